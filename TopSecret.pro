@@ -12,13 +12,19 @@ CONFIG -= app_bundle
 # QMAKE_LFLAGS += -lSDL2main -lSDL2 -lSDL2_image -mwindows
 # QMAKE_LINK += -lSDL2main -lSDL2 -lSDL2_image -mwindows
 
-# SFML stuff
-SFML_PATH = D:\SFML
-LIBS += -L$${SFML_PATH}\lib -lsfml-main -lsfml-window -lsfml-system -lsfml-graphics
-INCLUDEPATH += $${SFML_PATH}\include
+# SFML stuff. Build with "CONFIG += headless" to leave out the windowed renderer and the SFML dependency
+headless {
+    DEFINES += PSX_HEADLESS
+} else {
+    SFML_PATH = D:\SFML
+    LIBS += -L$${SFML_PATH}\lib -lsfml-main -lsfml-window -lsfml-system -lsfml-graphics
+    INCLUDEPATH += $${SFML_PATH}\include
 
-QMAKE_LFLAGS += -lsfml-main -lsfml-window -lsfml-system -lsfml-graphics
-QMAKE_LINK += -lsfml-main -lsfml-window -lsfml-system -lsfml-graphics
+    QMAKE_LFLAGS += -lsfml-main -lsfml-window -lsfml-system -lsfml-graphics
+    QMAKE_LINK += -lsfml-main -lsfml-window -lsfml-system -lsfml-graphics
+
+    SOURCES += src/GPU/window_renderer.cpp
+}
 
 # The following define makes your compiler emit warnings if you use
 # any Qt feature that has been marked deprecated (the exact warnings
@@ -32,33 +38,76 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    src/CDROM/cdrom.cpp \
+    src/CDROM/compressed_disc.cpp \
+    src/CDROM/disc.cpp \
+    src/CDROM/iso9660.cpp \
+    src/CDROM/xa_adpcm.cpp \
     src/CPU/alu.cpp \
     src/CPU/branches.cpp \
     src/CPU/cop0.cpp \
     src/CPU/cpu.cpp \
     src/CPU/exceptions.cpp \
     src/CPU/loads_stores.cpp \
+    src/GPU/display.cpp \
     src/GPU/draw_calls.cpp \
+    src/GPU/frame_cache.cpp \
+    src/GPU/frameskip.cpp \
     src/GPU/gp0.cpp \
     src/GPU/gp1.cpp \
     src/GPU/gpu.cpp \
+    src/GPU/gpu_recorder.cpp \
+    src/GPU/rasterizer.cpp \
+    src/GPU/renderer.cpp \
+    src/GPU/software_renderer.cpp \
+    src/GPU/span_kernels.cpp \
+    src/GPU/texture_cache.cpp \
+    src/GPU/upscaler.cpp \
     src/GPU/vram.cpp \
+    src/SPU/reverb.cpp \
+    src/SPU/spu.cpp \
     src/bus.cpp \
     src/dma.cpp \
     src/main.cpp \
-    src/psx.cpp
+    src/mdec.cpp \
+    src/psx.cpp \
+    src/scheduler.cpp
 
 HEADERS += \
+    include/audio_ring.h \
     include/bus.h \
+    include/cdrom.h \
+    include/compressed_disc.h \
     include/cop0.h \
     include/cpu.h \
+    include/disc.h \
+    include/display.h \
     include/dma.h \
+    include/draw_state.h \
+    include/frame_cache.h \
+    include/frameskip.h \
     include/gpu.h \
+    include/gpu_recorder.h \
     include/helpers.h \
+    include/iso9660.h \
+    include/mdec.h \
+    include/null_renderer.h \
     include/psx.h \
+    include/rasterizer.h \
     include/renderer.h \
+    include/scheduler.h \
+    include/simd.h \
+    include/software_renderer.h \
+    include/span_kernels.h \
+    include/spu.h \
     include/termcolor.hpp \
-    include/types.h
+    include/texture_cache.h \
+    include/types.h \
+    include/upscaler.h \
+    include/vertex_arena.h \
+    include/vram.h \
+    include/window_renderer.h \
+    include/xa_adpcm.h
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
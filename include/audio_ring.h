@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include "types.h"
+
+struct StereoSample {
+    s16 left;
+    s16 right;
+};
+
+// Fixed size FIFO of 44.1kHz stereo samples, between a producer (like the CD-ROM's XA decoder) and the audio mixer.
+// Both ends run on the emulator thread. When it's full, new samples are dropped rather than overwriting ones that weren't played yet
+class AudioRing {
+public:
+    static constexpr size_t CAPACITY = 32768; // a power of 2, about 0.75s
+
+    auto size() const -> size_t { return writePos - readPos; }
+    auto space() const -> size_t { return CAPACITY - size(); }
+    auto droppedSamples() const -> size_t { return dropped; }
+
+    void push (StereoSample sample) {
+        if (size() == CAPACITY) {
+            dropped++;
+            return;
+        }
+
+        buffer[writePos++ & (CAPACITY - 1)] = sample;
+    }
+
+    auto pop() -> StereoSample { // silence if there's nothing buffered
+        if (size() == 0)
+            return { 0, 0 };
+
+        return buffer[readPos++ & (CAPACITY - 1)];
+    }
+
+    auto pop (StereoSample* dest, size_t count) -> size_t { // how many samples it popped
+        const auto available = count < size() ? count : size();
+        for (size_t i = 0; i < available; i++)
+            dest[i] = buffer[readPos++ & (CAPACITY - 1)];
+
+        return available;
+    }
+
+    void clear() { readPos = writePos = 0; }
+
+private:
+    std::array <StereoSample, CAPACITY> buffer;
+    size_t readPos = 0; // both only ever go up, the buffer index is their low bits
+    size_t writePos = 0;
+    size_t dropped = 0;
+};
@@ -3,7 +3,11 @@
 #include <vector>
 #include "types.h"
 #include "dma.h"
+#include "cdrom.h"
+#include "spu.h"
 #include "gpu.h"
+#include "mdec.h"
+#include "scheduler.h"
 
 class Bus {
     const std::array <u32, 8> REGION_MASKS = {
@@ -18,19 +22,54 @@ class Bus {
     std::vector<u8> scratchpad;
     std::vector<u8> BIOS;
 
+    // Interrupt controller
+    static constexpr u32 IRQ_CDROM = 1 << 2;
+    static constexpr u32 IRQ_DMA = 1 << 3;
+    static constexpr u32 IRQ_SPU = 1 << 9;
+    u32 interruptStatus = 0; // I_STAT
+    u32 interruptMask = 0; // I_MASK
+
     // DMA stuff
     DPCR_t DMAControl;
     DICR_t DMAInterruptControl;
     std::array <DMAChannel, 7> DMAChannels;
 
     void writeToDMAControl(int channel, u32 val);
-    void DMA_transferBlock (SyncMode syncMode, Direction direction, Device device, u32 offset, u32 baseAddr, s64 length);
-    void DMA_transferLLs (Direction direction, Device device, u32 offset, u32 baseAddr);
+    void writeToDPCR (u32 val);
+    void writeToDICR (u32 val);
+    auto readDMARegister (u32 address) -> u32; // base address, block control and channel control of a channel
+    void DMA_start (int channel);
+    void DMA_kick(); // schedule a DMA step if none is pending
+    void DMA_step(); // scheduler event: complete channels that are done, then give the bus to the highest priority ready channel
+    auto DMA_runSlice (int channel) -> u32;
+    auto DMA_canRun (int channel) -> bool;
+    auto DMA_deviceReady (int channel) -> bool;
+    auto DMA_sliceWords (const DMAChannel& dma) -> u32;
+    auto DMA_priority (int channel) -> u32;
+    void DMA_transferWords (Direction direction, Device device, DMAChannel& dma, u32 count);
+    void DMA_clearOrderingTable (DMAChannel& dma, u32 count);
+    auto DMA_transferLLs (DMAChannel& dma, u32& words) -> bool;
+    // Linked list walking. Only the GPU channel runs linked lists, so there's one walk at a time
+    static constexpr u32 LL_MAX_NODES = 0x20'0000 / 4; // no list can have more distinct nodes than RAM has words
+    std::vector <u32> LLVisited; // for every word of RAM, the generation of the last walk that used it as a node header
+    u32 LLGeneration = 0; // bumped for every linked list transfer
+    u32 LLStart = 0; // first node of the current walk
+    u32 LLNodes = 0; // nodes visited by the current walk
+    LinkedListStats LLStats; // stats of the frame being run
+    LinkedListStats lastFrameLLStats; // stats of the last complete frame
+
+    void DMA_sendToGP0 (u32 addr, u32 count); // hand count words of RAM starting at addr to GP0, without copying them
+    void updateDMAIRQ();
     void markDMAComplete (int channel);
 
     // GPU stuff
     class GPU* gpu;
 
+    Scheduler* scheduler;
+    MDEC mdec;
+    class CDROM cdrom;
+    class SPU spu;
+
 public:
     u8 read8 (u32 address);
     u16 read16 (u32 address);
@@ -39,7 +78,12 @@ public:
     void write8  (u32 address, u8 value);
     void write16 (u32 address, u16 value);
     void write32 (u32 address, u32 value);
-    Bus(class GPU* _gpu);
+    Bus(class GPU* _gpu, Scheduler* _scheduler);
+    void newFrame();
+    void insertDisc (std::unique_ptr <Disc> disc) { cdrom.insertDisc (std::move (disc)); }
+    auto disc() -> Disc* { return cdrom.getDisc(); } // nullptr if there's no disc in the drive
+    void loadToRAM (u32 address, const u8* data, size_t size); // copy a whole block into RAM at once, wrapping around its end
+    auto linkedListStats() -> const LinkedListStats& { return lastFrameLLStats; } // stats of the last complete frame
 
     std::vector<u8> ROM;
 };
@@ -0,0 +1,130 @@
+#pragma once
+#include <array>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "types.h"
+#include "audio_ring.h"
+#include "disc.h"
+#include "scheduler.h"
+#include "xa_adpcm.h"
+
+/*
+ * The CD-ROM controller at 1F801800-1F801803. Commands are written with their parameters, and answered with interrupts that each
+ * come with a response: INT3 acknowledges a command, INT2 completes a command that takes a while (seeks, pauses, GetID...),
+ * INT1 reports that a sector was read into the sector buffer, and INT5 reports errors. The CPU has to acknowledge an interrupt
+ * before the next one gets delivered, so they're queued up until then.
+ * Command processing, seeks and sector reads take time, which the scheduler counts out. Sectors are read from the disc image
+ * when the emulated drive gets to them, and the image gets told where reading continues, so it can have the next sectors ready.
+ * With XA-ADPCM enabled in the mode, real-time audio sectors (of the file and channel set by Setfilter, if filtering is on)
+ * are decoded into a buffer the audio mixer plays from, and never reach the CPU
+*/
+
+class CDROM {
+    static constexpr u32 CPU_CLOCK = 33'868'800;
+    static constexpr u32 SECTOR_CYCLES = CPU_CLOCK / 75; // at single speed. Double speed reads twice as fast
+    static constexpr u32 FIRST_RESPONSE_CYCLES = 50'401; // roughly, from writing a command to its INT3
+    static constexpr u32 INIT_RESPONSE_CYCLES = 81'102;
+    static constexpr u32 SECOND_RESPONSE_CYCLES = 33'868; // roughly, from INT3 to INT2 for commands that don't seek or spin anything
+    static constexpr u32 SEEK_BASE_CYCLES = 33'868; // 1ms, plus SEEK_CYCLES_PER_SECTOR for every sector of distance
+    static constexpr u32 SEEK_CYCLES_PER_SECTOR = 16;
+    static constexpr u32 MAX_SEEK_CYCLES = CPU_CLOCK / 10;
+    static constexpr u32 NOT_READY_RETRY_CYCLES = SECTOR_CYCLES / 16; // how long to wait for the disc image when a sector isn't ready
+
+    enum Status : u8 { // the stat byte most responses start with
+        StatError = 1 << 0,
+        StatMotorOn = 1 << 1,
+        StatSeekError = 1 << 2,
+        StatIDError = 1 << 3,
+        StatShellOpen = 1 << 4,
+        StatReading = 1 << 5,
+        StatSeeking = 1 << 6,
+        StatPlaying = 1 << 7
+    };
+
+    enum Mode : u8 { // Setmode bits
+        ModeCDDA = 1 << 0,
+        ModeAutoPause = 1 << 1,
+        ModeReport = 1 << 2,
+        ModeXAFilter = 1 << 3,
+        ModeIgnoreBit = 1 << 4,
+        ModeWholeSector = 1 << 5, // hand out 0x924 bytes of every sector instead of 0x800
+        ModeXAADPCM = 1 << 6,
+        ModeDoubleSpeed = 1 << 7
+    };
+
+    enum Submode : u8 { // subheader byte 2 of Mode 2 sectors
+        SubmodeAudio = 1 << 2,
+        SubmodeRealTime = 1 << 6
+    };
+
+    struct Response {
+        u8 interrupt; // 1-5
+        std::vector <u8> bytes;
+    };
+
+    Scheduler* scheduler;
+    std::function <void()> irq; // raises the CD-ROM IRQ in I_STAT
+    std::unique_ptr <Disc> disc;
+
+    // Host interface
+    u8 index = 0; // selects what 1F801801-1F801803 access
+    u8 interruptEnable = 0;
+    u8 interruptFlag = 0;
+    std::deque <u8> parameters;
+    std::vector <u8> responseFifo;
+    size_t responsePos = 0;
+    std::deque <Response> pendingResponses; // waiting for the previous interrupt to be acknowledged
+    u8 pendingCommand = 0;
+    std::vector <u8> commandParameters; // parameters of the command being processed
+    bool commandBusy = false;
+
+    // Data
+    std::array <u8, Disc::SECTOR_SIZE> sectorBuffer; // the last sector read
+    std::vector <u8> dataFifo; // the part of sectorBuffer the CPU or DMA3 reads out, loaded on request
+    size_t dataPos = 0;
+
+    // Drive
+    u8 stat = StatMotorOn;
+    u8 mode = 0;
+    u32 seekTarget = Disc::PREGAP; // sector set by Setloc
+    bool seekPending = false; // Setloc was sent and no seek or read went there yet
+    u32 position = Disc::PREGAP; // sector under the head
+    u8 secondResponseCommand = 0; // command whose INT2 is scheduled
+    u8 filterFile = 0; // XA file and channel set by Setfilter
+    u8 filterChannel = 0;
+    std::array <u8, 8> lastHeader {}; // header and subheader of the last data sector read, for GetlocL
+    std::array <u8, 4> volume { 0x80, 0, 0x80, 0 }; // L->L, L->R, R->R, R->L CD audio volumes
+    std::array <u8, 4> pendingVolume { 0x80, 0, 0x80, 0 }; // latched into volume by the apply bit
+    bool muted = false; // by Mute, until Demute
+
+    // XA audio
+    XADecoder xaDecoder;
+    AudioRing xaAudio; // decoded samples at 44.1kHz, for the mixer
+
+    void queueResponse (u8 interrupt, std::vector <u8> bytes);
+    void deliverResponse(); // hand out the next queued response, if the last one was acknowledged
+    void executeCommand(); // scheduler event: the command's processing time is up
+    void secondResponse(); // scheduler event
+    void readSector(); // scheduler event: the head reached the next sector
+    void startReading();
+    void stopReading();
+    void error (u8 code);
+    auto sectorCycles() const -> u32 { return (mode & ModeDoubleSpeed) ? SECTOR_CYCLES / 2 : SECTOR_CYCLES; }
+    auto seekCycles() const -> u32;
+    void loadDataFifo();
+    auto playXA() -> bool; // decode the sector in the sector buffer if it's XA audio for us, false if it's data for the CPU
+
+public:
+    CDROM (Scheduler* _scheduler, std::function <void()> _irq);
+
+    void insertDisc (std::unique_ptr <Disc> _disc);
+    auto hasDisc() const -> bool { return disc != nullptr; }
+    auto getDisc() -> Disc* { return disc.get(); }
+
+    auto read (u32 address) -> u8; // 1F801800-1F801803
+    void write (u32 address, u8 value);
+    void readData (u8* dest, size_t count); // DMA3
+    auto audio() -> AudioRing& { return xaAudio; } // CD audio output, consumed by the mixer
+};
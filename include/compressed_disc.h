@@ -0,0 +1,136 @@
+#pragma once
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "types.h"
+#include "disc.h"
+
+/*
+ * Compressed disc images (.cdz). The sectors from 00:02:00 to the lead-out are cut into hunks of a fixed number of sectors,
+ * and every hunk is compressed on its own, so any sector can be read by decompressing just the hunk it's in.
+ * File layout, all little endian:
+ *     Header
+ *     TrackEntry * trackCount
+ *     HunkEntry * hunkCount   - hunk n holds sectors firstSector + n * hunkSectors onwards, so finding one is a single index
+ *     hunk data               - each hunk LZ4 (block format) compressed, or stored as is if it doesn't get any smaller
+ * Every hunk entry carries the CRC32 of the decompressed hunk, which is checked whenever the hunk gets decompressed.
+ * Decompressed hunks are kept in a cache shared by every image open in the process, so instances running the same disc
+ * decompress each hunk once between them. A read-ahead thread decompresses the hunks after the last sector asked for into the
+ * cache, so reading them doesn't page in, decompress or checksum anything on the emulation thread
+*/
+
+namespace CompressedDiscFormat {
+    constexpr char MAGIC[8] = { 'T', 'S', 'C', 'D', 'Z', '\x1A', 0, 0 };
+    constexpr u32 VERSION = 1;
+    constexpr u32 DEFAULT_HUNK_SECTORS = 8;
+    constexpr u32 MAX_HUNK_SECTORS = 64;
+
+    struct Header {
+        char magic[8];
+        u32 version;
+        u32 hunkSectors; // sectors per hunk, the last hunk is padded with zeroes
+        u32 hunkCount;
+        u32 trackCount;
+        u32 firstSector; // sector the first hunk starts at
+        u32 leadOut; // first sector past the last track
+    };
+
+    struct TrackEntry {
+        u32 number;
+        u32 audio;
+        u32 start;
+    };
+
+    struct HunkEntry {
+        u64 offset; // from the start of the file
+        u32 length; // compressed length, hunkSectors * Disc::SECTOR_SIZE if the hunk is stored as is
+        u32 crc; // CRC32 of the decompressed hunk
+    };
+
+    static_assert (sizeof (Header) == 32 && sizeof (TrackEntry) == 12 && sizeof (HunkEntry) == 16, "Disc image structures must match the file layout");
+
+    auto crc32 (const u8* data, size_t size) -> u32;
+    void compress (const u8* source, size_t size, std::vector <u8>& dest); // appends to dest
+    auto decompress (const u8* source, size_t size, u8* dest, size_t destSize) -> bool; // false if the data is corrupt or doesn't fill dest exactly
+}
+
+// LRU cache of decompressed hunks, shared by every compressed image in the process. Hunks are keyed by their image's identity
+// (a hash of its header and hunk index, so the same image opened twice shares hunks) and their index
+class HunkCache {
+public:
+    using Hunk = std::shared_ptr <const std::vector <u8>>; // readers keep the hunk alive even if it gets evicted
+
+    static constexpr size_t DEFAULT_CAPACITY = 64 * 1024 * 1024; // bytes
+
+    static auto instance() -> HunkCache&;
+
+    auto find (u64 image, u32 hunk) -> Hunk; // nullptr on a miss
+    void insert (u64 image, u32 hunk, Hunk data);
+    void setCapacity (size_t bytes);
+
+private:
+    struct Key {
+        u64 image;
+        u32 hunk;
+        bool operator== (const Key& other) const { return image == other.image && hunk == other.hunk; }
+    };
+
+    struct KeyHash {
+        size_t operator() (const Key& key) const { return (size_t) (key.image ^ ((u64) key.hunk * 0x9E37'79B9'7F4A'7C15)); }
+    };
+
+    using Entry = std::pair <Key, Hunk>;
+
+    std::mutex mutex;
+    std::list <Entry> entries; // most recently used first
+    std::unordered_map <Key, std::list <Entry>::iterator, KeyHash> lookup;
+    size_t size = 0; // bytes of hunk data held
+    size_t capacity = DEFAULT_CAPACITY;
+
+    void evict();
+};
+
+class CompressedDisc : public Disc {
+    static constexpr u32 READ_AHEAD_SECTORS = 128; // how far ahead of the reader the read-ahead thread stays, like BinCueDisc
+
+    MappedFile file;
+    CompressedDiscFormat::Header header;
+    std::vector <CompressedDiscFormat::HunkEntry> hunks;
+    u64 identity; // key of this image in the hunk cache
+
+    u32 currentIndex = ~0u; // last hunk read from, so sequential reads don't go through the cache for every sector
+    HunkCache::Hunk current;
+
+    // Read-ahead. The thread loads the hunks from target's up to target + READ_AHEAD_SECTORS into the hunk cache
+    std::thread readAhead;
+    std::mutex mutex;
+    std::condition_variable wake;
+    u32 target = 0;
+    bool quit = false;
+
+    auto hunkOf (u32 sector) const -> u32 { return (sector - header.firstSector) / header.hunkSectors; }
+    auto loadHunk (u32 index) -> HunkCache::Hunk;
+    void readAheadLoop();
+
+public:
+    CompressedDisc (const std::string& path);
+    ~CompressedDisc() override;
+
+    void readSector (u32 sector, u8* dest) override;
+    auto isSectorReady (u32 sector) -> bool override;
+    void prefetch (u32 sector) override;
+
+    struct ConvertStats {
+        u32 hunks;
+        u32 storedHunks; // hunks that didn't compress and were stored as is
+        u64 inputBytes;
+        u64 outputBytes;
+    };
+
+    static auto convert (Disc& source, const std::string& path, u32 hunkSectors = CompressedDiscFormat::DEFAULT_HUNK_SECTORS) -> ConvertStats;
+};
@@ -138,4 +138,5 @@ public:
 
     void step();
     void sideload_init_regs (u32 newPC, u32 newSP, u32 newGP);
+    auto pc() const -> u32 { return currentPC; } // the address of the next instruction to be fetched
 };
@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "types.h"
+
+/*
+ * Disc images. Sectors are addressed by their absolute position on the disc in frames, the same numbering as MSF times:
+ * (minutes * 60 + seconds) * 75 + frames. The first track's data starts at 00:02:00, sector 150.
+ * Every sector is read raw, 2352 bytes with its sync pattern and header
+*/
+
+struct DiscTrack {
+    u32 number; // 1-99
+    bool audio;
+    u32 start; // sector of its INDEX 01
+};
+
+class Disc {
+public:
+    static constexpr u32 SECTOR_SIZE = 2352;
+    static constexpr u32 PREGAP = 150; // sectors before the first track's data, 2 seconds
+
+    virtual ~Disc() = default;
+
+    virtual void readSector (u32 sector, u8* dest) = 0; // sectors no track covers read as zeroes
+    virtual auto isSectorReady (u32) -> bool { return true; } // could readSector get the sector without waiting on the host's disk?
+    virtual void prefetch (u32) {} // reading is going to carry on from this sector
+
+    auto tracks() const -> const std::vector <DiscTrack>& { return trackList; }
+    auto leadOut() const -> u32 { return end; } // first sector past the last track
+    auto trackAt (u32 sector) const -> const DiscTrack&;
+
+    static auto open (const std::string& path) -> std::unique_ptr <Disc>; // picks the format from the extension
+
+protected:
+    std::vector <DiscTrack> trackList;
+    u32 end = PREGAP;
+};
+
+// A read only view of a whole file, mapped into memory
+class MappedFile {
+    const u8* pointer = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+
+public:
+    MappedFile (const std::string& path); // panics if the file can't be mapped
+    ~MappedFile();
+    MappedFile (const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    auto data() const -> const u8* { return pointer; }
+    auto size() const -> size_t { return length; }
+};
+
+/*
+ * BIN/CUE images, one or more BIN files described by a CUE sheet (or a lone BIN, read as a single data track).
+ * The BINs are memory mapped, and a read-ahead thread touches the pages of the sectors after the last one asked for,
+ * so by the time the emulated drive gets to them they're in memory and reading them doesn't wait on the host's disk
+*/
+class BinCueDisc : public Disc {
+    static constexpr u32 READ_AHEAD_SECTORS = 128; // how far ahead of the reader the read-ahead thread stays
+    static constexpr u32 PAGE_SIZE = 4096;
+
+    struct Extent { // a run of sectors stored back to back in one of the files
+        u32 start; // first sector on the disc
+        u32 length;
+        u32 file;
+        size_t offset; // byte offset of the first sector in the file
+    };
+
+    std::vector <std::unique_ptr <MappedFile>> files;
+    std::vector <Extent> extents; // sorted by start, gaps between them are pregaps that aren't stored
+
+    // Read-ahead. hotWindow is the window [start, end) of sectors the thread has touched, it's moved on towards target + READ_AHEAD_SECTORS.
+    // Both ends share one atomic (start in the low half), so readers never see one end moved without the other
+    std::thread readAhead;
+    std::mutex mutex;
+    std::condition_variable wake;
+    u32 target = 0;
+    bool quit = false;
+    std::atomic <u64> hotWindow { 0 };
+
+    static auto packWindow (u32 start, u32 end) -> u64 { return start | ((u64) end << 32); }
+
+    void parseCue (const std::string& path);
+    void addFile (const std::string& path);
+    auto findSector (u32 sector) const -> const u8*; // nullptr for sectors in pregaps
+    void readAheadLoop();
+
+public:
+    BinCueDisc (const std::string& path); // a .cue sheet or a .bin
+    ~BinCueDisc() override;
+
+    void readSector (u32 sector, u8* dest) override;
+    auto isSectorReady (u32 sector) -> bool override;
+    void prefetch (u32 sector) override;
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include "types.h"
+#include "vram.h"
+
+// The part of VRAM that's currently being sent to the TV, as configured through GP1(05h..08h)
+struct DisplayArea {
+    u32 x, y; // top-left corner in VRAM (x is in halfwords, even in 24-bit mode)
+    u32 width, height; // in pixels. 0 when the display is disabled
+    bool is24bit; // pixels are packed 3 bytes each instead of being 1555 halfwords
+
+    auto vramWidth() const -> u32 { // how many VRAM halfwords a line of the display area covers
+        return is24bit ? (width * 3 + 1) / 2 : width;
+    }
+
+    auto operator== (const DisplayArea& other) const -> bool {
+        return x == other.x && y == other.y && width == other.width && height == other.height && is24bit == other.is24bit;
+    }
+};
+
+/*
+ * The display stage. Cuts the display area out of VRAM and converts it into a tightly packed frame
+ * that output sinks (the window, screenshots, video dumps) can use as is.
+ * This runs for every presented frame, so the row converters are vectorized with SSE2/SSSE3/AVX2 where available
+*/
+
+namespace Display {
+    enum class PixelFormat {
+        RGBA8888, // 4 bytes per pixel, R first
+        RGB888 // 3 bytes per pixel, R first
+    };
+
+    // Row converters. The 24-bit ones take a byte pointer, since 24-bit pixels don't line up with VRAM halfwords
+    void convert15ToRGBA (const u16* src, u32* dest, u32 count);
+    void convert24ToRGBA (const u8* src, u32* dest, u32 count);
+    void convert15ToRGB (const u16* src, u8* dest, u32 count);
+
+    // Extract the display area into frame (resized to fit), returns the size of a line in bytes
+    auto extract (const VRAM& vram, const DisplayArea& area, PixelFormat format, std::vector <u8>& frame) -> u32;
+
+    // Same, from a 15-bit render target scale times the size of VRAM on each axis (see upscaler.h). The frame is scale times the size
+    // of the display area, or with downsample, the size of the display area, with every scale x scale square of pixels averaged into one
+    auto extractScaled (const u16* pixels, u32 scale, const DisplayArea& area, PixelFormat format, bool downsample, std::vector <u8>& frame) -> u32;
+}
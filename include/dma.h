@@ -105,6 +105,13 @@ union LinkedListNode { // for DMAing LLs of GPU commands
     };
 };
 
+struct LinkedListStats { // what linked list DMAs sent to the GPU
+    u32 lists = 0; // linked list transfers that ended
+    u32 nodes = 0;
+    u32 emptyNodes = 0; // nodes without any commands, eg the unused entries of an ordering table
+    u64 words = 0; // node headers included
+};
+
 enum Direction {
     ToRAM = 0,
     FromRAM
@@ -135,11 +142,26 @@ struct DMAChannel {
     u32 baseAddr;
     int channelNumber;
 
+    // Progress of the transfer the channel is running (see Bus::DMA_step)
+    bool active; // started and not completed yet
+    bool finishing; // the last slice was sent, the channel completes once the bus is done with it
+    u32 currentAddr; // address of the next word to transfer
+    u32 wordsLeft; // words left in the whole transfer (sync modes 0 and 1)
+    u32 blockWordsLeft; // words left in the current block (sync mode 1)
+    u64 readyAt; // timestamp from which the channel can have the bus again
+
     DMAChannel() {
         control.raw = 0;
         blockControl.raw = 0;
         baseAddr = 0;
         channelNumber = 0; // set in the bus constructor
+
+        active = false;
+        finishing = false;
+        currentAddr = 0;
+        wordsLeft = 0;
+        blockWordsLeft = 0;
+        readyAt = 0;
     }
 
     auto isEnabled() -> bool {
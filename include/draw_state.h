@@ -0,0 +1,43 @@
+#pragma once
+#include "types.h"
+
+// A snapshot of the GPU state a primitive is drawn with
+struct DrawState {
+    u32 texpage_x; // base of the texture page in VRAM (in halfwords)
+    u32 texpage_y;
+    u32 texture_depth; // (0=4bit, 1=8bit, 2=15bit)
+    u32 clut_x; // position of the CLUT in VRAM (4bpp/8bpp textures only)
+    u32 clut_y;
+
+    u32 window_u_and; // texture window, applied as (u & and) | or
+    u32 window_u_or;
+    u32 window_v_and;
+    u32 window_v_or;
+
+    bool semi_transparent; // whether the primitive is semi-transparent
+    u32 semi_transparency; // (0=B/2+F/2, 1=B+F, 2=B-F, 3=B+F/4)
+    bool dither;
+    bool set_mask; // set the mask bit of every pixel drawn
+    bool check_mask; // don't draw over pixels with the mask bit set
+
+    s32 clip_left; // drawing area, inclusive
+    s32 clip_top;
+    s32 clip_right;
+    s32 clip_bottom;
+
+    auto operator== (const DrawState& other) const -> bool { // compared field by field, the padding bytes are never initialized
+        return texpage_x == other.texpage_x && texpage_y == other.texpage_y && texture_depth == other.texture_depth &&
+               clut_x == other.clut_x && clut_y == other.clut_y &&
+               window_u_and == other.window_u_and && window_u_or == other.window_u_or &&
+               window_v_and == other.window_v_and && window_v_or == other.window_v_or &&
+               semi_transparent == other.semi_transparent && semi_transparency == other.semi_transparency &&
+               dither == other.dither && set_mask == other.set_mask && check_mask == other.check_mask &&
+               clip_left == other.clip_left && clip_top == other.clip_top && clip_right == other.clip_right && clip_bottom == other.clip_bottom;
+    }
+};
+
+struct RasterVertex {
+    s32 x, y; // screen coordinates, drawing offset already applied
+    u32 color; // 24-bit BGR color, as sent over GP0
+    u32 u, v; // texture coordinates
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+#include <vector>
+#include "types.h"
+#include "vram.h"
+#include "vertex_arena.h"
+
+/*
+ * Memoizes the output of segments of draw commands. A segment is everything the vertex arena collects between two flushes,
+ * which for most games means everything drawn in a frame.
+ * A segment's output only depends on its primitives and draw state, the textures and CLUTs it samples and the VRAM it draws over,
+ * so the key is made from a hash of the batches, the VRAM generations of the texture pages/CLUTs, and a hash of the contents of the
+ * region the segment can draw to (the union of its drawing areas). When a key comes up again, the region as it was after drawing
+ * the segment last time is copied back, and nothing gets rasterized.
+ * This pays off in menus, pause screens and loading loops that send the same command stream every frame
+*/
+
+class FrameCache {
+    static constexpr u32 ENTRY_COUNT = 4; // enough for double buffering with a couple of segments per frame
+    static constexpr u32 MIN_VERTICES = 64; // smaller segments are cheaper to draw than to look up
+    static constexpr u32 REPORT_INTERVAL = 300; // frames between hit rate reports
+
+    struct Region { // inclusive bounds
+        s32 left, top, right, bottom;
+    };
+
+    struct Entry {
+        u64 key = 0;
+        bool valid = false;
+        Region region;
+        u32 lastUsed = 0;
+        std::vector <u16> pixels; // the region after the segment was drawn
+    };
+
+    std::array <Entry, ENTRY_COUNT> entries;
+    u32 useCounter = 0;
+    u32 framesSinceReport = 0;
+
+    // the segment lookup missed on, which store saves once it's drawn
+    bool pending = false;
+    u64 pendingKey = 0;
+    Region pendingRegion;
+
+    static auto hashRegion (const VRAM& vram, const Region& region) -> u64;
+    static auto segmentKey (VRAM& vram, const VertexArena& arena, const Region& region) -> u64;
+
+public:
+    struct Stats {
+        u32 segments = 0; // segments big enough to be looked up
+        u32 hits = 0;
+        u32 primitivesSkipped = 0;
+    };
+
+    bool enabled = false;
+    Stats stats; // since the last report
+
+    // Called before drawing a segment. Returns true if it was already drawn with the same inputs, in which case its output has been
+    // written back to VRAM and it must not be drawn again
+    auto lookup (VRAM& vram, const VertexArena& arena) -> bool;
+    // Called after drawing a segment that lookup returned false for
+    void store (const VRAM& vram);
+    void endFrame(); // prints the hit rate every REPORT_INTERVAL frames
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include "types.h"
+#include "vram.h"
+#include "draw_state.h"
+
+enum class FrameSkipMode {
+    Off,
+    Fixed, // draw 1 frame, skip the next N
+    Auto // skip the next frame whenever the last one went over the host time budget
+};
+
+/*
+ * Frameskip. In a skipped frame, draw commands are still parsed and queued, but batches are only drawn if they might be read back:
+ * if their drawing area covers VRAM that was recently used as a texture page, a CLUT or the source of a VRAM->VRAM/VRAM->CPU copy
+ * (render-to-texture targets, framebuffer effects, screenshots read by the game). Everything else is dropped, and the frame isn't presented.
+ * VRAM transfers and fills never go through the vertex arena, so they run as usual.
+ * Since dropped primitives never touch VRAM, texture reads and the display stay consistent with what's actually in VRAM
+*/
+
+class FrameSkipper {
+    static constexpr u32 MAX_CONSECUTIVE_SKIPS = 4; // auto mode still presents at least every 5th frame
+    static constexpr u32 SAMPLE_WINDOW = 120; // frames a block stays marked as a readback source after it was last read
+    static constexpr u32 REPORT_INTERVAL = 300; // frames between metric reports
+
+    using Clock = std::chrono::steady_clock;
+
+    std::array <u32, VRAM::BLOCKS_PER_ROW * VRAM::BLOCKS_PER_COLUMN> lastSampled; // the frame each VRAM block was last read back in (0 = never)
+    u32 frame = SAMPLE_WINDOW + 1; // starts past the window, so blocks that were never read don't count as recently read
+    u32 consecutiveSkips = 0;
+    bool skipThisFrame = false;
+
+    Clock::time_point frameStart;
+    double drawTime = 0.0; // ms spent drawing in the current frame
+    double averageDrawTime = 0.0; // ms spent drawing in a drawn frame, on average
+    u32 framesSinceReport = 0;
+
+public:
+    struct Stats {
+        u32 framesDrawn = 0;
+        u32 framesSkipped = 0;
+        u32 primitivesDropped = 0;
+        double timeSaved = 0.0; // ms, estimated from the average time drawn frames spend drawing
+    };
+
+    FrameSkipMode mode = FrameSkipMode::Off;
+    u32 fixedSkip = 1; // frames skipped after each drawn frame in Fixed mode
+    double budget = 1000.0 / 60.0; // host ms per frame in Auto mode
+    Stats stats; // since the last report
+
+    FrameSkipper();
+
+    auto skipping() const -> bool { return skipThisFrame; }
+
+    void markSampled (u32 x, u32 y, u32 width, u32 height); // the rectangle is read back by a copy or readback
+    void markTextureSource (const DrawState& state); // the texture page/CLUT of a textured batch is read back
+    auto isSampled (const DrawState& state) -> bool; // whether the drawing area of a batch covers anything that was read back recently
+
+    void addDrawTime (double ms) { drawTime += ms; }
+    void endFrame(); // account for the frame that just ended and decide whether to skip the next one
+};
@@ -1,12 +1,18 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <memory>
+#include <string>
+#include <vector>
 #include "types.h"
+#include "vram.h"
 #include "renderer.h"
+#include "vertex_arena.h"
+#include "frame_cache.h"
+#include "frameskip.h"
+#include "gpu_recorder.h"
 #include "helpers.h"
 
-const auto WIDTH = 1024;
-const auto HEIGHT = 512;
-
 union GPUSTAT {
     u32 raw;
 
@@ -59,14 +65,14 @@ union GP0_cmd {
     struct {
         unsigned texture_x_page: 4;
         unsigned texture_y_page: 1;
-        unsigned semi_transparency: 3;
+        unsigned semi_transparency: 2;
         unsigned texture_depth: 2;
         unsigned dither: 1;
         unsigned draw_to_display: 1;
         unsigned texture_disable: 1;
         unsigned rectangle_texture_h_flip: 1;
         unsigned rectangle_texture_v_flip: 1;
-        unsigned padding: 17;
+        unsigned padding: 18;
     } draw_mode_params;
 
     GP0_cmd (u32 val) {
@@ -99,6 +105,18 @@ union GP1_cmd {
     }
 };
 
+struct GPUConfig {
+    RendererType renderer = RendererType::Window;
+    bool frameCache = false; // reuse the output of draw segments that were already drawn with the same inputs
+    FrameSkipMode frameskip = FrameSkipMode::Off;
+    u32 frameskipFixed = 1; // frames skipped after each drawn frame in fixed mode
+    double frameBudget = 1000.0 / 60.0; // host ms per frame in auto mode
+    TexelLayout textureLayout = TexelLayout::Linear; // memory layout of decoded texture pages
+    u32 resolutionScale = 1; // internal resolution: 1 (native), 2 or 4
+    bool downsample = false; // present higher internal resolutions averaged down to the native display size
+    std::string recordPath; // if set, everything sent to the GPU is logged to this file (see gpu_recorder.h)
+};
+
 class GPU {
 public:
     GPUSTAT status;
@@ -143,8 +161,26 @@ public:
 
     bool fetchingGP0Params = false; // whether we're fetching GP0 params or we're ready to execute GP0 opcodes
     bool fetchingTextureData = false; // if this is 1, GP0 is fetching texture data, NOT commands
-
-    BeegRenderer renderer; // the renderer;
+    bool fetchingPolyline = false; // if this is 1, GP0 is receiving polyline vertices until a terminator word
+
+    // polyline state. Only the previous vertex is kept around, so polylines of any length fit
+    RasterVertex polylineLastVertex;
+    u32 polylineColor = 0; // the color of the next vertex
+    u32 polylineVertexCount = 0; // number of vertices received so far
+    bool polylineShaded = false;
+    bool polylineSemiTransparent = false;
+    bool polylineExpectingColor = false; // shaded polylines alternate between color and vertex words
+
+    std::vector <u32> vramReadBuffer; // VRAM data prepared by GP0(C0h), streamed out word by word through GPUREAD
+    u32 vramReadIndex = 0; // the next word of vramReadBuffer GPUREAD is going to return
+    u32 gpureadLatch = 0; // GPUREAD keeps returning the last value once the buffer runs dry
+
+    VRAM vram;
+    std::unique_ptr <Renderer> renderer; // the renderer backend primitives are handed to
+    VertexArena primitives; // primitives queued up for the renderer, flushed before anything else touches VRAM and at the end of each frame
+    FrameCache frameCache;
+    FrameSkipper frameSkipper;
+    std::unique_ptr <GPURecorder> recorder; // null unless recording
     const unsigned int commandLengths[256] = {
             //0  1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
              1,  1,  3,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, //0
@@ -153,8 +189,8 @@ public:
              6,  6,  6,  6,  9,  9,  9,  9,  8,  8,  8,  8, 12, 12, 12, 12, //3
              3,  3,  3,  3,  3,  3,  3,  3, 16, 16, 16, 16, 16, 16, 16, 16, //4
              4,  4,  4,  4,  4,  4,  4,  4, 16, 16, 16, 16, 16, 16, 16, 16, //5
-             3,  3,  3,  1,  4,  4,  4,  4,  2,  1,  2,  1,  3,  3,  3,  3, //6
-             2,  1,  2,  1,  3,  3,  3,  3,  2,  1,  2,  2,  3,  3,  3,  3, //7
+             3,  3,  3,  3,  4,  4,  4,  4,  2,  2,  2,  2,  3,  3,  3,  3, //6
+             2,  2,  2,  2,  3,  3,  3,  3,  2,  2,  2,  2,  3,  3,  3,  3, //7
              4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4, //8
              4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4, //9
              3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3, //A
@@ -165,7 +201,15 @@ public:
              1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1  //F
     };
 
-    GPU() : renderer (WIDTH, HEIGHT, "Poopstation") { // initialize renderer
+    GPU (const GPUConfig& config) : renderer (Renderer::create (config.renderer, vram, config.resolutionScale, config.downsample)) { // initialize renderer
+        // There's nothing to memoize if nothing gets drawn. The frame cache only restores VRAM, so it's off at higher resolutions too
+        frameCache.enabled = config.frameCache && renderer -> drawsToVRAM() && config.resolutionScale == 1;
+        renderer -> setTextureLayout (config.textureLayout);
+        frameSkipper.mode = config.frameskip;
+        frameSkipper.fixedSkip = config.frameskipFixed;
+        frameSkipper.budget = config.frameBudget;
+        if (!config.recordPath.empty())
+            recorder = std::make_unique <GPURecorder> (config.recordPath);
         status.raw = 0x1C00'0000; // Signal that the GPU is ready to receive stuff from the CPU/DMAC
         rectangle_texture_h_flip = false; // turn texture flipping off
         rectangle_texture_v_flip = false;
@@ -175,8 +219,33 @@ public:
     }
 
     void gp0_command (u32 val);
+    void gp0_commands (const u32* words, size_t count); // a span of GP0 words, eg a DMA block or linked list node straight from RAM
     void gp1_command (u32 val);
+    void gp0_word (u32 val); // everything gp0_command does except recording
     void bufferCommand (u32 val); // buffer GP0 command
+    void executeBufferedCommand(); // run the multi-word command in commandParameters
+    void uploadTextureWords (const u32* words, u32 count); // write words of a CPU->VRAM transfer to VRAM
+    u32 gpuread(); // read from the GPUREAD port (0x1F801810)
+    void endFrame(); // called once per emulated frame, presents the frame through the renderer backend
+    void flushPrimitives(); // hand every queued batch to the renderer
+
+    auto allocatePrimitive (PrimitiveType type, u32 flags, const DrawState& state, u32 vertexCount) -> RasterVertex* {
+        auto dest = primitives.allocate (type, flags, state, vertexCount);
+        if (dest == nullptr) { // arena is full, make room
+            flushPrimitives();
+            dest = primitives.allocate (type, flags, state, vertexCount);
+        }
+
+        return dest;
+    }
+
+    static constexpr auto canonicalGP0Opcode (u32 opcode) -> u32 { // GP0(80h..DFh) are 3 blocks of 32 mirrors of GP0(80h), GP0(A0h) and GP0(C0h)
+        return (opcode >= 0x80 && opcode < 0xE0) ? (opcode & 0xE0) : opcode;
+    }
+
+    static constexpr auto isPolyline (u32 opcode) -> bool { // GP0(48h..4Fh) and GP0(58h..5Fh) are terminated by a marker word instead of having a fixed length
+        return (opcode & 0xE8) == 0x48;
+    }
 
     // config commands
     void gp1_softReset();
@@ -189,74 +258,141 @@ public:
     void gp0_set_drawing_area_top_left (GP0_cmd command);
     void gp0_set_drawing_area_bottom_right (GP0_cmd command);
     void gp0_load_texture();
+    void gp0_copy_vram_to_cpu();
+    void gp0_copy_vram_to_vram();
+    void gp0_fill_vram();
+    void gp0_polyline_start (u32 val);
+    void gp0_polyline_param (u32 val);
 
     void gp1_display_mode (GP1_cmd command);
     void gp1_set_display_area_start (GP1_cmd command);
     void gp1_set_display_horizontal_range (GP1_cmd command);
     void gp1_set_display_vertical_range (GP1_cmd command);
     void gp1_display_enable (GP1_cmd command);
+    auto displayArea() -> DisplayArea; // the VRAM rectangle the display registers currently select
 
     // draw commands
-    template <const bool semi_transparent>
-    void quad_monochrome () {
-        auto color = commandParameters[0] & 0xFF'FFFF; // the 24 bit RGB color of the quad
-
-        auto vertex1 = commandParameters[1];
-        auto vertex2 = commandParameters[2];
-        auto vertex3 = commandParameters[3];
-        auto vertex4 = commandParameters[4];
-
-        renderer.push_quad <semi_transparent> (vertex1, vertex2, vertex3, vertex4, color);
+    auto buildDrawState (u32 clut) -> DrawState; // snapshot the current drawing state for the rasterizer
+    void update_texpage (u32 texpage); // textured polygons carry their own texpage attribute, which also updates GPUSTAT
+
+    auto decodeVertex (u32 vertex) -> RasterVertex { // vertices are 11-bit signed coordinates, relative to the drawing offset
+        RasterVertex decoded;
+        decoded.x = (s32) Helpers::signExtend32 (vertex & 0x7FF, 11) + vertex_x_offs;
+        decoded.y = (s32) Helpers::signExtend32 ((vertex >> 16) & 0x7FF, 11) + vertex_y_offs;
+        decoded.color = 0;
+        decoded.u = 0;
+        decoded.v = 0;
+        return decoded;
     }
 
-    template <const bool semi_transparent>
-    void tri_monochrome() {
+    /*
+     * Polygons (GP0 20h..3Fh). The opcode bits describe the primitive:
+     * bit 0 = raw texture (no color modulation), bit 1 = semi-transparent, bit 2 = textured, bit 3 = quad, bit 4 = gouraud shaded
+     * Each vertex is sent as [color (first vertex, or every vertex if shaded)], position, [texcoord (if textured)]
+    */
+    template <const u32 opcode>
+    void draw_polygon() {
+        constexpr bool raw_texture = opcode & 1;
+        constexpr bool semi_transparent = opcode & 2;
+        constexpr bool textured = opcode & 4;
+        constexpr bool quad = opcode & 8;
+        constexpr bool shaded = opcode & 0x10;
+        constexpr auto vertexCount = quad ? 4 : 3;
+
+        std::array <RasterVertex, 4> vertices;
+        u32 clut = 0;
+        auto param = 0;
         auto color = commandParameters[0] & 0xFF'FFFF;
-        auto vertex1 = commandParameters[1];
-        auto vertex2 = commandParameters[2];
-        auto vertex3 = commandParameters[3];
 
-        renderer.push_tri <semi_transparent> (vertex1, vertex2, vertex3, color);
+        for (auto i = 0; i < vertexCount; i++) {
+            if (shaded)
+                color = commandParameters[param++] & 0xFF'FFFF;
+            else if (i == 0)
+                param++; // skip the command word, which holds the color
+
+            vertices[i] = decodeVertex (commandParameters[param++]);
+            vertices[i].color = color;
+
+            if constexpr (textured) {
+                auto texcoord = commandParameters[param++];
+                vertices[i].u = texcoord & 0xFF;
+                vertices[i].v = (texcoord >> 8) & 0xFF;
+
+                if (i == 0) // the CLUT lives in the top half of the first texcoord, the texpage in the top half of the second one
+                    clut = texcoord >> 16;
+                else if (i == 1)
+                    update_texpage (texcoord >> 16);
+            }
+        }
+
+        auto state = buildDrawState (clut);
+        state.semi_transparent = semi_transparent;
+
+        constexpr auto flags = (shaded ? Renderer::SHADED : 0) | (textured ? Renderer::TEXTURED : 0) | (raw_texture && textured ? Renderer::RAW_TEXTURE : 0);
+        constexpr auto type = quad ? PrimitiveType::Quad : PrimitiveType::Triangle;
+        auto dest = allocatePrimitive (type, flags, state, vertexCount);
+        std::copy (vertices.begin(), vertices.begin() + vertexCount, dest);
     }
 
-    template <const bool semi_transparent>
-    void quad_shaded() {
-        auto color1 = commandParameters[0] & 0xFF'FFFF;
-        auto vertex1 = commandParameters[1];
+    /*
+     * Rectangles (GP0 60h..7Fh). Bit 0 = raw texture, bit 1 = semi-transparent, bit 2 = textured,
+     * bits 3-4 = size (0=variable, 1=1x1, 2=8x8, 3=16x16)
+     * Parameters: color, top-left vertex, [texcoord + CLUT (if textured)], [size (if variable)]
+    */
+    template <const u32 opcode>
+    void draw_rectangle() {
+        constexpr bool raw_texture = opcode & 1;
+        constexpr bool semi_transparent = opcode & 2;
+        constexpr bool textured = opcode & 4;
+        constexpr auto sizeMode = (opcode >> 3) & 3;
+        constexpr auto sizeParam = textured ? 3 : 2;
 
-        auto color2 = commandParameters[2] & 0xFF'FFFF;
-        auto vertex2 = commandParameters[3];
-
-        auto color3 = commandParameters[4] & 0xFF'FFFF;
-        auto vertex3 = commandParameters[5];
-
-        auto color4 = commandParameters[6] & 0xFF'FFFF;
-        auto vertex4 = commandParameters[7];
-
-        renderer.push_quad <semi_transparent> (vertex1, color1, vertex2, color2, vertex3, color3, vertex4, color4);
-    }
-
-    template <const bool semi_transparent>
-    void tri_shaded () {
-        auto color1 = commandParameters[0] & 0xFF'FFFF;
-        auto vertex1 = commandParameters[1];
-
-        auto color2 = commandParameters[2] & 0xFF'FFFF;
-        auto vertex2 = commandParameters[3];
-
-        auto color3 = commandParameters[4] & 0xFF'FFFF;
-        auto vertex3 = commandParameters[5];
-
-        renderer.push_tri <semi_transparent> (vertex1, color1, vertex2, color2, vertex3, color3);
+        auto color = commandParameters[0] & 0xFF'FFFF;
+        auto vertex = decodeVertex (commandParameters[1]);
+        auto texcoord = textured ? commandParameters[2] : 0;
+        u32 width, height;
+
+        switch (sizeMode) {
+            case 0: width = commandParameters[sizeParam] & 0x3FF; height = (commandParameters[sizeParam] >> 16) & 0x1FF; break;
+            case 1: width = height = 1; break;
+            case 2: width = height = 8; break;
+            case 3: width = height = 16; break;
+        }
+
+        auto state = buildDrawState (texcoord >> 16);
+        state.semi_transparent = semi_transparent;
+
+        u32 flags = 0;
+        if constexpr (textured)
+            flags = (raw_texture ? Renderer::RAW_TEXTURE : 0) | (rectangle_texture_h_flip ? Renderer::H_FLIP : 0) | (rectangle_texture_v_flip ? Renderer::V_FLIP : 0);
+
+        auto dest = allocatePrimitive (textured ? PrimitiveType::TexturedRect : PrimitiveType::FlatRect, flags, state, 2);
+        dest[0] = vertex; // top-left corner
+        dest[0].color = color;
+        dest[0].u = texcoord & 0xFF;
+        dest[0].v = (texcoord >> 8) & 0xFF;
+        dest[1] = { (s32) width, (s32) height, 0, 0, 0 }; // size. The rest is cleared, or FrameCache would hash whatever was left there
     }
 
-    template <const bool semi_transparent>
-    void textured_quad_blend() {
-        auto vertex1 = commandParameters[1];
-        auto vertex2 = commandParameters[3];
-        auto vertex3 = commandParameters[5];
-        auto vertex4 = commandParameters[7];
-
-        renderer.push_quad <semi_transparent> (vertex1, vertex2, vertex3, vertex4, 0xFF);
+    /*
+     * Lines (GP0 40h..5Fh). Bit 1 = semi-transparent, bit 3 = polyline, bit 4 = gouraud shaded
+     * Single lines are buffered like any other command. Polylines have no fixed length, so they're drawn segment by segment
+     * as their vertices arrive, until a terminator word (5xxx5xxxh) shows up
+    */
+    template <const u32 opcode>
+    void draw_line() {
+        constexpr bool semi_transparent = opcode & 2;
+        constexpr bool shaded = opcode & 0x10;
+
+        auto start = decodeVertex (commandParameters[1]);
+        auto end = decodeVertex (commandParameters[shaded ? 3 : 2]);
+        start.color = commandParameters[0] & 0xFF'FFFF;
+        end.color = shaded ? (commandParameters[2] & 0xFF'FFFF) : start.color;
+
+        auto state = buildDrawState (0);
+        state.semi_transparent = semi_transparent;
+        auto dest = allocatePrimitive (PrimitiveType::Line, shaded ? Renderer::SHADED : 0, state, 2);
+        dest[0] = start;
+        dest[1] = end;
     }
 };
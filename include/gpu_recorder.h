@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "types.h"
+
+/*
+ * GPU command logs. A log is everything the rest of the system did to the GPU: every GP0 and GP1 word (whether it came from the CPU or DMA),
+ * every GPUREAD read and every frame boundary. Feeding it back into a fresh GPU in the same order reproduces the same VRAM contents,
+ * so GPU work can be benchmarked and regression-tested without booting the system (see tools/gpu_replay.cpp).
+ *
+ * Format, little endian: a header of MAGIC and VERSION (u32 each), followed by records, each a Record byte and its payload:
+ *     GP0Words: u32 count, then count GP0 words. Consecutive GP0 words are merged into one record, so packets and transfers stay compact
+ *     GP1Word: u32 word
+ *     GPURead: u32 count. That many consecutive GPUREAD reads
+ *     Frame: no payload. GPU::endFrame was called
+*/
+
+namespace GPULog {
+    constexpr u32 MAGIC = 0x4C55'5047; // "GPUL"
+    constexpr u32 VERSION = 1;
+
+    enum class Record : u8 {
+        GP0Words = 0,
+        GP1Word,
+        GPURead,
+        Frame
+    };
+}
+
+class GPURecorder {
+    static constexpr u32 MAX_PENDING_WORDS = 64 * 1024; // longest GP0Words record, so long transfers don't pile up in memory
+
+    std::FILE* file;
+    std::vector <u32> pendingWords; // GP0 words of the record being built
+    u32 pendingReads = 0; // GPUREAD reads of the record being built
+
+    void writeRecord (GPULog::Record record, const void* payload, size_t size);
+    void flushPending(); // write out the GP0Words or GPURead record being built
+
+public:
+    GPURecorder (const std::string& path);
+    ~GPURecorder();
+
+    void gp0 (u32 word) {
+        if (pendingReads != 0)
+            flushPending();
+
+        pendingWords.push_back (word);
+        if (pendingWords.size() == MAX_PENDING_WORDS)
+            flushPending();
+    }
+
+    void gp0 (const u32* words, size_t count);
+
+    void gpuread() {
+        if (!pendingWords.empty())
+            flushPending();
+
+        pendingReads++;
+    }
+
+    void gp1 (u32 word);
+    void frame(); // also flushes the file, so the log is usable up to the last frame even if the emulator gets killed
+};
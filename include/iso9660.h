@@ -0,0 +1,40 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <vector>
+#include "types.h"
+#include "disc.h"
+
+/*
+ * Read only access to the ISO9660 filesystem on the data track of a disc. Logical block n is the 2048 bytes of user data
+ * of disc sector 150 + n, whether the sector is Mode 1 or Mode 2 Form 1.
+ * Paths are matched the way the BIOS does: case insensitive, "\" or "/" separated, with or without the ";1" version suffix
+*/
+
+class ISO9660 {
+public:
+    static constexpr u32 BLOCK_SIZE = 2048;
+
+    ISO9660 (Disc& _disc); // panics if the disc has no ISO9660 filesystem
+
+    auto readFile (const std::string& path) -> std::optional <std::vector <u8>>; // nullopt if there's no such file
+
+private:
+    static constexpr u32 VOLUME_DESCRIPTOR_BLOCK = 16; // the primary volume descriptor
+    static constexpr u32 MAX_DIRECTORY_SIZE = 16 * 1024 * 1024; // sanity limit, so a corrupt directory doesn't eat all the memory
+
+    struct Entry {
+        u32 block; // first logical block
+        u32 size; // in bytes
+        bool directory;
+    };
+
+    Disc& disc;
+    Entry root;
+    std::vector <u8> sector; // raw sector buffer
+
+    void readBlock (u32 block, u8* dest);
+    auto read (const Entry& entry) -> std::vector <u8>;
+    auto find (const Entry& directory, const std::string& name) -> std::optional <Entry>;
+    static auto parseEntry (const u8* record) -> Entry;
+};
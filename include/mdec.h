@@ -0,0 +1,84 @@
+#pragma once
+#include <array>
+#include <vector>
+#include "types.h"
+
+/*
+ * The MDEC (motion decoder), which FMVs are decoded with. Commands and their parameters come in through 1F801820 or DMA0.
+ * A decode command carries macroblocks of run length coded DCT coefficients. Every 8x8 block gets dequantized with the uploaded
+ * quantization tables, turned back into pixels by an IDCT with the uploaded scale table, and colour blocks get converted from YUV
+ * to 15 or 24-bit RGB. The pixels come out of 1F801820 or DMA1.
+ * Blocks are decoded as soon as all of their input is in, so output is available as soon as the input that makes it is
+*/
+
+enum class MDECDepth : u32 {
+    Bit4 = 0, // monochrome, 2 pixels per byte
+    Bit8,     // monochrome
+    Bit24,    // RGB, 3 bytes per pixel
+    Bit15     // RGB555, 2 bytes per pixel
+};
+
+class MDEC {
+    enum class Command {
+        None = 0, // waiting for a command word
+        Decode,
+        SetQuantTables,
+        SetScaleTable
+    };
+
+    // Current command
+    Command command = Command::None;
+    u32 paramsLeft = 0; // parameter words the current command still expects
+    u32 paramIndex = 0; // parameter words the current command got so far
+    MDECDepth depth = MDECDepth::Bit4;
+    bool signedOutput = false;
+    bool setBit15 = false;
+
+    // Control register
+    bool dataInEnabled = false; // DMA0 requests
+    bool dataOutEnabled = false; // DMA1 requests
+
+    // Tables
+    std::array <u8, 64> lumaQuant; // in zigzag order, like the coefficients
+    std::array <u8, 64> chromaQuant;
+    std::array <s16, 64> scaleTable; // the IDCT matrix: scaleTable[u * 8 + x] weighs coefficient u for pixel x
+    std::array <s16, 4 * 16> rowPairs; // the matrix rearranged for the row pass, see idct
+    std::array <u32, 4 * 8> columnPairs; // the matrix rearranged for the column pass, see idct
+
+    // Decoding
+    std::vector <u16> input; // halfwords of the decode command that weren't consumed yet
+    size_t inputPos = 0;
+    std::array <std::array <s16, 64>, 6> blocks; // decoded blocks of the current macroblock, in the order they come in: Cr, Cb, Y1, Y2, Y3, Y4
+    u32 blockIndex = 0; // the block being decoded
+    std::vector <u32> output;
+    size_t outputPos = 0; // next word to read out of output
+
+    void startCommand (u32 word);
+    void updateScalePairs();
+    void decodeAvailable(); // decode every block the input holds all of
+    auto decodeBlock (std::array <s16, 64>& block, const std::array <u8, 64>& quant) -> bool;
+    void idct (const s16* coefficients, s16* pixels);
+    void outputMonochrome (const std::array <s16, 64>& block);
+    void outputColour();
+    void endCommand();
+
+public:
+    MDEC() {
+        lumaQuant.fill (0);
+        chromaQuant.fill (0);
+        scaleTable.fill (0);
+        updateScalePairs();
+        reset();
+    }
+
+    void reset();
+    void writeCommand (u32 word); // 1F801820 writes and DMA0
+    void writeCommands (const u32* words, size_t count);
+    void writeControl (u32 value); // 1F801824 writes
+    auto readData() -> u32; // 1F801820 reads and DMA1
+    void readData (u32* dest, size_t count);
+    auto readStatus() -> u32; // 1F801824 reads
+
+    auto dataInRequested() -> bool { return dataInEnabled; } // the input is decoded as it comes in, so the MDEC always takes more
+    auto dataOutRequested (u32 words) -> bool { return dataOutEnabled && output.size() - outputPos >= words; } // can DMA1 take out this many words?
+};
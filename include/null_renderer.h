@@ -0,0 +1,8 @@
+#pragma once
+#include "renderer.h"
+
+// Backend that throws every primitive away. Nothing is rasterized and nothing is presented
+class NullRenderer final : public Renderer {
+public:
+    void drawBatch (const RasterVertex*, const Batch&) override {}
+};
@@ -2,6 +2,7 @@
 #include "bus.h"
 #include "cpu.h"
 #include "gpu.h"
+#include "scheduler.h"
 #include "types.h"
 
 struct PSX_EXE_HEADER {
@@ -14,20 +15,32 @@ struct PSX_EXE_HEADER {
     u32 size; // must be n * 800h
 
     u64 trash2;
-    u64 memfillStuff;
+    u32 memfillStart; // RAM zeroed before the EXE starts, usually its BSS
+    u32 memfillSize;
 
     u32 sp_base;
     u32 sp_offs;
 };
 
 class PSX {
+    static constexpr u64 CYCLES_PER_STEP = 2; // the CPU averages about 2 cycles per instruction, main.cpp sizes frames the same way
+    static constexpr u32 SHELL_ENTRY = 0x8003'0000; // the BIOS jumps here to start the shell, once the kernel is set up
+    static constexpr u32 DEFAULT_STACK = 0x801F'FFF0; // stack pointer the kernel gives EXEs that don't ask for one
+
+    Scheduler* scheduler;
     Bus* bus;
     CPU* cpu;
     class GPU* gpu;
+    bool bootPending = false; // start the disc's EXE instead of the shell
+
+    void loadEXE (const std::vector <u8>& exe);
+    void bootDisc();
 
 public:
-    PSX(std::string directory);
+    PSX(std::string directory, const GPUConfig& gpuConfig = GPUConfig());
     void step();
     void sideload();
+    void insertDisc (const std::string& path); // a .cue, .bin or .cdz image
+    void fastBoot(); // let the BIOS set the kernel up, then boot the disc without going through the shell and license screens
     void render();
 };
@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include "types.h"
+#include "vram.h"
+#include "draw_state.h"
+#include "texture_cache.h"
+#include "span_kernels.h"
+
+struct ClipRect { // inclusive bounds
+    s32 left, top, right, bottom;
+};
+
+struct CullStats { // what the setup stage did with the primitives it saw. Quads count as 2 triangles
+    u32 drawn = 0;
+    u32 offscreen = 0; // entirely outside of the drawing area
+    u32 degenerate = 0; // zero area or zero size
+    u32 oversized = 0; // spans more than 1023x511 pixels, which the GPU refuses to draw
+    u64 pixels = 0; // pixels covered by the primitives that were drawn, including transparent texels and masked pixels
+};
+
+/*
+ * A software rasterizer that draws straight into VRAM.
+ * Primitives are broken into horizontal spans. Each span is first shaded into a buffer of fragments,
+ * then the fragments are written to VRAM by writeSpan.
+ * Before any of that, a setup stage rejects primitives that wouldn't draw anything and clips their bounding boxes to the drawing area.
+ * A rasterizer can also draw into a scaled render target instead of VRAM (see upscaler.h). It then expects vertices and drawing areas
+ * in target coordinates, still samples textures from VRAM, and leaves the VRAM generations alone
+*/
+
+class Rasterizer {
+    VRAM& vram; // where textures come from
+    TextureCache textureCache;
+    u16* target; // where pixels go. VRAM itself, or a render target (WIDTH << scaleShift) pixels wide
+    u32 targetWidth;
+    u32 scaleShift; // log2 of the target's scale. 0 when drawing into VRAM
+    std::vector <u32> fragments; // the fragments of the span currently being drawn, in the format described in span_kernels.h
+    std::vector <u16> texelColumns; // offset of the texel every column of a textured rectangle samples
+
+    // per-primitive state, set up by setupPrimitive
+    SpanKernels::Kernel spanKernel; // writes fragments to VRAM with the primitive's blending, dithering and masking settings
+    u32 texelFlags; // fragment flags for texels with bit 15 set
+    u32 flatFlags; // fragment flags for untextured fragments
+
+    void setupPrimitive (const DrawState& state, bool textured, bool ditherable);
+
+    // setup stage. Returns false if the primitive gets culled, otherwise bounds is set to its bounding box clipped to the drawing area
+    auto clipBounds (s32 minX, s32 minY, s32 maxX, s32 maxY, const DrawState& state, ClipRect& bounds) -> bool;
+    auto setupTriangle (const RasterVertex* vertices, const DrawState& state, ClipRect& bounds) -> bool;
+    auto setupLine (const RasterVertex& start, const RasterVertex& end, const DrawState& state, ClipRect& bounds) -> bool;
+    auto setupRect (s32 x, s32 y, u32 width, u32 height, const DrawState& state, ClipRect& bounds) -> bool;
+    void writeSpan (s32 x, s32 y, u32 count) {
+        stats.pixels += count;
+        spanKernel (&target[y * targetWidth + x], fragments.data(), count, x, y);
+    }
+
+    void markDrawn (const ClipRect& bounds) { // bump the generations of what a primitive drew over, if it drew into VRAM
+        if (scaleShift == 0)
+            vram.markDirty (bounds.left, bounds.top, bounds.right - bounds.left + 1, bounds.bottom - bounds.top + 1);
+    }
+
+    template <const bool shaded, const bool textured, const bool raw_texture>
+    void rasterizeTriangle (const RasterVertex* v0, const RasterVertex* v1, const RasterVertex* v2, const DrawState& state, const ClipRect& bounds, const u16* texels);
+
+    template <const bool raw_texture>
+    void rasterizeTexturedRect (s32 x, s32 y, u32 u, u32 v, u32 color, const DrawState& state, const ClipRect& bounds, bool hflip, bool vflip);
+
+public:
+    CullStats stats; // stats of the frame being drawn
+    CullStats lastFrameStats; // stats of the last complete frame
+
+    Rasterizer (VRAM& _vram) : Rasterizer (_vram, _vram.pixels.data(), 0) {}
+    Rasterizer (VRAM& _vram, u16* _target, u32 _scaleShift) : vram(_vram), textureCache(_vram), target(_target),
+        targetWidth(WIDTH << _scaleShift), scaleShift(_scaleShift), fragments(WIDTH << _scaleShift), texelColumns(WIDTH << _scaleShift) {}
+
+    void setTextureLayout (TexelLayout layout) {
+        textureCache.setLayout (layout);
+    }
+
+    void newFrame() {
+        lastFrameStats = stats;
+        stats = CullStats();
+    }
+
+    template <const bool shaded, const bool textured, const bool raw_texture>
+    void drawTriangle (const RasterVertex* vertices, const DrawState& state);
+
+    template <const bool shaded, const bool textured, const bool raw_texture>
+    void drawQuad (const RasterVertex* vertices, const DrawState& state);
+
+    template <const bool raw_texture>
+    void drawTexturedRect (s32 x, s32 y, u32 width, u32 height, u32 u, u32 v, u32 color, const DrawState& state, bool hflip, bool vflip);
+
+    void drawFlatRect (s32 x, s32 y, u32 width, u32 height, u32 color, const DrawState& state);
+
+    template <const bool shaded>
+    void drawLine (const RasterVertex& start, const RasterVertex& end, const DrawState& state);
+};
@@ -1,194 +1,49 @@
 #pragma once
-#include <SFML/Graphics.hpp>
-#include <Windows.h>
-#include "helpers.h"
-
-using Vertex = sf::Vertex;
-using Vector2D = sf::Vector2f;
-using Color = sf::Color;
-using u8 = std::uint8_t;
-using u32 = std::uint32_t;
+#include <memory>
+#include <string>
+#include "types.h"
+#include "vram.h"
+#include "draw_state.h"
+#include "vertex_arena.h"
+#include "display.h"
+#include "texture_cache.h"
 
 /*
- * PSX vertex format: each vertex is 1 32-bit number which is formatted as
- * YyyyXxxx (top 16 bits are y, low 16 are x)
+ * Interface every renderer backend implements. The GPU decodes GP0 commands into primitives, queues them in a vertex arena
+ * and hands them to the backend one batch at a time,
+ * the backend decides what to do with them (draw them into VRAM, draw them into VRAM and show a window, or nothing at all).
+ * VRAM itself is owned by the GPU, so transfers and fills keep working no matter which backend is active.
+ * None of this pulls in SFML, only the windowed backend does
 */
 
-class VRAM {
-public:
-    std::vector <u32> pixels;
-
-    void setPixel (int x, int y, u32 color);
-    u32 getPixel24bit(int x, int y);
-
-    VRAM();
+enum class RendererType {
+    Null, // drops every primitive and presents nothing. For headless runs that only care about the CPU side
+    Software, // draws into VRAM, presents nothing. For headless runs that need correct VRAM contents (readbacks, captures)
+    Window // draws into VRAM and presents it in an SFML window
 };
 
-class BeegRenderer {
-    sf::ContextSettings context_settings;
-    sf::RenderWindow window;
-    sf::VertexArray vertex_buffer; // TODO: Ditch this, have a pool of sf::VertexArrays
-    sf::Texture texture_atlas;
-    int vertex_buffer_index;
-
-public:    
-    VRAM vram = VRAM();
-
-    BeegRenderer (int width, int height, std::string title) :   context_settings(0, 0, 0, 1, 1, sf::ContextSettings::Attribute::Default, true),
-                                                                window (sf::VideoMode(width, height), title.c_str(), sf::Style::Default, context_settings),
-                                                                vertex_buffer (sf::Triangles, 0) {
-        window.clear(); // init color to 0xDEADBEFF;
-        poll_events();
-        window.display();
-        texture_atlas.create(1024, 512);
-
-        vertex_buffer_index = 0;
-    }
-
-    auto isOpen() -> bool {
-        return window.isOpen();
-    }
-
-    void close() {
-        window.close();
-    }
-
-    void set_title (std::string title) {
-        window.setTitle(title.c_str());
-    }
-
-    void poll_events () {
-        sf::Event event;
-
-        while (window.pollEvent(event)) {
-            switch (event.type) {
-                case sf::Event::Closed: close(); break;
-                case sf::Event::Resized: window.display(); break;
-                // if you want to handle other events, add the code here
-            }
-        }
-    }
-
-    template <const bool semi_transparent>
-    constexpr auto BGRToRGBA (u32 value) -> u32 {
-        auto r = value & 0xFF;
-        auto g = (value >> 8) & 0xFF;
-        auto b = (value >> 16) & 0xFF;
-        u32 alpha = 255;
-
-        if constexpr (semi_transparent)
-            alpha = 128;
-
-        return (r << 24) | (g << 16) | (b << 8) | alpha;
-    }
-
-    void push_vertex (const Vector2D& position) {
-        vertex_buffer[vertex_buffer_index++] = Vertex (position);
-    }
-
-    void push_vertex (const Vector2D& position, const Color color) {
-        vertex_buffer[vertex_buffer_index++] = Vertex (position, color);
-        vertex_buffer_index++;
-    }
-
-    void push_vertex (const Vector2D& position, const u32 color) {
-        //vertex_buffer[vertex_buffer_index++] = Vertex (position, Color (color));
-        vertex_buffer.append (Vertex(position, Color(color)));
-        vertex_buffer_index++;
-    }
-
-    void push_vertex (const Vector2D& position, const u8 red, const u8 green, const u8 blue) {
-        vertex_buffer[vertex_buffer_index++] = Vertex (position, Color (red, green, blue));
-    }
-
-    void push_vertex (const Vector2D& position, const u8 red, const u8 green, const u8 blue, const u8 alpha) {
-        vertex_buffer[vertex_buffer_index++] = Vertex (position, Color (red, green, blue, alpha));
-    }
-
-    // PSX-specific
-    template <const bool semi_transparent>
-    void push_tri (u32 vertex1, u32 vertex2, u32 vertex3, u32 colorBGR) { // monochrome tri
-        const auto v1 = Vector2D((float) (vertex1 & 0xFFFF), (float)(vertex1 >> 16));
-        const auto v2 = Vector2D((float) (vertex2 & 0xFFFF), (float)(vertex2 >> 16));
-        const auto v3 = Vector2D((float) (vertex3 & 0xFFFF), (float)(vertex3 >> 16));
-
-        const auto colorRGB = BGRToRGBA <semi_transparent> (colorBGR);
-
-        push_vertex(v1, colorRGB);
-        push_vertex(v2, colorRGB);
-        push_vertex(v3, colorRGB);
-    }
-
-    template <const bool semi_transparent>
-    void push_tri (u32 vertex1, u32 color1, u32 vertex2, u32 color2, u32 vertex3, u32 color3) { // shaded tri
-        const auto p1 = Vector2D((float) (vertex1 & 0xFFFF), (float)(vertex1 >> 16));
-        const auto p2 = Vector2D((float) (vertex2 & 0xFFFF), (float)(vertex2 >> 16));
-        const auto p3 = Vector2D((float) (vertex3 & 0xFFFF), (float)(vertex3 >> 16));
-
-        color1 = BGRToRGBA <semi_transparent> (color1);
-        color2 = BGRToRGBA <semi_transparent> (color2);
-        color3 = BGRToRGBA <semi_transparent> (color3);
-
-        push_vertex(p1, color1);
-        push_vertex(p2, color2);
-        push_vertex(p3, color3);
-    }
-
-    // PSX-specific
-    template <const bool semi_transparent>
-    void push_quad (u32 vertex1, u32 vertex2, u32 vertex3, u32 vertex4, u32 colorBGR) { // monochrome quad
-        const auto p1 = Vector2D((float) (vertex1 & 0xFFFF), (float)(vertex1 >> 16));
-        const auto p2 = Vector2D((float) (vertex2 & 0xFFFF), (float)(vertex2 >> 16));
-        const auto p3 = Vector2D((float) (vertex3 & 0xFFFF), (float)(vertex3 >> 16));
-        const auto p4 = Vector2D((float) (vertex4 & 0xFFFF), (float)(vertex4 >> 16));
-
-        auto colorRGB = BGRToRGBA <semi_transparent> (colorBGR);
-
-        // break quad into 2 triangles, 6 vertices
-        push_vertex(p1, colorRGB);
-        push_vertex(p2, colorRGB);
-        push_vertex(p3, colorRGB);
-        push_vertex(p2, colorRGB);
-        push_vertex(p3, colorRGB);
-        push_vertex(p4, colorRGB);
-    }
-
-    template <bool semi_transparent>
-    void push_quad (u32 vertex1, u32 color1, u32 vertex2, u32 color2, u32 vertex3, u32 color3, u32 vertex4, u32 color4) { // shaded quad
-        const auto p1 = Vector2D((float) (vertex1 & 0xFFFF), (float)(vertex1 >> 16));
-        const auto p2 = Vector2D((float) (vertex2 & 0xFFFF), (float)(vertex2 >> 16));
-        const auto p3 = Vector2D((float) (vertex3 & 0xFFFF), (float)(vertex3 >> 16));
-        const auto p4 = Vector2D((float) (vertex4 & 0xFFFF), (float)(vertex4 >> 16));
-
-        color1 = BGRToRGBA <semi_transparent> (color1);
-        color2 = BGRToRGBA <semi_transparent> (color2);
-        color3 = BGRToRGBA <semi_transparent> (color3);
-        color4 = BGRToRGBA <semi_transparent> (color4);
-
-        push_vertex(p1, color1);
-        push_vertex(p2, color2);
-        push_vertex(p3, color3);
-        push_vertex(p2, color2);
-        push_vertex(p3, color3);
-        push_vertex(p4, color4);
-    }
-
-    void draw () {
-        poll_events();
-        if (vertex_buffer_index == 0)
-            return;
-
-        window.draw(vertex_buffer);
-
-        sf::Texture texture; // dump RGBA values of VRAM for debugging
-        texture.create(1024, 512);
-        texture.update((u8*) vram.pixels.data());
-        sf::Sprite sprite(texture);
-        window.draw(sprite);
-
-        window.display();
-
-        vertex_buffer.clear();
-        vertex_buffer_index = 0;
-    }
+class Renderer {
+public:
+    // batch flags
+    static constexpr u32 SHADED = 1; // polygons and lines
+    static constexpr u32 TEXTURED = 2; // polygons
+    static constexpr u32 RAW_TEXTURE = 4; // textured polygons and rectangles without color modulation
+    static constexpr u32 H_FLIP = 8; // textured rectangles
+    static constexpr u32 V_FLIP = 16;
+
+    virtual ~Renderer() = default;
+
+    // Draw every primitive of a batch. vertices points to the start of the arena, the batch's vertices start at batch.firstVertex
+    virtual void drawBatch (const RasterVertex* vertices, const Batch& batch) = 0;
+
+    virtual void endFrame() {} // called once per emulated frame, after the last primitive of the frame
+    virtual void present (const DisplayArea&) {} // show the display area, if the backend has anywhere to show it
+    virtual auto isOpen() -> bool { return true; } // false once the user closed the window
+    virtual auto drawsToVRAM() -> bool { return false; } // whether drawBatch actually changes VRAM
+    virtual void setTextureLayout (TexelLayout) {} // how decoded textures are laid out in memory, for backends that sample them
+
+    // scale is the internal resolution (1, 2 or 4) of the backends that draw. downsample makes the window average higher resolutions
+    // back down to the size of the display area instead of presenting them as is
+    static auto create (RendererType type, VRAM& vram, u32 scale = 1, bool downsample = false) -> std::unique_ptr <Renderer>;
+    static auto parseType (const std::string& name, RendererType& type) -> bool; // "null", "software" or "window"
 };
@@ -0,0 +1,51 @@
+#pragma once
+#include <array>
+#include <functional>
+#include "types.h"
+
+/*
+ * Tracks system time in CPU cycles and fires events once it reaches their deadline. Devices that work in the background
+ * (DMA transfers, the CD-ROM and the SPU) schedule an event for when their next piece of work is due, instead of
+ * being polled every step. Each event type has at most one pending deadline, scheduling it again moves the deadline
+*/
+
+enum class SchedulerEvent : u32 {
+    DMA = 0, // Bus::DMA_step
+    CDROMCommand, // a CD-ROM command is done being processed
+    CDROMSecondResponse,
+    CDROMRead, // the CD-ROM drive reached the next sector
+    CDROMResponse, // a queued CD-ROM interrupt can be delivered
+    SPU, // the next block of samples is due
+    Count
+};
+
+class Scheduler {
+    static constexpr u64 NEVER = ~0ull;
+    static constexpr auto EVENT_COUNT = (size_t) SchedulerEvent::Count;
+
+    std::array <u64, EVENT_COUNT> deadlines;
+    std::array <std::function <void()>, EVENT_COUNT> handlers;
+    u64 nextDeadline = NEVER; // earliest entry of deadlines, so addCycles only has to compare against one value
+    u64 pendingStall = 0; // cycles the CPU has to sit out, eg because a DMA slice has the bus
+
+    void updateNextDeadline();
+    void runDueEvents();
+
+public:
+    u64 timestamp = 0; // cycles since power on
+
+    Scheduler();
+
+    void setHandler (SchedulerEvent event, std::function <void()> handler);
+    void schedule (SchedulerEvent event, u64 cycles); // fire event cycles from now, replacing its pending deadline if it has one
+    void cancel (SchedulerEvent event);
+    auto isScheduled (SchedulerEvent event) const -> bool { return deadlines[(size_t) event] != NEVER; }
+
+    void stall (u64 cycles) { pendingStall += cycles; } // keep the CPU off the bus for this many more cycles. Meant for event handlers
+
+    void addCycles (u64 cycles) {
+        timestamp += cycles;
+        if (timestamp >= nextDeadline)
+            runDueEvents();
+    }
+};
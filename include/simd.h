@@ -0,0 +1,37 @@
+#pragma once
+
+// Figure out which SIMD instruction sets we can use. MSVC doesn't define __SSE2__, so check its own macros too
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define PSX_SSE2
+    #include <emmintrin.h>
+#endif
+
+#if defined(__SSSE3__) || defined(__AVX__)
+    #define PSX_SSSE3
+    #include <tmmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+    #define PSX_AVX2
+    #include <immintrin.h>
+#endif
+
+#if defined(PSX_SSE2)
+// (a * b) >> 15 for 8 pairs of s16s, as 2 vectors of s32s (lanes 0-3 in low, 4-7 in high). The full 32-bit products are rebuilt
+// from their low and high halves, so this gives exactly what the same math on scalars does
+inline void mulShift15 (__m128i a, __m128i b, __m128i& low, __m128i& high) {
+    const auto productLow = _mm_mullo_epi16 (a, b);
+    const auto productHigh = _mm_mulhi_epi16 (a, b);
+    low = _mm_srai_epi32 (_mm_unpacklo_epi16 (productLow, productHigh), 15);
+    high = _mm_srai_epi32 (_mm_unpackhi_epi16 (productLow, productHigh), 15);
+}
+#endif
+
+// Ask the CPU to start pulling the cache line holding addr in, for data that's about to be read
+inline void prefetch (const void* addr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch (addr);
+#elif defined(PSX_SSE2)
+    _mm_prefetch ((const char*) addr, _MM_HINT_T0);
+#endif
+}
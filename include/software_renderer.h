@@ -0,0 +1,48 @@
+#pragma once
+#include <memory>
+#include "renderer.h"
+#include "rasterizer.h"
+#include "upscaler.h"
+
+// Backend that draws every primitive into VRAM with the software rasterizer. Presents nothing by itself
+// At a higher internal resolution, every batch is also drawn into the upscaler's render target
+class SoftwareRenderer : public Renderer {
+protected:
+    VRAM& vram;
+    Rasterizer rasterizer;
+    std::unique_ptr <Upscaler> upscaler; // null at native resolution
+
+    template <const PrimitiveType type, const u32 flags>
+    static void drawPrimitives (Rasterizer& rasterizer, const RasterVertex* vertices, const Batch& batch);
+
+public:
+    SoftwareRenderer (VRAM& _vram, u32 scale = 1) : vram(_vram), rasterizer(_vram) {
+        if (scale != 1)
+            upscaler = std::make_unique <Upscaler> (_vram, scale);
+    }
+
+    // Draw every primitive of a batch with the given rasterizer
+    static void rasterizeBatch (Rasterizer& rasterizer, const RasterVertex* vertices, const Batch& batch);
+
+    void drawBatch (const RasterVertex* vertices, const Batch& batch) override;
+
+    auto drawsToVRAM() -> bool override { return true; }
+
+    void setTextureLayout (TexelLayout layout) override {
+        rasterizer.setTextureLayout (layout);
+        if (upscaler)
+            upscaler -> setTextureLayout (layout);
+    }
+
+    void endFrame() override {
+        rasterizer.newFrame();
+        if (upscaler) { // catch up with transfers made after the last batch of the frame, before anything gets presented
+            upscaler -> newFrame();
+            upscaler -> sync();
+        }
+    }
+
+    auto cullStats() -> const CullStats& { // stats of the last complete frame
+        return rasterizer.lastFrameStats;
+    }
+};
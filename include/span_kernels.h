@@ -0,0 +1,23 @@
+#pragma once
+#include "types.h"
+
+/*
+ * Span kernels write a span of shaded fragments to a VRAM row. Every combination of
+ * blending mode, dithering and mask bit settings gets its own kernel, so the per-pixel loop is branchless.
+ *
+ * Fragment format: bits 0-23 = 24-bit BGR color, bit 24 = value of the mask bit to write (texel bit 15),
+ * bit 25 = blend this fragment with VRAM, bit 31 = discard (fully transparent texel)
+*/
+
+namespace SpanKernels {
+    constexpr u32 FRAGMENT_MASK = 1 << 24;
+    constexpr u32 FRAGMENT_BLEND = 1 << 25;
+    constexpr u32 FRAGMENT_DISCARD = 1u << 31;
+
+    constexpr u32 BLEND_NONE = 4; // blend modes 0-3 are the ones in GPUSTAT.semi_transparency, 4 is opaque
+
+    // dest = pointer to the first VRAM pixel of the span, x/y = VRAM coordinates of that pixel (used for dithering)
+    using Kernel = void (*) (u16* dest, const u32* fragments, u32 count, s32 x, s32 y);
+
+    auto select (u32 blendMode, bool dither, bool setMask, bool checkMask) -> Kernel;
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <array>
+#include <functional>
+#include <vector>
+#include "types.h"
+#include "audio_ring.h"
+#include "scheduler.h"
+
+/*
+ * The SPU, at 1F801C00-1F801FFF. 24 voices play ADPCM samples out of 512KB of sound RAM, each with its own pitch, ADSR envelope
+ * and volume, and get mixed with CD audio at 44.1kHz. Sound RAM is written through the transfer FIFO or DMA4.
+ * Samples are mixed in blocks from a scheduler event, not every cycle. Register and sound RAM accesses first mix the samples
+ * that are due, so every write still lands on the right sample. Within a block each voice is rendered on its own: the pitch
+ * counter walk, ADPCM decoding and envelope are sequential, and everything per sample after that (Gaussian interpolation,
+ * envelope and volume scaling, mixing) runs across the block in SIMD lanes.
+ * Voices with reverb enabled also feed the reverb unit, a network of IIR, comb and all-pass filters running at 22.05kHz against
+ * a work area at the end of sound RAM (see reverb.cpp)
+ * Known limitation: the frontend has no audio output, so nothing plays the mix. Mixing still runs for what it leaves in sound RAM
+ * (capture buffers, reverb) and the IRQs it raises, but the samples are only kept if a consumer hands over a ring with setOutput
+*/
+
+class SPU {
+    static constexpr u32 RAM_SIZE = 512 * 1024;
+    static constexpr u32 VOICE_COUNT = 24;
+    static constexpr u32 CYCLES_PER_SAMPLE = 33'868'800 / 44'100; // 768
+    static constexpr u32 BLOCK_SAMPLES = 32; // samples mixed per scheduler event
+    static constexpr u32 SAMPLES_PER_ADPCM_BLOCK = 28;
+    static constexpr u32 FIFO_SIZE = 32; // halfwords
+    static constexpr u32 REVERB_BLOCK_TICKS = BLOCK_SAMPLES / 2; // reverb ticks per block of samples at most
+
+    enum class EnvelopePhase : u8 { Off, Attack, Decay, Sustain, Release };
+
+    enum class TransferMode : u16 { Stop = 0, ManualWrite, DMAWrite, DMARead };
+
+    // Reverb registers at 1DC0-1DFF, named like psx-spx does. d* are delays and m* buffer addresses, both in 8 byte units and
+    // relative to the current buffer address, v* are volumes
+    enum ReverbRegister : u32 {
+        dAPF1, dAPF2, vIIR, vCOMB1, vCOMB2, vCOMB3, vCOMB4, vWALL, vAPF1, vAPF2, mLSAME, mRSAME, mLCOMB1, mRCOMB1, mLCOMB2, mRCOMB2,
+        dLSAME, dRSAME, mLDIFF, mRDIFF, mLCOMB3, mRCOMB3, mLCOMB4, mRCOMB4, dLDIFF, dRDIFF, mLAPF1, mRAPF1, mLAPF2, mRAPF2, vLIN, vRIN
+    };
+
+    struct Voice {
+        // Registers
+        s16 volumeLeft = 0; // current volumes, see writeVolume
+        s16 volumeRight = 0;
+        u16 pitch = 0; // 0x1000 = 44.1kHz
+        u16 startAddress = 0; // in 8 byte units, like every SPU address register
+        u16 adsrLow = 0;
+        u16 adsrHigh = 0;
+        u16 repeatAddress = 0;
+
+        // Playback
+        u32 blockAddress = 0; // byte address of the ADPCM block being played
+        u32 counter = 0; // pitch counter. Bits 12 and up are the sample in the block, bits 4-11 the interpolation point
+        std::array <s16, 3 + SAMPLES_PER_ADPCM_BLOCK> samples {}; // the previous block's last 3 samples, then the current block's
+        s32 old = 0; // last 2 decoded samples, for the prediction filter
+        s32 older = 0;
+        u8 blockFlags = 0;
+
+        // Envelope
+        EnvelopePhase phase = EnvelopePhase::Off;
+        s32 envelope = 0; // 0 to 0x7FFF
+        u32 envelopeWait = 0; // samples until the envelope steps again
+    };
+
+    Scheduler* scheduler;
+    AudioRing& cdAudio; // XA audio from the CD-ROM
+    std::function <void()> irq; // raises the SPU IRQ in I_STAT
+    std::vector <u8> RAM;
+    std::array <Voice, VOICE_COUNT> voices;
+    std::array <u16, 0x100> registers {}; // everything written to 1F801C00-1F801DFF, for reading back
+
+    // Control
+    u16 control = 0; // SPUCNT
+    bool irqFlag = false; // SPUSTAT bit 6
+    u32 keyOnVoices = 0, keyOffVoices = 0; // last values written
+    u32 pitchModVoices = 0; // PMON
+    u32 noiseVoices = 0; // NON
+    u32 reverbVoices = 0; // EON
+    u32 endedVoices = 0; // ENDX: voices that played a block with the loop end flag since they were keyed on
+    s16 mainVolumeLeft = 0, mainVolumeRight = 0;
+    s16 cdVolumeLeft = 0, cdVolumeRight = 0;
+    u16 irqAddress = 0;
+
+    // Transfers
+    u16 transferAddressRegister = 0;
+    u32 transferAddress = 0; // byte address the next halfword goes to or comes from
+    std::array <u16, FIFO_SIZE> fifo;
+    u32 fifoSize = 0;
+
+    // Noise generator
+    s32 noiseTimer = 0;
+    u16 noiseLevel = 0;
+
+    // Reverb
+    u32 reverbBase = 0; // mBASE, where the work area starts, in bytes. It goes on to the end of sound RAM
+    u32 reverbAddress = 0; // current buffer address. Goes up a halfword every reverb tick, wrapping around the work area
+    bool reverbPhase = false; // reverb runs at 22.05kHz, so only on every other sample
+    s16 reverbOutLeft = 0, reverbOutRight = 0; // latest reverb output, held until the next tick
+    s16 reverbVolumeLeft = 0, reverbVolumeRight = 0; // vLOUT/vROUT
+    bool reverbScheduleDirty = true; // the settings changed, so reverbBlockTicks has to be worked out again
+    u32 reverbBlockTicks = 0; // how many ticks reverbBlock can take at once with the current settings, 0 if it can't be used
+    u16 reverbEarlyReads = 0; // which of the comb and all-pass reads reverbBlock does before the reflections, see updateReverbSchedule
+    bool reverbReference = false;
+
+    // Mixing
+    u64 lastTimestamp = 0; // time up to which samples were mixed
+    u32 captureIndex = 0; // halfword the capture buffers are written to next
+    std::array <std::array <s16, BLOCK_SAMPLES>, VOICE_COUNT> voiceOutput; // per voice, after the envelope, for pitch modulation and capture
+    AudioRing* out = nullptr; // where mixed samples go, null if nothing consumes them
+
+    void catchUp(); // mix every sample that's due by now
+    void mixBlock (u32 count);
+    void renderVoice (u32 index, u32 count, const s16* noise, s32* mixLeft, s32* mixRight, s32* reverbLeft, s32* reverbRight);
+    void decodeBlock (Voice& voice);
+    void nextBlock (Voice& voice, u32 index);
+    void keyOn (u32 index);
+    void keyOff (u32 index);
+    void tickEnvelope (Voice& voice);
+    void checkIRQ (u32 address, u32 size); // raise the IRQ if [address, address + size) holds the IRQ address
+    void writeRAM (u16 value);
+    void flushFifo();
+    void writeVoiceRegister (u32 index, u32 offset, u16 value);
+
+    void processReverb (const s32* inLeft, const s32* inRight, s16* outLeft, s16* outRight, u32 count);
+    void reverbStep (s16 inLeft, s16 inRight, s16& outLeft, s16& outRight); // one tick, one access at a time, like psx-spx describes it
+    void reverbBlock (const s16* inLeft, const s16* inRight, s16* outLeft, s16* outRight, u32 ticks); // several ticks, stage by stage
+    void reverbReflect (s16 inLeft, s16 inRight); // the same side and different side reflections of a tick
+    void updateReverbSchedule();
+    auto reverbRegister (ReverbRegister reg) const -> u16 { return registers[0xE0 + reg]; }
+    auto reverbAddressOf (s32 offset) const -> u32; // the work area address offset bytes from the current buffer address
+
+    // Work area accesses, offset bytes from the current buffer address. Runs are count halfwords, one per tick from the current one.
+    // Writes only go through while SPUCNT bit 7 (reverb master enable) is set
+    auto readReverb (s32 offset) const -> s16;
+    void writeReverb (s32 offset, s16 value);
+    void readReverbRun (s32 offset, u32 count, s16* dest) const;
+    void writeReverbRun (s32 offset, u32 count, const s16* src);
+
+    // Volume registers either hold a fixed volume or start a sweep. Sweeps aren't emulated, the volume just holds where it was
+    static void writeVolume (u16 value, s16& volume);
+
+public:
+    SPU (Scheduler* _scheduler, AudioRing& _cdAudio, std::function <void()> _irq);
+
+    auto read16 (u32 address) -> u16;
+    void write16 (u32 address, u16 value);
+
+    auto dmaRequested() const -> bool; // is a DMA4 transfer mode selected?
+    void dmaWrite (const u32* words, size_t count); // DMA4 from RAM
+    void dmaRead (u32* words, size_t count); // DMA4 to RAM
+
+    void setOutput (AudioRing* ring) { out = ring; } // where the mixed 44.1kHz output goes from now on, null to drop it
+
+    // Run the reverb one tick at a time with no block processing. The output is the same either way, this is for checking that it is (see tools/reverb_check.cpp)
+    void setReverbReference (bool enabled) { reverbReference = enabled; }
+};
@@ -0,0 +1,68 @@
+#pragma once
+#include <array>
+#include <vector>
+#include "types.h"
+#include "vram.h"
+#include "draw_state.h"
+
+/*
+ * Cache of decoded texture pages. A page is decoded into 256x256 1555 texels, with the CLUT already applied for 4bpp/8bpp pages,
+ * so sampling is a single load. Pages are keyed by their position, depth and CLUT, and are decoded lazily in bands of 16 rows.
+ * Entries are validated against the generations of the VRAM blocks they were decoded from, so any VRAM write that touches
+ * the page or its CLUT invalidates them.
+ * Decoded pages can be stored linearly or in 8x8 tiles. Textured primitives are often rotated or scaled, which makes the rasterizer
+ * walk the page in 2D, and with the tiled layout those walks stay within a few cache lines. The layout is selectable so both can be benchmarked
+*/
+
+enum class TexelLayout {
+    Linear, // one row after the other, so vertically adjacent texels are 512 bytes apart
+    Tiled // 8x8 texel tiles of 128 bytes each, so texels that are close in 2D are close in memory
+};
+
+// Offsets of every texel row and column inside a decoded page. Texel (u, v) lives at row[v] + column[u] in either layout
+struct TexelAddressing {
+    std::array <u16, 256> row;
+    std::array <u16, 256> column;
+};
+
+class TextureCache {
+    static constexpr u32 ENTRY_COUNT = 16;
+    static constexpr u32 BAND_HEIGHT = 16;
+
+    struct Entry {
+        u32 key = 0xFFFF'FFFF; // (0xFFFFFFFF = unused)
+        u64 generation = 0; // the VRAM generation of the page + CLUT at the time of decoding
+        u32 lastUsed = 0;
+        u32 validBands = 0; // bit n set = rows (n * 16)..(n * 16 + 15) are decoded
+        std::vector <u16> texels;
+    };
+
+    VRAM& vram;
+    std::array <Entry, ENTRY_COUNT> entries;
+    TexelLayout layout = TexelLayout::Linear;
+    TexelAddressing addressing;
+    u32 useCounter = 0;
+
+    static auto makeKey (const DrawState& state) -> u32;
+    void decodeBand (Entry& entry, const DrawState& state, u32 band);
+
+public:
+    TextureCache (VRAM& _vram);
+
+    // The VRAM generation of everything a primitive with this draw state samples from (its texture page, and its CLUT if it has one)
+    static auto sourceGeneration (VRAM& vram, const DrawState& state) -> u64;
+
+    static constexpr auto pageWidth (const DrawState& state) -> u32 { // width of the texture page in VRAM halfwords
+        return state.texture_depth == 0 ? 64 : (state.texture_depth == 1 ? 128 : 256);
+    }
+
+    static constexpr auto clutWidth (const DrawState& state) -> u32 { // 0 for 15bpp textures, which have no CLUT
+        return state.texture_depth == 0 ? 16 : (state.texture_depth == 1 ? 256 : 0);
+    }
+
+    void setLayout (TexelLayout newLayout); // drops every cached page
+    auto texelAddressing() const -> const TexelAddressing& { return addressing; }
+
+    // Returns the decoded page used by the draw state, making sure rows vMin to vMax (wrapping at 256) are decoded
+    auto fetch (const DrawState& state, s32 vMin, s32 vMax) -> const u16*;
+};
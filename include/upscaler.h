@@ -0,0 +1,64 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "types.h"
+#include "vram.h"
+#include "vertex_arena.h"
+#include "rasterizer.h"
+
+/*
+ * Higher internal resolution. Keeps a render target scale times the size of VRAM on each axis, and draws every batch into it a second time
+ * with its vertices and drawing area scaled up, so edges, texture mapping and shading are worked out at the higher resolution.
+ * VRAM is still drawn at native resolution first and stays the reference for everything else: transfers, fills, copies and readbacks
+ * only touch VRAM, and the scaled pass samples its textures and CLUTs from it. VRAM blocks that change without being drawn to
+ * are copied over to the target with nearest neighbour scaling.
+ * The target has scale² times the pixels to fill, so it's split in horizontal bands, each drawn by its own thread and rasterizer
+*/
+
+class Upscaler {
+    static constexpr u32 MAX_THREADS = 8;
+    static constexpr u32 PARALLEL_MIN_PRIMITIVES = 16; // smaller batches are drawn on the calling thread, waking the workers would cost more
+
+    struct Band {
+        std::unique_ptr <Rasterizer> rasterizer;
+        s32 top, bottom; // rows of the target, inclusive
+    };
+
+    VRAM& vram;
+    const u32 scaleShift;
+    std::vector <u16> target;
+    std::array <u32, VRAM::BLOCKS_PER_ROW * VRAM::BLOCKS_PER_COLUMN> syncedGenerations; // generation of each VRAM block when the target last matched it
+
+    // the batch being drawn, in target coordinates
+    std::vector <RasterVertex> scaledVertices;
+    Batch scaledBatch;
+
+    std::vector <Band> bands; // band 0 is drawn by the thread that calls draw, band n by worker n - 1
+    std::vector <std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workReady;
+    std::condition_variable workDone;
+    u32 job = 0; // bumped for every batch handed to the workers
+    u32 busyWorkers = 0;
+    bool quit = false;
+
+    void copyBlock (u32 column, u32 row); // scale a VRAM block up into the target
+    void drawBand (Band& band, bool clipToBand);
+    void workerLoop (u32 index);
+
+public:
+    Upscaler (VRAM& _vram, u32 scale); // scale has to be 2 or 4
+    ~Upscaler();
+
+    auto scale() const -> u32 { return 1 << scaleShift; }
+    auto pixels() const -> const u16* { return target.data(); } // (WIDTH * scale) x (HEIGHT * scale) 1555 pixels
+    void setTextureLayout (TexelLayout layout);
+    void newFrame(); // roll the band rasterizers' stats over, like Rasterizer::newFrame
+
+    void sync(); // copy over every VRAM block that changed without being drawn to
+    void draw (const RasterVertex* vertices, const Batch& batch); // draw a batch that was just drawn into VRAM
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include <vector>
+#include "types.h"
+#include "draw_state.h"
+
+enum class PrimitiveType : u32 {
+    Triangle, // 3 vertices
+    Quad, // 4 vertices
+    TexturedRect, // 2 vertices: the top-left corner (with color and texcoords), then the size in x/y
+    FlatRect, // same as TexturedRect
+    Line // 2 vertices
+};
+
+constexpr auto verticesPerPrimitive (PrimitiveType type) -> u32 {
+    switch (type) {
+        case PrimitiveType::Triangle: return 3;
+        case PrimitiveType::Quad: return 4;
+        default: return 2;
+    }
+}
+
+// A run of consecutive primitives of the same type, drawn with the same flags and state
+struct Batch {
+    PrimitiveType type;
+    u32 flags; // Renderer::SHADED/TEXTURED/RAW_TEXTURE/H_FLIP/V_FLIP
+    DrawState state;
+    u32 firstVertex; // index of the first vertex of the batch in the arena
+    u32 vertexCount;
+};
+
+/*
+ * Fixed-capacity storage for the primitives of a frame. Everything is allocated up front and the arena is reset
+ * every time it's flushed to the renderer, so queueing a primitive never touches the heap.
+ * A primitive with the same type, flags and state as the previous one extends its batch, anything else starts a new batch.
+ * Batches are never reordered, so flushing them in order draws exactly what drawing each primitive immediately would
+*/
+
+class VertexArena {
+public:
+    static constexpr u32 VERTEX_CAPACITY = 32 * 1024;
+    static constexpr u32 BATCH_CAPACITY = 4 * 1024;
+
+private:
+    std::vector <RasterVertex> vertices;
+    std::vector <Batch> batches;
+    u32 vertexCount = 0;
+    u32 batchCount = 0;
+
+public:
+    VertexArena() : vertices (VERTEX_CAPACITY), batches (BATCH_CAPACITY) {}
+
+    // Returns where to write the primitive's vertices, or nullptr if the arena is full and needs to be flushed first
+    auto allocate (PrimitiveType type, u32 flags, const DrawState& state, u32 count) -> RasterVertex* {
+        if (vertexCount + count > VERTEX_CAPACITY)
+            return nullptr;
+
+        auto batch = batchCount == 0 ? nullptr : &batches[batchCount - 1];
+        if (batch == nullptr || batch -> type != type || batch -> flags != flags || !(batch -> state == state)) {
+            if (batchCount == BATCH_CAPACITY)
+                return nullptr;
+
+            batch = &batches[batchCount++];
+            batch -> type = type;
+            batch -> flags = flags;
+            batch -> state = state;
+            batch -> firstVertex = vertexCount;
+            batch -> vertexCount = 0;
+        }
+
+        auto dest = &vertices[vertexCount];
+        batch -> vertexCount += count;
+        vertexCount += count;
+        return dest;
+    }
+
+    void reset() {
+        vertexCount = 0;
+        batchCount = 0;
+    }
+
+    auto empty() const -> bool { return batchCount == 0; }
+    auto batchList() const -> const Batch* { return batches.data(); }
+    auto size() const -> u32 { return batchCount; }
+    auto vertexData() const -> const RasterVertex* { return vertices.data(); }
+    auto vertexSize() const -> u32 { return vertexCount; }
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <vector>
+#include "types.h"
+
+const auto WIDTH = 1024;
+const auto HEIGHT = 512;
+
+/*
+ * VRAM is 1024x512 halfwords. Each halfword is a pixel in the PSX's native 1555 format:
+ * bits 0-4 = red, 5-9 = green, 10-14 = blue, bit 15 = mask bit
+*/
+
+class VRAM {
+public:
+    std::vector <u16> pixels;
+
+    // VRAM is split in 64x16 blocks, each with a generation counter that's bumped every time the block is written to
+    // This lets caches of things derived from VRAM (eg decoded textures) find out if they're stale without tracking every write
+    static constexpr u32 BLOCK_WIDTH = 64;
+    static constexpr u32 BLOCK_HEIGHT = 16;
+    static constexpr u32 BLOCKS_PER_ROW = WIDTH / BLOCK_WIDTH;
+    static constexpr u32 BLOCKS_PER_COLUMN = HEIGHT / BLOCK_HEIGHT;
+    std::array <u32, BLOCKS_PER_ROW * BLOCKS_PER_COLUMN> generations;
+
+    void setPixel (int x, int y, u16 color);
+    u16 getPixel (int x, int y);
+    u32 getPixel24bit(int x, int y);
+
+    // VRAM->VRAM copy (GP0 80h). Rows are moved memmove-style, so overlapping rectangles copy correctly
+    // setMask is ORed into every written pixel, if checkMask is set, pixels with the mask bit set are not overwritten
+    void copyRect (u32 srcX, u32 srcY, u32 destX, u32 destY, u32 width, u32 height, u16 setMask, bool checkMask);
+    // VRAM fill (GP0 02h). Ignores the drawing area and the mask bit settings, wraps around VRAM
+    void fillRect (u32 x, u32 y, u32 width, u32 height, u16 color);
+    // VRAM->CPU copy (GP0 C0h). Packs the rectangle into words, 2 pixels per word (low halfword first)
+    void readRect (u32 x, u32 y, u32 width, u32 height, std::vector <u32>& dest);
+
+    void markDirty (u32 x, u32 y, u32 width, u32 height); // bump the generation of every block the rectangle touches. Wraps around VRAM
+    auto generation (u32 x, u32 y, u32 width, u32 height) -> u64; // sum of the generations of the blocks the rectangle touches. Grows whenever any of them is written
+
+    static void fillSpan (u16* dest, u32 count, u16 color); // fill a span of pixels in a row with a single color
+
+    static constexpr auto RGB555ToRGBA (u16 pixel) -> u32 { // converts a 1555 pixel to the little endian RGBA8888 format SFML wants
+        u32 r = (pixel & 0x1F) << 3;
+        u32 g = ((pixel >> 5) & 0x1F) << 3;
+        u32 b = ((pixel >> 10) & 0x1F) << 3;
+
+        return r | (g << 8) | (b << 16) | 0xFF00'0000;
+    }
+
+    VRAM();
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <SFML/Graphics.hpp>
+#include "helpers.h"
+#include "software_renderer.h"
+
+/*
+ * The windowed backend. Draws with the software rasterizer, then presents the display area in an SFML window.
+ * In 15-bit mode, the SFML surface texture is a persistent copy of VRAM. Every frame, only the VRAM blocks inside the display area
+ * that have been written to since they were last uploaded get converted and uploaded again.
+ * 24-bit pixels don't line up with VRAM blocks, so in 24-bit mode the whole display area goes through the display stage
+ * into its own texture, but only on frames where VRAM under the display area changed.
+ * If nothing changed, the window isn't redrawn at all.
+ * At a higher internal resolution, the surface is a copy of the upscaler's render target instead, which is drawn shrunk to the window's
+ * native size and filtered, so it shows its detail when the window is made bigger. With downsampling on, 15-bit frames are averaged down
+ * by the display stage and go through the same path as 24-bit ones. 24-bit frames always come from VRAM, they're pictures uploaded by the CPU
+*/
+
+class BeegRenderer final : public SoftwareRenderer {
+    sf::ContextSettings context_settings;
+    sf::RenderWindow window;
+    sf::Texture surface; // VRAM on the SFML side, as of the last upload
+    std::vector <u32> staging; // RGBA8888 pixels of the rectangle being uploaded
+    std::array <u32, VRAM::BLOCKS_PER_ROW * VRAM::BLOCKS_PER_COLUMN> presentedGenerations; // generation of each VRAM block when it was last uploaded
+    sf::Texture extracted; // the display area, in 24-bit mode or when downsampling
+    std::vector <u8> extractedPixels;
+    u32 extractedWidth = 0;
+    u32 extractedHeight = 0;
+    u64 extractedGeneration = 0; // VRAM generation of the display area when it was last extracted
+    const u32 scale; // internal resolution
+    const bool downsample;
+
+    DisplayArea lastDisplayArea = { 0, 0, 0, 0, false };
+    bool redraw = true; // set when the window has to be redrawn even if nothing changed (eg after a resize)
+
+    void uploadRect (u32 x, u32 y, u32 width, u32 height); // convert a VRAM rectangle (or its scaled up version) to RGBA and upload it to the surface
+    void uploadDirtyBlocks (const DisplayArea& area); // upload every stale block that intersects the display area
+    void updateExtractedFrame (const DisplayArea& area); // extract the display area if VRAM under it changed
+
+    auto extracts (const DisplayArea& area) const -> bool { // whether the display area is presented through extracted instead of the surface
+        return area.is24bit || (upscaler && downsample);
+    }
+
+public:
+    BeegRenderer (VRAM& _vram, int width, int height, std::string title, u32 _scale = 1, bool _downsample = false);
+
+    auto isOpen() -> bool override {
+        return window.isOpen();
+    }
+
+    void close() {
+        window.close();
+    }
+
+    void set_title (std::string title) {
+        window.setTitle(title.c_str());
+    }
+
+    void poll_events();
+    void present (const DisplayArea& area) override;
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include <array>
+#include "types.h"
+#include "audio_ring.h"
+
+/*
+ * XA-ADPCM, the compressed audio streamed from Mode 2 Form 2 sectors. A sector holds 18 sound groups of 128 bytes, each of them
+ * 8 units of 28 4-bit samples or 4 units of 28 8-bit samples (in stereo, even units are the left channel and odd ones the right).
+ * Each unit has a shift and a prediction filter, which adds a weighted sum of the last 2 decoded samples to every sample.
+ * The 18.9 or 37.8kHz output is resampled to 44.1kHz the way the hardware does it: 18.9kHz samples are doubled, and every
+ * 6 samples at 37.8kHz turn into 7 samples at 44.1kHz, each a 29 tap FIR of the previous samples ("zigzag interpolation").
+ * The FIRs run on SIMD, the prediction filter can't since every sample depends on the one before it
+*/
+
+class XADecoder {
+    static constexpr u32 GROUPS_PER_SECTOR = 18;
+    static constexpr u32 SAMPLES_PER_UNIT = 28;
+    static constexpr u32 MAX_SAMPLES = GROUPS_PER_SECTOR * 8 * SAMPLES_PER_UNIT; // per channel per sector, for 4-bit mono
+    static constexpr u32 MAX_RESAMPLED = MAX_SAMPLES * 2 * 7 / 6; // 4-bit mono at 18.9kHz
+    static constexpr u32 HISTORY = 32; // zigzag FIR window, 29 taps rounded up
+
+    struct Channel {
+        s32 old = 0; // last 2 decoded samples, for the prediction filter
+        s32 older = 0;
+        std::array <s16, HISTORY * 2> history {}; // last 32 samples at 37.8kHz, stored twice so the window never wraps
+        u32 historyPos = 0;
+        u32 sixStep = 6; // samples left until the next 7 outputs
+    };
+
+    std::array <Channel, 2> channels;
+    std::array <std::array <s16, MAX_SAMPLES>, 2> decoded; // per sector scratch buffers, so decoding never allocates
+    std::array <std::array <s16, MAX_RESAMPLED>, 2> resampled;
+
+    void decodeUnit (const u8* group, u32 unit, bool eightBit, Channel& channel, s16* dest);
+    auto resample (Channel& channel, const s16* samples, u32 count, bool halfRate, s16* dest) -> u32; // how many samples it output
+
+public:
+    enum CodingInfo : u8 { // subheader byte 3
+        CodingStereo = 1 << 0,
+        CodingHalfRate = 1 << 2, // 18.9kHz instead of 37.8kHz
+        CodingEightBit = 1 << 4
+    };
+
+    void reset(); // forget the previous samples, for when a new stream starts
+
+    // Decode the 18 sound groups of a sector (starting right after its subheader), scale the channels by the CD-ROM's
+    // volume matrix (L->L, L->R, R->R, R->L with 0x80 = 100%) and push the 44.1kHz result to out
+    void decodeSector (const u8* data, u8 codingInfo, const std::array <u8, 4>& volume, AudioRing& out);
+};
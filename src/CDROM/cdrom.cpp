@@ -0,0 +1,402 @@
+#include <algorithm>
+#include "include/cdrom.h"
+#include "include/helpers.h"
+
+namespace {
+    auto toBCD (u32 value) -> u8 {
+        return (u8) (((value / 10) << 4) | (value % 10));
+    }
+
+    auto fromBCD (u8 value) -> u32 {
+        return (value >> 4) * 10 + (value & 0xF);
+    }
+
+    constexpr u32 NEXT_RESPONSE_CYCLES = 1'000; // from acknowledging an interrupt to the next queued one
+}
+
+CDROM::CDROM (Scheduler* _scheduler, std::function <void()> _irq) : scheduler(_scheduler), irq(std::move (_irq)) {
+    sectorBuffer.fill (0);
+    stat = StatShellOpen; // until a disc gets inserted
+
+    scheduler -> setHandler (SchedulerEvent::CDROMCommand, [this] { executeCommand(); });
+    scheduler -> setHandler (SchedulerEvent::CDROMSecondResponse, [this] { secondResponse(); });
+    scheduler -> setHandler (SchedulerEvent::CDROMRead, [this] { readSector(); });
+    scheduler -> setHandler (SchedulerEvent::CDROMResponse, [this] { deliverResponse(); });
+}
+
+void CDROM::insertDisc (std::unique_ptr <Disc> _disc) {
+    disc = std::move (_disc);
+    stat = StatMotorOn;
+    disc -> prefetch (Disc::PREGAP); // the first thing anything reads is the start of the data track
+}
+
+auto CDROM::read (u32 address) -> u8 {
+    switch (address & 3) {
+        case 0: { // status
+            u8 status = index;
+            status |= parameters.empty() << 3;
+            status |= (parameters.size() < 16) << 4;
+            status |= (responsePos < responseFifo.size()) << 5;
+            status |= (dataPos < dataFifo.size()) << 6;
+            status |= commandBusy << 7;
+            return status;
+        }
+
+        case 1: // response FIFO
+            return responsePos < responseFifo.size() ? responseFifo[responsePos++] : 0;
+
+        case 2: { // data FIFO
+            u8 value = 0;
+            readData (&value, 1);
+            return value;
+        }
+
+        default: // interrupt enable on even indices, flags on odd ones. The top 3 bits always read as 1
+            return ((index & 1) ? interruptFlag : interruptEnable) | 0xE0;
+    }
+}
+
+void CDROM::write (u32 address, u8 value) {
+    switch ((address & 3) * 4 + ((address & 3) == 0 ? 0 : index)) {
+        case 0: index = value & 3; break;
+
+        case 4: // command
+            if (commandBusy)
+                Helpers::warn ("CD-ROM command %02X sent while command %02X was still being processed\n", value, pendingCommand);
+
+            pendingCommand = value;
+            commandParameters.assign (parameters.begin(), parameters.end());
+            parameters.clear();
+            commandBusy = true;
+            scheduler -> schedule (SchedulerEvent::CDROMCommand, value == 0x0A ? INIT_RESPONSE_CYCLES : FIRST_RESPONSE_CYCLES);
+            break;
+
+        case 5: case 6: break; // sound map output, which isn't emulated
+        case 7: pendingVolume[2] = value; break; // right -> right
+
+        case 8: // parameter FIFO
+            if (parameters.size() < 16)
+                parameters.push_back (value);
+            break;
+
+        case 9: interruptEnable = value & 0x1F; break;
+        case 10: pendingVolume[0] = value; break; // left -> left
+        case 11: pendingVolume[3] = value; break; // right -> left
+
+        case 12: // request register
+            if (value & 0x80) // BFRD: hand the sector buffer to the data FIFO
+                loadDataFifo();
+            else {
+                dataFifo.clear();
+                dataPos = 0;
+            }
+            break;
+
+        case 13: // acknowledge interrupts
+            interruptFlag &= ~(value & 0x1F);
+            if (value & 0x40)
+                parameters.clear();
+
+            if (interruptFlag == 0 && !pendingResponses.empty())
+                scheduler -> schedule (SchedulerEvent::CDROMResponse, NEXT_RESPONSE_CYCLES);
+            break;
+
+        case 14: pendingVolume[1] = value; break; // left -> right
+        case 15: // apply volumes
+            if (value & 0x20)
+                volume = pendingVolume;
+            break;
+    }
+}
+
+void CDROM::loadDataFifo() {
+    const auto wholeSector = (mode & ModeWholeSector) != 0;
+    const auto start = wholeSector ? 12 : (sectorBuffer[15] == 1 ? 16 : 24); // skip the sync pattern, and the header and subheader too for 0x800 byte reads
+    const auto size = wholeSector ? 0x924 : 0x800;
+
+    dataFifo.assign (sectorBuffer.begin() + start, sectorBuffer.begin() + start + size);
+    dataPos = 0;
+}
+
+void CDROM::readData (u8* dest, size_t count) {
+    const auto available = std::min (count, dataFifo.size() - dataPos);
+    std::copy_n (dataFifo.begin() + dataPos, available, dest);
+    dataPos += available;
+
+    if (available < count) {
+        Helpers::warn ("Read %zu bytes past the end of the CD-ROM data FIFO\n", count - available);
+        std::fill_n (dest + available, count - available, 0);
+    }
+}
+
+void CDROM::queueResponse (u8 interrupt, std::vector <u8> bytes) {
+    if (interrupt == 1) { // a sector the CPU didn't get to yet is overwritten by the next one
+        pendingResponses.erase (std::remove_if (pendingResponses.begin(), pendingResponses.end(), [] (const Response& r) { return r.interrupt == 1; }),
+                                pendingResponses.end());
+    }
+
+    pendingResponses.push_back ({ interrupt, std::move (bytes) });
+    deliverResponse();
+}
+
+void CDROM::deliverResponse() {
+    if (interruptFlag != 0 || pendingResponses.empty())
+        return;
+
+    auto& response = pendingResponses.front();
+    responseFifo = std::move (response.bytes);
+    responsePos = 0;
+    interruptFlag = response.interrupt;
+    pendingResponses.pop_front();
+
+    if (interruptFlag & interruptEnable)
+        irq();
+}
+
+void CDROM::error (u8 code) {
+    queueResponse (5, { (u8) (stat | StatError), code });
+}
+
+auto CDROM::seekCycles() const -> u32 {
+    const auto distance = seekTarget > position ? seekTarget - position : position - seekTarget;
+    return std::min (SEEK_BASE_CYCLES + distance * SEEK_CYCLES_PER_SECTOR, MAX_SEEK_CYCLES);
+}
+
+void CDROM::startReading() {
+    auto delay = sectorCycles();
+    if (seekPending) {
+        delay += seekCycles();
+        position = seekTarget;
+        seekPending = false;
+        xaDecoder.reset(); // a new stream, don't predict from the last one's samples
+    }
+
+    stat = (stat & ~(StatPlaying | StatSeeking)) | StatReading;
+    disc -> prefetch (position);
+    scheduler -> schedule (SchedulerEvent::CDROMRead, delay);
+}
+
+void CDROM::stopReading() {
+    stat &= ~(StatReading | StatPlaying | StatSeeking);
+    scheduler -> cancel (SchedulerEvent::CDROMRead);
+}
+
+void CDROM::readSector() {
+    // Never block on the host's disk: until the read-ahead has the sector in memory, check back a fraction of a sector later.
+    // A slow host disk just looks like a slow drive to the game
+    if (!disc -> isSectorReady (position)) {
+        disc -> prefetch (position);
+        scheduler -> schedule (SchedulerEvent::CDROMRead, NOT_READY_RETRY_CYCLES);
+        return;
+    }
+
+    disc -> readSector (position, sectorBuffer.data());
+    disc -> prefetch (position + 1);
+    std::copy_n (sectorBuffer.begin() + 12, lastHeader.size(), lastHeader.begin());
+    position++;
+
+    if (!playXA())
+        queueResponse (1, { stat });
+    scheduler -> schedule (SchedulerEvent::CDROMRead, sectorCycles());
+}
+
+auto CDROM::playXA() -> bool {
+    const auto submode = sectorBuffer[18];
+    if (!(mode & ModeXAADPCM) || sectorBuffer[15] != 2 || (submode & (SubmodeAudio | SubmodeRealTime)) != (SubmodeAudio | SubmodeRealTime))
+        return false;
+
+    // Audio sectors of other files and channels are interleaved with the one being played, and just get skipped
+    const auto file = sectorBuffer[16];
+    const auto channel = sectorBuffer[17];
+    if ((mode & ModeXAFilter) && (file != filterFile || channel != filterChannel))
+        return true;
+
+    static constexpr std::array <u8, 4> silence = { 0, 0, 0, 0 };
+    xaDecoder.decodeSector (&sectorBuffer[24], sectorBuffer[19], muted ? silence : volume, xaAudio);
+    return true;
+}
+
+void CDROM::executeCommand() {
+    commandBusy = false;
+    const auto& params = commandParameters;
+    auto needs = [&] (size_t count) { // commands with the wrong number of parameters get an error instead
+        if (params.size() == count)
+            return true;
+
+        error (0x20);
+        return false;
+    };
+
+    if (disc == nullptr && pendingCommand != 0x01 && pendingCommand != 0x19 && pendingCommand != 0x0A) {
+        error (0x80); // door open / no disc
+        return;
+    }
+
+    switch (pendingCommand) {
+        case 0x01: // GetStat
+            queueResponse (3, { stat });
+            if (disc != nullptr)
+                stat &= ~StatShellOpen; // the shell open bit stays until it's been read once with the shell closed
+            break;
+
+        case 0x02: // Setloc mm, ss, ff
+            if (!needs (3))
+                break;
+
+            seekTarget = (fromBCD (params[0]) * 60 + fromBCD (params[1])) * 75 + fromBCD (params[2]);
+            seekPending = true;
+            queueResponse (3, { stat });
+            break;
+
+        case 0x03: // Play. CD audio isn't emulated, the drive just says it's playing
+            stopReading();
+            if (seekPending) {
+                position = seekTarget;
+                seekPending = false;
+            }
+            stat |= StatPlaying;
+            queueResponse (3, { stat });
+            break;
+
+        case 0x06: case 0x1B: // ReadN, ReadS
+            queueResponse (3, { stat });
+            startReading();
+            break;
+
+        case 0x07: case 0x08: case 0x09: case 0x12: case 0x1E: // Standby, Stop, Pause, SetSession, ReadTOC: INT3 now, INT2 once done
+            queueResponse (3, { stat });
+            if (pendingCommand == 0x08 || pendingCommand == 0x09)
+                stopReading();
+            if (pendingCommand == 0x08)
+                stat &= ~StatMotorOn;
+            if (pendingCommand == 0x07)
+                stat |= StatMotorOn;
+
+            secondResponseCommand = pendingCommand;
+            scheduler -> schedule (SchedulerEvent::CDROMSecondResponse, pendingCommand == 0x09 ? sectorCycles() : SECOND_RESPONSE_CYCLES);
+            break;
+
+        case 0x0A: // Init
+            stopReading();
+            mode = 0;
+            stat = disc != nullptr ? StatMotorOn : StatShellOpen;
+            queueResponse (3, { stat });
+            secondResponseCommand = 0x0A;
+            scheduler -> schedule (SchedulerEvent::CDROMSecondResponse, SECOND_RESPONSE_CYCLES);
+            break;
+
+        case 0x0B: case 0x0C: // Mute, Demute
+            muted = pendingCommand == 0x0B;
+            queueResponse (3, { stat });
+            break;
+
+        case 0x0D: // Setfilter file, channel
+            if (!needs (2))
+                break;
+
+            filterFile = params[0];
+            filterChannel = params[1];
+            queueResponse (3, { stat });
+            break;
+
+        case 0x0E: // Setmode
+            if (!needs (1))
+                break;
+
+            mode = params[0];
+            queueResponse (3, { stat });
+            break;
+
+        case 0x0F: // Getparam
+            queueResponse (3, { stat, mode, 0, filterFile, filterChannel });
+            break;
+
+        case 0x10: // GetlocL: header and subheader of the last sector read
+            queueResponse (3, std::vector <u8> (lastHeader.begin(), lastHeader.end()));
+            break;
+
+        case 0x11: { // GetlocP: where the head is, relative to its track and absolute
+            const auto& track = disc -> trackAt (position);
+            const auto relative = position >= track.start ? position - track.start : track.start - position; // counts down in the pregap
+            queueResponse (3, { toBCD (track.number), 1,
+                                toBCD (relative / 75 / 60), toBCD (relative / 75 % 60), toBCD (relative % 75),
+                                toBCD (position / 75 / 60), toBCD (position / 75 % 60), toBCD (position % 75) });
+            break;
+        }
+
+        case 0x13: // GetTN: first and last track numbers
+            queueResponse (3, { stat, toBCD (disc -> tracks().front().number), toBCD (disc -> tracks().back().number) });
+            break;
+
+        case 0x14: { // GetTD track: where a track starts, track 0 being the lead-out
+            if (!needs (1))
+                break;
+
+            const auto number = fromBCD (params[0]);
+            u32 sector = disc -> leadOut();
+            bool found = number == 0;
+            for (auto& track : disc -> tracks()) {
+                if (track.number == number) {
+                    sector = track.start;
+                    found = true;
+                }
+            }
+
+            if (!found) {
+                error (0x10);
+                break;
+            }
+
+            queueResponse (3, { stat, toBCD (sector / 75 / 60), toBCD (sector / 75 % 60) });
+            break;
+        }
+
+        case 0x15: case 0x16: { // SeekL, SeekP
+            stopReading();
+            const auto cycles = seekCycles();
+            position = seekTarget;
+            seekPending = false;
+            stat |= StatSeeking;
+            queueResponse (3, { stat });
+
+            secondResponseCommand = pendingCommand;
+            scheduler -> schedule (SchedulerEvent::CDROMSecondResponse, cycles);
+            break;
+        }
+
+        case 0x19: // Test
+            if (params.size() == 1 && params[0] == 0x20) // controller version: 1998-09-19, version C0
+                queueResponse (3, { 0x94, 0x09, 0x19, 0xC0 });
+            else
+                error (0x10);
+            break;
+
+        case 0x1A: // GetID
+            queueResponse (3, { stat });
+            secondResponseCommand = 0x1A;
+            scheduler -> schedule (SchedulerEvent::CDROMSecondResponse, SECOND_RESPONSE_CYCLES);
+            break;
+
+        default:
+            Helpers::warn ("Unimplemented CD-ROM command %02X\n", pendingCommand);
+            error (0x40);
+            break;
+    }
+}
+
+void CDROM::secondResponse() {
+    switch (secondResponseCommand) {
+        case 0x15: case 0x16: // seeks are done
+            stat &= ~StatSeeking;
+            queueResponse (2, { stat });
+            break;
+
+        case 0x1A: // GetID: a licensed, NTSC-U data disc
+            queueResponse (2, { stat, 0x00, 0x20, 0x00, 'S', 'C', 'E', 'A' });
+            break;
+
+        default:
+            queueResponse (2, { stat });
+            break;
+    }
+}
@@ -0,0 +1,437 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include "include/compressed_disc.h"
+#include "include/helpers.h"
+
+namespace {
+    constexpr u32 MIN_MATCH = 4;
+    constexpr size_t LAST_LITERALS = 5; // LZ4 blocks end with at least this many literals
+    constexpr size_t MATCH_START_LIMIT = 12; // and the last match starts at least this far from the end
+    constexpr u32 HASH_BITS = 14;
+    constexpr u32 MAX_OFFSET = 65535;
+
+    auto read32 (const u8* pointer) -> u32 {
+        u32 value;
+        std::memcpy (&value, pointer, sizeof (u32));
+        return value;
+    }
+
+    void writeLength (std::vector <u8>& dest, size_t length) { // the part of a length that didn't fit in the token
+        for (; length >= 255; length -= 255)
+            dest.push_back (255);
+        dest.push_back ((u8) length);
+    }
+
+    void writeSequence (std::vector <u8>& dest, const u8* literals, size_t literalCount, u32 offset, size_t matchLength) {
+        const auto matchCode = matchLength - MIN_MATCH;
+        dest.push_back ((u8) ((std::min <size_t> (literalCount, 15) << 4) | std::min <size_t> (matchCode, 15)));
+        if (literalCount >= 15)
+            writeLength (dest, literalCount - 15);
+
+        dest.insert (dest.end(), literals, literals + literalCount);
+        dest.push_back ((u8) offset);
+        dest.push_back ((u8) (offset >> 8));
+        if (matchCode >= 15)
+            writeLength (dest, matchCode - 15);
+    }
+
+    auto crcTable() -> const std::array <u32, 256>& {
+        static const auto table = [] {
+            std::array <u32, 256> table;
+            for (u32 i = 0; i < 256; i++) {
+                auto crc = i;
+                for (auto bit = 0; bit < 8; bit++)
+                    crc = (crc & 1) ? (crc >> 1) ^ 0xEDB8'8320 : crc >> 1;
+                table[i] = crc;
+            }
+
+            return table;
+        }();
+
+        return table;
+    }
+
+    auto hashBytes (const void* data, size_t size, u64 hash = 0xCBF2'9CE4'8422'2325) -> u64 { // FNV-1a
+        const auto bytes = (const u8*) data;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100'0000'01B3;
+        }
+
+        return hash;
+    }
+}
+
+auto CompressedDiscFormat::crc32 (const u8* data, size_t size) -> u32 {
+    const auto& table = crcTable();
+    u32 crc = ~0u;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+// Greedy LZ4 block compression. Every 4 byte sequence is hashed, and the table remembers where it was last seen
+void CompressedDiscFormat::compress (const u8* source, size_t size, std::vector <u8>& dest) {
+    std::vector <u32> table (1 << HASH_BITS, ~0u);
+    size_t anchor = 0; // first byte that isn't covered by a sequence yet
+    size_t pos = 0;
+
+    if (size > MATCH_START_LIMIT) {
+        const auto matchStartLimit = size - MATCH_START_LIMIT;
+        const auto matchEndLimit = size - LAST_LITERALS;
+
+        while (pos < matchStartLimit) {
+            const auto sequence = read32 (source + pos);
+            const auto hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+            const auto candidate = table[hash];
+            table[hash] = (u32) pos;
+
+            if (candidate == ~0u || pos - candidate > MAX_OFFSET || read32 (source + candidate) != sequence) {
+                pos++;
+                continue;
+            }
+
+            auto length = (size_t) MIN_MATCH;
+            while (pos + length < matchEndLimit && source[candidate + length] == source[pos + length])
+                length++;
+
+            writeSequence (dest, source + anchor, pos - anchor, (u32) (pos - candidate), length);
+            pos += length;
+            anchor = pos;
+        }
+    }
+
+    // The last sequence is only literals
+    const auto literalCount = size - anchor;
+    dest.push_back ((u8) (std::min <size_t> (literalCount, 15) << 4));
+    if (literalCount >= 15)
+        writeLength (dest, literalCount - 15);
+    dest.insert (dest.end(), source + anchor, source + size);
+}
+
+// Every length and offset is checked against the buffers, so a corrupt image fails here instead of reading or writing out of bounds
+auto CompressedDiscFormat::decompress (const u8* source, size_t size, u8* dest, size_t destSize) -> bool {
+    const auto sourceEnd = source + size;
+    const auto destStart = dest;
+    const auto destEnd = dest + destSize;
+
+    const auto readLength = [&] (size_t& length) {
+        u8 byte;
+        do {
+            if (source == sourceEnd)
+                return false;
+            byte = *source++;
+            length += byte;
+        } while (byte == 255);
+
+        return true;
+    };
+
+    while (source < sourceEnd) {
+        const auto token = *source++;
+
+        auto literalCount = (size_t) (token >> 4);
+        if (literalCount == 15 && !readLength (literalCount))
+            return false;
+        if (literalCount > (size_t) (sourceEnd - source) || literalCount > (size_t) (destEnd - dest))
+            return false;
+
+        std::memcpy (dest, source, literalCount);
+        source += literalCount;
+        dest += literalCount;
+
+        if (source == sourceEnd) // the last sequence has no match
+            break;
+
+        if (sourceEnd - source < 2)
+            return false;
+        const auto offset = (size_t) (source[0] | (source[1] << 8));
+        source += 2;
+
+        auto length = (size_t) (token & 0xF);
+        if (length == 15 && !readLength (length))
+            return false;
+        length += MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t) (dest - destStart) || length > (size_t) (destEnd - dest))
+            return false;
+
+        const auto match = dest - offset;
+        if (offset >= length)
+            std::memcpy (dest, match, length);
+        else { // the match overlaps what it's writing, which repeats the last offset bytes
+            for (size_t i = 0; i < length; i++)
+                dest[i] = match[i];
+        }
+
+        dest += length;
+    }
+
+    return dest == destEnd;
+}
+
+auto HunkCache::instance() -> HunkCache& {
+    static HunkCache cache;
+    return cache;
+}
+
+auto HunkCache::find (u64 image, u32 hunk) -> Hunk {
+    std::lock_guard <std::mutex> lock (mutex);
+    const auto entry = lookup.find ({ image, hunk });
+    if (entry == lookup.end())
+        return nullptr;
+
+    entries.splice (entries.begin(), entries, entry -> second); // now the most recently used
+    return entry -> second -> second;
+}
+
+void HunkCache::insert (u64 image, u32 hunk, Hunk data) {
+    std::lock_guard <std::mutex> lock (mutex);
+    const Key key = { image, hunk };
+    if (lookup.count (key) != 0) // another instance decompressed it in the meantime
+        return;
+
+    size += data -> size();
+    entries.emplace_front (key, std::move (data));
+    lookup[key] = entries.begin();
+    evict();
+}
+
+void HunkCache::setCapacity (size_t bytes) {
+    std::lock_guard <std::mutex> lock (mutex);
+    capacity = bytes;
+    evict();
+}
+
+void HunkCache::evict() {
+    while (size > capacity && !entries.empty()) {
+        const auto& last = entries.back();
+        size -= last.second -> size();
+        lookup.erase (last.first);
+        entries.pop_back();
+    }
+}
+
+CompressedDisc::CompressedDisc (const std::string& path) : file (path) {
+    using namespace CompressedDiscFormat;
+
+    if (file.size() < sizeof (Header))
+        Helpers::panic ("%s is too small to be a compressed disc image\n", path.c_str());
+
+    std::memcpy (&header, file.data(), sizeof (Header));
+    if (std::memcmp (header.magic, MAGIC, sizeof (MAGIC)) != 0)
+        Helpers::panic ("%s is not a compressed disc image\n", path.c_str());
+    if (header.version != VERSION)
+        Helpers::panic ("%s is a version %u compressed disc image, only version %u is supported\n", path.c_str(), header.version, VERSION);
+
+    const auto sectors = header.leadOut >= header.firstSector ? header.leadOut - header.firstSector : 0;
+    if (header.hunkSectors == 0 || header.hunkSectors > MAX_HUNK_SECTORS || header.trackCount == 0 || header.trackCount > 99
+        || header.hunkCount != (sectors + header.hunkSectors - 1) / header.hunkSectors)
+        Helpers::panic ("%s has a corrupt header\n", path.c_str());
+
+    const auto tracksOffset = sizeof (Header);
+    const auto hunksOffset = tracksOffset + (size_t) header.trackCount * sizeof (TrackEntry);
+    const auto dataOffset = hunksOffset + (size_t) header.hunkCount * sizeof (HunkEntry);
+    if (file.size() < dataOffset)
+        Helpers::panic ("%s is truncated\n", path.c_str());
+
+    for (u32 i = 0; i < header.trackCount; i++) {
+        TrackEntry track;
+        std::memcpy (&track, file.data() + tracksOffset + i * sizeof (TrackEntry), sizeof (TrackEntry));
+        trackList.push_back ({ track.number, track.audio != 0, track.start });
+    }
+
+    end = header.leadOut;
+    hunks.resize (header.hunkCount);
+    std::memcpy (hunks.data(), file.data() + hunksOffset, hunks.size() * sizeof (HunkEntry));
+
+    const auto hunkSize = (size_t) header.hunkSectors * SECTOR_SIZE;
+    for (const auto& hunk : hunks) {
+        if (hunk.length > hunkSize || hunk.offset < dataOffset || hunk.offset > file.size() || hunk.length > file.size() - hunk.offset)
+            Helpers::panic ("%s has a corrupt hunk index\n", path.c_str());
+    }
+
+    // The per-hunk CRCs make the index identify the image's contents
+    identity = hashBytes (&header, sizeof (Header));
+    identity = hashBytes (hunks.data(), hunks.size() * sizeof (HunkEntry), identity);
+
+    readAhead = std::thread (&CompressedDisc::readAheadLoop, this);
+}
+
+CompressedDisc::~CompressedDisc() {
+    {
+        std::lock_guard <std::mutex> lock (mutex);
+        quit = true;
+    }
+
+    wake.notify_one();
+    readAhead.join();
+}
+
+auto CompressedDisc::loadHunk (u32 index) -> HunkCache::Hunk {
+    auto& cache = HunkCache::instance();
+    if (auto hunk = cache.find (identity, index); hunk != nullptr)
+        return hunk;
+
+    const auto& entry = hunks[index];
+    const auto hunkSize = (size_t) header.hunkSectors * SECTOR_SIZE;
+    auto data = std::make_shared <std::vector <u8>> (hunkSize);
+    const auto source = file.data() + entry.offset;
+
+    if (entry.length == hunkSize)
+        std::memcpy (data -> data(), source, hunkSize);
+    else if (!CompressedDiscFormat::decompress (source, entry.length, data -> data(), hunkSize))
+        Helpers::panic ("Compressed disc hunk %u is corrupt\n", index);
+
+    if (CompressedDiscFormat::crc32 (data -> data(), hunkSize) != entry.crc)
+        Helpers::panic ("Compressed disc hunk %u failed its checksum\n", index);
+
+    HunkCache::Hunk hunk = std::move (data);
+    cache.insert (identity, index, hunk);
+    return hunk;
+}
+
+void CompressedDisc::readSector (u32 sector, u8* dest) {
+    if (sector < header.firstSector || sector >= header.leadOut) {
+        std::memset (dest, 0, SECTOR_SIZE);
+        return;
+    }
+
+    const auto index = hunkOf (sector);
+    if (index != currentIndex) {
+        current = loadHunk (index);
+        currentIndex = index;
+    }
+
+    const auto offset = (size_t) ((sector - header.firstSector) % header.hunkSectors) * SECTOR_SIZE;
+    std::memcpy (dest, current -> data() + offset, SECTOR_SIZE);
+}
+
+// Ready once its hunk is decompressed. The hunk becomes the current one, so it can't get evicted before readSector gets to it
+auto CompressedDisc::isSectorReady (u32 sector) -> bool {
+    if (sector < header.firstSector || sector >= header.leadOut)
+        return true;
+
+    const auto index = hunkOf (sector);
+    if (index == currentIndex)
+        return true;
+
+    auto hunk = HunkCache::instance().find (identity, index);
+    if (hunk == nullptr)
+        return false;
+
+    current = std::move (hunk);
+    currentIndex = index;
+    return true;
+}
+
+void CompressedDisc::prefetch (u32 sector) {
+    {
+        std::lock_guard <std::mutex> lock (mutex);
+        if (target == sector)
+            return;
+
+        target = sector;
+    }
+
+    wake.notify_one();
+}
+
+void CompressedDisc::readAheadLoop() {
+    u32 seen = ~0u;
+
+    while (true) {
+        u32 from;
+        {
+            std::unique_lock <std::mutex> lock (mutex);
+            wake.wait (lock, [&] { return quit || target != seen; });
+            if (quit)
+                return;
+
+            from = seen = target;
+        }
+
+        // Hunks that are still cached from last time are just found again, which also keeps them from being evicted
+        const auto first = std::max (from, header.firstSector);
+        const auto last = std::min <u64> ((u64) from + READ_AHEAD_SECTORS, header.leadOut);
+        for (u64 sector = first; sector < last; sector += header.hunkSectors - (sector - header.firstSector) % header.hunkSectors) {
+            {
+                std::lock_guard <std::mutex> lock (mutex);
+                if (quit || target != seen) // the reader moved on, go look at where it is now
+                    break;
+            }
+
+            loadHunk (hunkOf ((u32) sector));
+        }
+    }
+}
+
+// Writes the header and a placeholder index, then the hunks as they get compressed, then goes back and fills the index in
+auto CompressedDisc::convert (Disc& source, const std::string& path, u32 hunkSectors) -> ConvertStats {
+    using namespace CompressedDiscFormat;
+
+    if (hunkSectors == 0 || hunkSectors > MAX_HUNK_SECTORS)
+        Helpers::panic ("Hunks have to be 1 to %u sectors\n", MAX_HUNK_SECTORS);
+
+    std::ofstream out (path, std::ios::binary);
+    if (out.fail())
+        Helpers::panic ("Couldn't create %s\n", path.c_str());
+
+    const auto sectors = source.leadOut() - PREGAP;
+    Header header;
+    std::memcpy (header.magic, MAGIC, sizeof (MAGIC));
+    header.version = VERSION;
+    header.hunkSectors = hunkSectors;
+    header.hunkCount = (sectors + hunkSectors - 1) / hunkSectors;
+    header.trackCount = (u32) source.tracks().size();
+    header.firstSector = PREGAP;
+    header.leadOut = source.leadOut();
+    out.write ((const char*) &header, sizeof (Header));
+
+    for (const auto& track : source.tracks()) {
+        const TrackEntry entry = { track.number, track.audio ? 1u : 0u, track.start };
+        out.write ((const char*) &entry, sizeof (TrackEntry));
+    }
+
+    std::vector <HunkEntry> index (header.hunkCount);
+    const auto indexOffset = (u64) out.tellp();
+    out.write ((const char*) index.data(), index.size() * sizeof (HunkEntry));
+
+    ConvertStats stats = { header.hunkCount, 0, 0, 0 };
+    const auto hunkSize = (size_t) hunkSectors * SECTOR_SIZE;
+    std::vector <u8> hunk (hunkSize);
+    std::vector <u8> compressed;
+
+    for (u32 i = 0; i < header.hunkCount; i++) {
+        std::fill (hunk.begin(), hunk.end(), 0);
+        for (u32 j = 0; j < hunkSectors; j++) {
+            const auto sector = PREGAP + i * hunkSectors + j;
+            if (sector < header.leadOut)
+                source.readSector (sector, hunk.data() + j * SECTOR_SIZE);
+        }
+
+        compressed.clear();
+        compress (hunk.data(), hunkSize, compressed);
+        const auto stored = compressed.size() >= hunkSize;
+
+        index[i] = { (u64) out.tellp(), stored ? (u32) hunkSize : (u32) compressed.size(), crc32 (hunk.data(), hunkSize) };
+        if (stored) {
+            out.write ((const char*) hunk.data(), hunkSize);
+            stats.storedHunks++;
+        } else
+            out.write ((const char*) compressed.data(), compressed.size());
+    }
+
+    stats.inputBytes = (u64) sectors * SECTOR_SIZE;
+    stats.outputBytes = (u64) out.tellp();
+
+    out.seekp (indexOffset);
+    out.write ((const char*) index.data(), index.size() * sizeof (HunkEntry));
+    if (out.fail())
+        Helpers::panic ("Couldn't write %s\n", path.c_str());
+
+    return stats;
+}
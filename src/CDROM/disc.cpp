@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "include/compressed_disc.h"
+#include "include/disc.h"
+#include "include/helpers.h"
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+    auto extensionOf (const std::string& path) -> std::string {
+        const auto dot = path.find_last_of ('.');
+        auto extension = dot == std::string::npos ? std::string() : path.substr (dot + 1);
+        std::transform (extension.begin(), extension.end(), extension.begin(), [] (unsigned char c) { return (char) std::tolower (c); });
+        return extension;
+    }
+
+    auto directoryOf (const std::string& path) -> std::string {
+        const auto slash = path.find_last_of ("/\\");
+        return slash == std::string::npos ? std::string() : path.substr (0, slash + 1);
+    }
+
+    auto parseMSF (const std::string& msf) -> u32 { // mm:ss:ff to a sector count
+        u32 minutes = 0, seconds = 0, frames = 0;
+        if (std::sscanf (msf.c_str(), "%u:%u:%u", &minutes, &seconds, &frames) != 3)
+            Helpers::panic ("Bad time %s in CUE sheet\n", msf.c_str());
+
+        return (minutes * 60 + seconds) * 75 + frames;
+    }
+}
+
+auto Disc::open (const std::string& path) -> std::unique_ptr <Disc> {
+    const auto extension = extensionOf (path);
+    if (extension == "cue" || extension == "bin" || extension == "img")
+        return std::make_unique <BinCueDisc> (path);
+    if (extension == "cdz")
+        return std::make_unique <CompressedDisc> (path);
+
+    Helpers::panic ("Unknown disc image format: %s\n", path.c_str());
+}
+
+auto Disc::trackAt (u32 sector) const -> const DiscTrack& {
+    auto track = trackList.begin();
+    for (auto it = trackList.begin(); it != trackList.end() && it -> start <= sector; it++)
+        track = it;
+
+    return *track;
+}
+
+MappedFile::MappedFile (const std::string& path) {
+#ifdef _WIN32
+    fileHandle = CreateFileA (path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        Helpers::panic ("Couldn't open %s\n", path.c_str());
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx (fileHandle, &fileSize);
+    length = (size_t) fileSize.QuadPart;
+    if (length == 0)
+        return;
+
+    mappingHandle = CreateFileMappingA (fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr)
+        Helpers::panic ("Couldn't map %s\n", path.c_str());
+
+    pointer = (const u8*) MapViewOfFile (mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+    const auto fd = ::open (path.c_str(), O_RDONLY);
+    if (fd < 0)
+        Helpers::panic ("Couldn't open %s\n", path.c_str());
+
+    struct stat info;
+    fstat (fd, &info);
+    length = (size_t) info.st_size;
+
+    if (length != 0) {
+        auto mapping = mmap (nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        pointer = mapping == MAP_FAILED ? nullptr : (const u8*) mapping;
+    }
+
+    close (fd); // the mapping keeps the file open
+#endif
+
+    if (length != 0 && pointer == nullptr)
+        Helpers::panic ("Couldn't map %s\n", path.c_str());
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (pointer != nullptr)
+        UnmapViewOfFile (pointer);
+    if (mappingHandle != nullptr)
+        CloseHandle (mappingHandle);
+    CloseHandle (fileHandle);
+#else
+    if (pointer != nullptr)
+        munmap ((void*) pointer, length);
+#endif
+}
+
+BinCueDisc::BinCueDisc (const std::string& path) {
+    if (extensionOf (path) == "cue")
+        parseCue (path);
+
+    else { // a lone BIN is a single data track that starts right at the beginning
+        addFile (path);
+        extents.push_back ({ PREGAP, (u32) (files[0] -> size() / SECTOR_SIZE), 0, 0 });
+        trackList.push_back ({ 1, false, PREGAP });
+        end = PREGAP + extents[0].length;
+    }
+
+    if (trackList.empty())
+        Helpers::panic ("Disc image %s has no tracks\n", path.c_str());
+
+    readAhead = std::thread (&BinCueDisc::readAheadLoop, this);
+}
+
+BinCueDisc::~BinCueDisc() {
+    {
+        std::lock_guard <std::mutex> lock (mutex);
+        quit = true;
+    }
+
+    wake.notify_one();
+    readAhead.join();
+}
+
+void BinCueDisc::addFile (const std::string& path) {
+    files.push_back (std::make_unique <MappedFile> (path));
+}
+
+// Lay the tracks of a CUE sheet out on the disc. Each file is split into runs at its tracks' first index (INDEX 00 if there is one, otherwise INDEX 01),
+// and the runs are placed back to back from sector 150, with PREGAP directives adding unstored sectors in front of a track
+void BinCueDisc::parseCue (const std::string& path) {
+    std::ifstream cue (path);
+    if (cue.fail())
+        Helpers::panic ("Couldn't read CUE sheet %s\n", path.c_str());
+
+    struct CueTrack {
+        DiscTrack track;
+        u32 file;
+        u32 firstIndex = ~0u; // in sectors from the start of its file
+        u32 index1 = ~0u;
+        u32 pregap = 0;
+    };
+
+    std::vector <CueTrack> cueTracks;
+    std::string line;
+
+    while (std::getline (cue, line)) {
+        std::istringstream tokens (line);
+        std::string keyword;
+        tokens >> keyword;
+        std::transform (keyword.begin(), keyword.end(), keyword.begin(), [] (unsigned char c) { return (char) std::toupper (c); });
+
+        if (keyword == "FILE") {
+            const auto firstQuote = line.find ('"');
+            const auto lastQuote = line.rfind ('"');
+            if (firstQuote == std::string::npos || lastQuote == firstQuote)
+                Helpers::panic ("Unquoted file name in CUE sheet: %s\n", line.c_str());
+
+            addFile (directoryOf (path) + line.substr (firstQuote + 1, lastQuote - firstQuote - 1));
+        }
+
+        else if (keyword == "TRACK") {
+            if (files.empty())
+                Helpers::panic ("TRACK before any FILE in CUE sheet\n");
+
+            u32 number;
+            std::string type;
+            tokens >> number >> type;
+            cueTracks.push_back ({ { number, type == "AUDIO", 0 }, (u32) files.size() - 1 });
+        }
+
+        else if (keyword == "INDEX" && !cueTracks.empty()) {
+            u32 index;
+            std::string msf;
+            tokens >> index >> msf;
+
+            auto& track = cueTracks.back();
+            if (index == 1)
+                track.index1 = parseMSF (msf);
+            if (index <= 1)
+                track.firstIndex = std::min (track.firstIndex, parseMSF (msf));
+        }
+
+        else if (keyword == "PREGAP" && !cueTracks.empty()) {
+            std::string msf;
+            tokens >> msf;
+            cueTracks.back().pregap = parseMSF (msf);
+        }
+    }
+
+    auto cursor = PREGAP;
+    for (size_t i = 0; i < cueTracks.size(); i++) {
+        auto& track = cueTracks[i];
+        if (track.index1 == ~0u)
+            Helpers::panic ("Track %u has no INDEX 01\n", track.track.number);
+
+        const auto fileSectors = (u32) (files[track.file] -> size() / SECTOR_SIZE);
+        const auto runEnd = (i + 1 < cueTracks.size() && cueTracks[i + 1].file == track.file) ? cueTracks[i + 1].firstIndex : fileSectors;
+        const auto length = runEnd > track.firstIndex ? runEnd - track.firstIndex : 0;
+
+        cursor += track.pregap;
+        extents.push_back ({ cursor, length, track.file, (size_t) track.firstIndex * SECTOR_SIZE });
+        track.track.start = cursor + (track.index1 - track.firstIndex);
+        trackList.push_back (track.track);
+        cursor += length;
+    }
+
+    end = cursor;
+}
+
+auto BinCueDisc::findSector (u32 sector) const -> const u8* {
+    auto extent = std::upper_bound (extents.begin(), extents.end(), sector, [] (u32 value, const Extent& e) { return value < e.start; });
+    if (extent == extents.begin())
+        return nullptr;
+
+    extent--;
+    if (sector - extent -> start >= extent -> length)
+        return nullptr;
+
+    return files[extent -> file] -> data() + extent -> offset + (size_t) (sector - extent -> start) * SECTOR_SIZE;
+}
+
+void BinCueDisc::readSector (u32 sector, u8* dest) {
+    const auto source = findSector (sector);
+    if (source == nullptr)
+        std::memset (dest, 0, SECTOR_SIZE);
+    else
+        std::memcpy (dest, source, SECTOR_SIZE);
+}
+
+auto BinCueDisc::isSectorReady (u32 sector) -> bool {
+    const auto window = hotWindow.load (std::memory_order_acquire);
+    return sector >= (u32) window && sector < (u32) (window >> 32);
+}
+
+void BinCueDisc::prefetch (u32 sector) {
+    {
+        std::lock_guard <std::mutex> lock (mutex);
+        if (target == sector)
+            return;
+
+        target = sector;
+    }
+
+    wake.notify_one();
+}
+
+void BinCueDisc::readAheadLoop() {
+    u32 seen = ~0u;
+
+    while (true) {
+        u32 from;
+        {
+            std::unique_lock <std::mutex> lock (mutex);
+            wake.wait (lock, [&] { return quit || target != seen; });
+            if (quit)
+                return;
+
+            from = seen = target;
+        }
+
+        // Start over if the reader jumped out of the window, otherwise slide the window along behind it
+        const auto window = hotWindow.load (std::memory_order_relaxed); // this thread is the only one that writes it
+        auto start = (u32) window;
+        auto end = (u32) (window >> 32);
+
+        if (from < start || from > end)
+            start = end = from;
+        else if (from > READ_AHEAD_SECTORS)
+            start = std::max (start, from - READ_AHEAD_SECTORS);
+
+        hotWindow.store (packWindow (start, end), std::memory_order_release);
+
+        for (auto sector = end; sector < from + READ_AHEAD_SECTORS; sector++) {
+            {
+                std::lock_guard <std::mutex> lock (mutex);
+                if (quit || target != seen) // the reader moved on, go look at where it is now
+                    break;
+            }
+
+            // Reading a byte of every page is enough to get the whole sector paged in
+            if (const auto data = findSector (sector); data != nullptr) {
+                volatile u8 sink = 0;
+                for (u32 offset = 0; offset < SECTOR_SIZE; offset += PAGE_SIZE)
+                    sink = sink + data[offset];
+                sink = sink + data[SECTOR_SIZE - 1];
+            }
+
+            end = sector + 1;
+            hotWindow.store (packWindow (start, end), std::memory_order_release);
+        }
+    }
+}
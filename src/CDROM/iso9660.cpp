@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include "include/iso9660.h"
+#include "include/helpers.h"
+
+namespace {
+    auto read32LE (const u8* pointer) -> u32 { // ISO9660 stores numbers both little and big endian, we read the little endian half
+        return pointer[0] | (pointer[1] << 8) | (pointer[2] << 16) | ((u32) pointer[3] << 24);
+    }
+
+    auto normalize (std::string name) -> std::string { // upper case, without the ";1" version suffix or a trailing dot
+        if (const auto semicolon = name.find (';'); semicolon != std::string::npos)
+            name.erase (semicolon);
+        if (!name.empty() && name.back() == '.')
+            name.pop_back();
+
+        std::transform (name.begin(), name.end(), name.begin(), [] (unsigned char c) { return (char) std::toupper (c); });
+        return name;
+    }
+}
+
+ISO9660::ISO9660 (Disc& _disc) : disc(_disc), sector (Disc::SECTOR_SIZE) {
+    std::vector <u8> descriptor (BLOCK_SIZE);
+    readBlock (VOLUME_DESCRIPTOR_BLOCK, descriptor.data());
+
+    if (descriptor[0] != 1 || std::memcmp (&descriptor[1], "CD001", 5) != 0)
+        Helpers::panic ("Disc has no ISO9660 filesystem\n");
+
+    root = parseEntry (&descriptor[156]); // the root directory's record is embedded in the descriptor
+    if (!root.directory)
+        Helpers::panic ("ISO9660 root directory record is corrupt\n");
+}
+
+void ISO9660::readBlock (u32 block, u8* dest) {
+    disc.readSector (Disc::PREGAP + block, sector.data());
+    const auto userData = sector[15] == 1 ? 16 : 24; // Mode 1 data comes right after the header, Mode 2 Form 1 after the subheader
+    std::memcpy (dest, &sector[userData], BLOCK_SIZE);
+}
+
+auto ISO9660::read (const Entry& entry) -> std::vector <u8> {
+    std::vector <u8> data ((size_t) (entry.size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE);
+    for (size_t offset = 0, block = entry.block; offset < data.size(); offset += BLOCK_SIZE, block++)
+        readBlock ((u32) block, &data[offset]);
+
+    data.resize (entry.size);
+    return data;
+}
+
+auto ISO9660::parseEntry (const u8* record) -> Entry {
+    return { read32LE (&record[2]), read32LE (&record[10]), (record[25] & 2) != 0 };
+}
+
+// Directory records never cross a block boundary, a record length of 0 means the rest of the block is padding
+auto ISO9660::find (const Entry& directory, const std::string& name) -> std::optional <Entry> {
+    if (directory.size > MAX_DIRECTORY_SIZE)
+        Helpers::panic ("ISO9660 directory at block %u is too big to be real\n", directory.block);
+
+    const auto records = read (directory);
+    size_t offset = 0;
+
+    while (offset < records.size()) {
+        const auto length = records[offset];
+        if (length == 0) {
+            offset = (offset / BLOCK_SIZE + 1) * BLOCK_SIZE;
+            continue;
+        }
+
+        if (length < 34 || offset + length > records.size())
+            break;
+
+        const auto nameLength = records[offset + 32];
+        if (33 + nameLength <= length) {
+            const auto recordName = std::string ((const char*) &records[offset + 33], nameLength);
+            if (normalize (recordName) == name)
+                return parseEntry (&records[offset]);
+        }
+
+        offset += length;
+    }
+
+    return std::nullopt;
+}
+
+auto ISO9660::readFile (const std::string& path) -> std::optional <std::vector <u8>> {
+    auto entry = root;
+    size_t start = 0;
+
+    while (start < path.size()) {
+        auto end = path.find_first_of ("\\/", start);
+        if (end == std::string::npos)
+            end = path.size();
+
+        if (end > start) { // skip empty components, from leading or doubled separators
+            if (!entry.directory)
+                return std::nullopt;
+
+            const auto next = find (entry, normalize (path.substr (start, end - start)));
+            if (!next)
+                return std::nullopt;
+            entry = *next;
+        }
+
+        start = end + 1;
+    }
+
+    if (entry.directory)
+        return std::nullopt;
+
+    return read (entry);
+}
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include "include/xa_adpcm.h"
+#include "include/simd.h"
+
+namespace {
+    constexpr s32 POSITIVE_WEIGHTS[4] = { 0, 60, 115, 98 }; // prediction filters, in 64ths
+    constexpr s32 NEGATIVE_WEIGHTS[4] = { 0, 0, -52, -55 };
+
+    // The 7 zigzag interpolation tables, from psx-spx. Output i after every 6th input is the sum of
+    // ZIGZAG[i][j] * (the input j + 1 samples back), over 0x8000
+    constexpr s16 ZIGZAG[7][29] = {
+        { 0, 0, 0, 0, 0, -0x0002, +0x000A, -0x0022, +0x0041, -0x0054, +0x0034, +0x0009, -0x010A, +0x0400, -0x0A78, +0x234C, +0x6794, -0x1780,
+          +0x0BCD, -0x0623, +0x0350, -0x016D, +0x006B, +0x000A, -0x0010, +0x0011, -0x0008, +0x0003, -0x0001 },
+        { 0, 0, 0, -0x0002, 0, +0x0003, -0x0013, +0x003C, -0x004B, +0x00A2, -0x00E3, +0x0132, -0x0043, -0x0267, +0x0C9D, +0x74BB, -0x11B4,
+          +0x09B8, -0x05BF, +0x0372, -0x01A8, +0x00A6, -0x001B, +0x0005, +0x0006, -0x0008, +0x0003, -0x0001, 0 },
+        { 0, 0, -0x0001, +0x0003, -0x0002, -0x0005, +0x001F, -0x004A, +0x00B3, -0x0192, +0x02B1, -0x039E, +0x04F8, -0x05A6, +0x7939, -0x05A6,
+          +0x04F8, -0x039E, +0x02B1, -0x0192, +0x00B3, -0x004A, +0x001F, -0x0005, -0x0002, +0x0003, -0x0001, 0, 0 },
+        { 0, -0x0001, +0x0003, -0x0008, +0x0006, +0x0005, -0x001B, +0x00A6, -0x01A8, +0x0372, -0x05BF, +0x09B8, -0x11B4, +0x74BB, +0x0C9D,
+          -0x0267, -0x0043, +0x0132, -0x00E3, +0x00A2, -0x004B, +0x003C, -0x0013, +0x0003, 0, -0x0002, 0, 0, 0 },
+        { -0x0001, +0x0003, -0x0008, +0x0011, -0x0010, +0x000A, +0x006B, -0x016D, +0x0350, -0x0623, +0x0BCD, -0x1780, +0x6794, +0x234C,
+          -0x0A78, +0x0400, -0x010A, +0x0009, +0x0034, -0x0054, +0x0041, -0x0022, +0x000A, -0x0001, 0, +0x0001, 0, 0, 0 },
+        { +0x0002, -0x0008, +0x0010, -0x0023, +0x002B, +0x001A, -0x00EB, +0x027B, -0x0548, +0x0AFA, -0x16FA, +0x53E0, +0x3C07, -0x1249,
+          +0x080E, -0x0347, +0x015B, -0x0044, -0x0017, +0x0046, -0x0023, +0x0011, -0x0005, 0, 0, 0, 0, 0, 0 },
+        { -0x0005, +0x0011, -0x0023, +0x0046, -0x0017, -0x0044, +0x015B, -0x0347, +0x080E, -0x1249, +0x3C07, +0x53E0, -0x16FA, +0x0AFA,
+          -0x0548, +0x027B, -0x00EB, +0x001A, +0x002B, -0x0023, +0x0010, -0x0008, +0x0002, 0, 0, 0, 0, 0, 0 }
+    };
+
+    // The tables laid out against the history window, oldest sample first: window[k] is the input 32 - k samples back
+    struct alignas (32) ZigzagWindows {
+        s16 weights[7][32];
+
+        constexpr ZigzagWindows() : weights {} {
+            for (int table = 0; table < 7; table++) {
+                for (int k = 3; k < 32; k++)
+                    weights[table][k] = ZIGZAG[table][31 - k];
+            }
+        }
+    };
+
+    constexpr ZigzagWindows ZIGZAG_WINDOWS;
+
+    auto clamp16 (s32 value) -> s16 {
+        return (s16) std::clamp (value, -0x8000, 0x7FFF);
+    }
+
+    auto dot32 (const s16* samples, const s16* weights) -> s32 { // the sum fits in 32 bits, so every path gets the same result
+#if defined(PSX_AVX2)
+        const auto low = _mm256_madd_epi16 (_mm256_loadu_si256 ((const __m256i*) samples), _mm256_load_si256 ((const __m256i*) weights));
+        const auto high = _mm256_madd_epi16 (_mm256_loadu_si256 ((const __m256i*) (samples + 16)), _mm256_load_si256 ((const __m256i*) (weights + 16)));
+        const auto sum8 = _mm256_add_epi32 (low, high);
+        auto sum4 = _mm_add_epi32 (_mm256_castsi256_si128 (sum8), _mm256_extracti128_si256 (sum8, 1));
+        sum4 = _mm_add_epi32 (sum4, _mm_shuffle_epi32 (sum4, 0x4E));
+        sum4 = _mm_add_epi32 (sum4, _mm_shuffle_epi32 (sum4, 0xB1));
+        return _mm_cvtsi128_si32 (sum4);
+#elif defined(PSX_SSE2)
+        auto sum4 = _mm_setzero_si128();
+        for (int i = 0; i < 32; i += 8)
+            sum4 = _mm_add_epi32 (sum4, _mm_madd_epi16 (_mm_loadu_si128 ((const __m128i*) (samples + i)), _mm_load_si128 ((const __m128i*) (weights + i))));
+
+        sum4 = _mm_add_epi32 (sum4, _mm_shuffle_epi32 (sum4, 0x4E));
+        sum4 = _mm_add_epi32 (sum4, _mm_shuffle_epi32 (sum4, 0xB1));
+        return _mm_cvtsi128_si32 (sum4);
+#else
+        s32 sum = 0;
+        for (int i = 0; i < 32; i++)
+            sum += samples[i] * weights[i];
+        return sum;
+#endif
+    }
+}
+
+void XADecoder::reset() {
+    channels.fill (Channel());
+}
+
+// Unit samples are interleaved across the 28 words after the group's 16 byte header: word j holds sample j of every unit
+void XADecoder::decodeUnit (const u8* group, u32 unit, bool eightBit, Channel& channel, s16* dest) {
+    const auto header = group[4 + unit];
+    const auto filter = (header >> 4) & 3;
+    const auto shift = (header & 0xF) > 12 ? 9 : header & 0xF; // shifts 13-15 act like 9
+    const auto positive = POSITIVE_WEIGHTS[filter];
+    const auto negative = NEGATIVE_WEIGHTS[filter];
+    const auto data = group + 16;
+
+    for (u32 i = 0; i < SAMPLES_PER_UNIT; i++) {
+        s32 sample;
+        if (eightBit)
+            sample = (s16) (data[i * 4 + unit] << 8) >> shift;
+        else {
+            const auto byte = data[i * 4 + unit / 2];
+            sample = (s16) (((unit & 1) ? byte >> 4 : byte & 0xF) << 12) >> shift;
+        }
+
+        sample += (channel.old * positive + channel.older * negative + 32) >> 6;
+        const auto clamped = clamp16 (sample);
+        channel.older = channel.old;
+        channel.old = clamped;
+        dest[i] = clamped;
+    }
+}
+
+auto XADecoder::resample (Channel& channel, const s16* samples, u32 count, bool halfRate, s16* dest) -> u32 {
+    u32 outputs = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        for (u32 repeat = halfRate ? 2 : 1; repeat > 0; repeat--) {
+            channel.history[channel.historyPos] = samples[i];
+            channel.history[channel.historyPos + HISTORY] = samples[i];
+            channel.historyPos = (channel.historyPos + 1) & (HISTORY - 1);
+
+            if (--channel.sixStep == 0) {
+                channel.sixStep = 6;
+                const auto window = &channel.history[channel.historyPos]; // the last 32 samples, oldest first
+                for (int table = 0; table < 7; table++)
+                    dest[outputs++] = clamp16 (dot32 (window, ZIGZAG_WINDOWS.weights[table]) >> 15);
+            }
+        }
+    }
+
+    return outputs;
+}
+
+void XADecoder::decodeSector (const u8* data, u8 codingInfo, const std::array <u8, 4>& volume, AudioRing& out) {
+    const auto stereo = (codingInfo & CodingStereo) != 0;
+    const auto eightBit = (codingInfo & CodingEightBit) != 0;
+    const auto units = eightBit ? 4u : 8u;
+    u32 counts[2] = { 0, 0 };
+
+    for (u32 group = 0; group < GROUPS_PER_SECTOR; group++) {
+        const auto groupData = data + group * 128;
+        for (u32 unit = 0; unit < units; unit++) {
+            const auto channel = stereo ? (unit & 1) : 0;
+            decodeUnit (groupData, unit, eightBit, channels[channel], &decoded[channel][counts[channel]]);
+            counts[channel] += SAMPLES_PER_UNIT;
+        }
+    }
+
+    const auto halfRate = (codingInfo & CodingHalfRate) != 0;
+    auto frames = resample (channels[0], decoded[0].data(), counts[0], halfRate, resampled[0].data());
+    if (stereo) // the channels only get out of step if a stream switches between mono and stereo without a reset
+        frames = std::min (frames, resample (channels[1], decoded[1].data(), counts[1], halfRate, resampled[1].data()));
+
+    const auto& right = stereo ? resampled[1] : resampled[0];
+    for (u32 i = 0; i < frames; i++) {
+        const s32 l = resampled[0][i];
+        const s32 r = right[i];
+        out.push ({ clamp16 ((l * volume[0] + r * volume[3]) >> 7), clamp16 ((r * volume[2] + l * volume[1]) >> 7) });
+    }
+}
@@ -0,0 +1,194 @@
+#include <cstring>
+#include "include/display.h"
+#include "include/simd.h"
+
+namespace {
+#ifdef PSX_SSE2
+    // Expand 8 1555 pixels to RGBA8888. Pixels 0-3 end up in low, 4-7 in high
+    inline void expand15 (__m128i pixels, __m128i& low, __m128i& high) {
+        const auto channelMask = _mm_set1_epi16 (0x1F);
+        const auto r = _mm_slli_epi16 (_mm_and_si128 (pixels, channelMask), 3);
+        const auto g = _mm_slli_epi16 (_mm_and_si128 (_mm_srli_epi16 (pixels, 5), channelMask), 3);
+        const auto b = _mm_slli_epi16 (_mm_and_si128 (_mm_srli_epi16 (pixels, 10), channelMask), 3);
+
+        const auto rg = _mm_or_si128 (r, _mm_slli_epi16 (g, 8)); // interleaving these 2 gives R, G, B, A bytes
+        const auto ba = _mm_or_si128 (b, _mm_set1_epi16 ((s16) 0xFF00));
+        low = _mm_unpacklo_epi16 (rg, ba);
+        high = _mm_unpackhi_epi16 (rg, ba);
+    }
+#endif
+}
+
+void Display::convert15ToRGBA (const u16* src, u32* dest, u32 count) {
+    u32 i = 0;
+
+#ifdef PSX_AVX2
+    const auto channelMask = _mm256_set1_epi16 (0x1F);
+    const auto alpha = _mm256_set1_epi16 ((s16) 0xFF00);
+
+    for (; i + 16 <= count; i += 16) {
+        const auto pixels = _mm256_loadu_si256 ((const __m256i*) &src[i]);
+        const auto r = _mm256_slli_epi16 (_mm256_and_si256 (pixels, channelMask), 3);
+        const auto g = _mm256_slli_epi16 (_mm256_and_si256 (_mm256_srli_epi16 (pixels, 5), channelMask), 3);
+        const auto b = _mm256_slli_epi16 (_mm256_and_si256 (_mm256_srli_epi16 (pixels, 10), channelMask), 3);
+
+        const auto rg = _mm256_or_si256 (r, _mm256_slli_epi16 (g, 8));
+        const auto ba = _mm256_or_si256 (b, alpha);
+        const auto low = _mm256_unpacklo_epi16 (rg, ba); // unpacking works inside 128-bit lanes, so this is pixels 0-3 and 8-11
+        const auto high = _mm256_unpackhi_epi16 (rg, ba); // and this is 4-7 and 12-15
+
+        _mm256_storeu_si256 ((__m256i*) &dest[i], _mm256_permute2x128_si256 (low, high, 0x20));
+        _mm256_storeu_si256 ((__m256i*) &dest[i + 8], _mm256_permute2x128_si256 (low, high, 0x31));
+    }
+#endif
+
+#ifdef PSX_SSE2
+    for (; i + 8 <= count; i += 8) {
+        __m128i low, high;
+        expand15 (_mm_loadu_si128 ((const __m128i*) &src[i]), low, high);
+        _mm_storeu_si128 ((__m128i*) &dest[i], low);
+        _mm_storeu_si128 ((__m128i*) &dest[i + 4], high);
+    }
+#endif
+
+    for (; i < count; i++)
+        dest[i] = VRAM::RGB555ToRGBA (src[i]);
+}
+
+void Display::convert24ToRGBA (const u8* src, u32* dest, u32 count) {
+    u32 i = 0;
+
+#ifdef PSX_SSSE3
+    // Each 16-byte load holds 4 whole pixels and 4 bytes of the next ones, a shuffle moves every pixel to its own 32-bit lane
+    // The loops stop early enough that loads never go past the last pixel of the row
+    const auto spread = _mm_setr_epi8 (0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const auto alpha = _mm_set1_epi32 ((s32) 0xFF00'0000);
+
+#ifdef PSX_AVX2
+    const auto spread256 = _mm256_broadcastsi128_si256 (spread);
+    const auto alpha256 = _mm256_set1_epi32 ((s32) 0xFF00'0000);
+
+    for (; i + 10 <= count; i += 8) {
+        const auto low = _mm_loadu_si128 ((const __m128i*) &src[i * 3]);
+        const auto high = _mm_loadu_si128 ((const __m128i*) &src[i * 3 + 12]);
+        const auto pixels = _mm256_inserti128_si256 (_mm256_castsi128_si256 (low), high, 1);
+        _mm256_storeu_si256 ((__m256i*) &dest[i], _mm256_or_si256 (_mm256_shuffle_epi8 (pixels, spread256), alpha256));
+    }
+#endif
+
+    for (; i + 6 <= count; i += 4) {
+        const auto pixels = _mm_loadu_si128 ((const __m128i*) &src[i * 3]);
+        _mm_storeu_si128 ((__m128i*) &dest[i], _mm_or_si128 (_mm_shuffle_epi8 (pixels, spread), alpha));
+    }
+#endif
+
+    for (; i < count; i++) {
+        const auto pixel = &src[i * 3];
+        dest[i] = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16) | 0xFF00'0000;
+    }
+}
+
+void Display::convert15ToRGB (const u16* src, u8* dest, u32 count) {
+    u32 i = 0;
+
+#if defined(PSX_SSE2) && defined(PSX_SSSE3)
+    // Expand to RGBA, then squeeze the alpha bytes out. Every store writes 4 bytes of garbage past its 12 bytes,
+    // which the next store (or the scalar tail) overwrites, so the loop leaves enough room at the end of the row
+    const auto squeeze = _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    for (; i + 10 <= count; i += 8) {
+        __m128i low, high;
+        expand15 (_mm_loadu_si128 ((const __m128i*) &src[i]), low, high);
+        _mm_storeu_si128 ((__m128i*) &dest[i * 3], _mm_shuffle_epi8 (low, squeeze));
+        _mm_storeu_si128 ((__m128i*) &dest[i * 3 + 12], _mm_shuffle_epi8 (high, squeeze));
+    }
+#endif
+
+    for (; i < count; i++) {
+        const auto pixel = VRAM::RGB555ToRGBA (src[i]);
+        dest[i * 3] = (u8) pixel;
+        dest[i * 3 + 1] = (u8) (pixel >> 8);
+        dest[i * 3 + 2] = (u8) (pixel >> 16);
+    }
+}
+
+auto Display::extract (const VRAM& vram, const DisplayArea& area, PixelFormat format, std::vector <u8>& frame) -> u32 {
+    const auto pitch = area.width * (format == PixelFormat::RGBA8888 ? 4 : 3);
+    frame.resize (pitch * area.height);
+
+    for (u32 line = 0; line < area.height; line++) {
+        const auto src = &vram.pixels[((area.y + line) & 0x1FF) * WIDTH + area.x];
+        const auto dest = &frame[line * pitch];
+
+        if (area.is24bit) {
+            if (format == PixelFormat::RGBA8888)
+                convert24ToRGBA ((const u8*) src, (u32*) dest, area.width);
+            else
+                std::memcpy (dest, src, area.width * 3); // 24-bit VRAM data is already R, G, B bytes
+        }
+
+        else {
+            if (format == PixelFormat::RGBA8888)
+                convert15ToRGBA (src, (u32*) dest, area.width);
+            else
+                convert15ToRGB (src, dest, area.width);
+        }
+    }
+
+    return pitch;
+}
+
+auto Display::extractScaled (const u16* pixels, u32 scale, const DisplayArea& area, PixelFormat format, bool downsample, std::vector <u8>& frame) -> u32 {
+    const auto bytesPerPixel = format == PixelFormat::RGBA8888 ? 4 : 3;
+    const auto targetWidth = WIDTH * scale;
+    const auto targetHeight = HEIGHT * scale;
+
+    if (!downsample) {
+        const auto width = area.width * scale;
+        const auto pitch = width * bytesPerPixel;
+        frame.resize (pitch * area.height * scale);
+
+        for (u32 line = 0; line < area.height * scale; line++) {
+            const auto src = &pixels[((area.y * scale + line) % targetHeight) * targetWidth + area.x * scale];
+            if (format == PixelFormat::RGBA8888)
+                convert15ToRGBA (src, (u32*) &frame[line * pitch], width);
+            else
+                convert15ToRGB (src, &frame[line * pitch], width);
+        }
+
+        return pitch;
+    }
+
+    const auto pitch = area.width * bytesPerPixel;
+    const auto samples = scale * scale;
+    frame.resize (pitch * area.height);
+
+    for (u32 line = 0; line < area.height; line++) {
+        const auto firstRow = ((area.y + line) * scale) % targetHeight;
+        auto dest = &frame[line * pitch];
+
+        for (u32 x = 0; x < area.width; x++) {
+            u32 r = 0, g = 0, b = 0;
+
+            for (u32 row = 0; row < scale; row++) {
+                const auto src = &pixels[(firstRow + row) * targetWidth + (area.x + x) * scale];
+                for (u32 column = 0; column < scale; column++) {
+                    r += src[column] & 0x1F;
+                    g += (src[column] >> 5) & 0x1F;
+                    b += (src[column] >> 10) & 0x1F;
+                }
+            }
+
+            // The averages keep the fraction the 5-bit channels lose, so gradients come out smoother than at native resolution
+            dest[0] = (u8) ((r << 3) / samples);
+            dest[1] = (u8) ((g << 3) / samples);
+            dest[2] = (u8) ((b << 3) / samples);
+            if (format == PixelFormat::RGBA8888)
+                dest[3] = 0xFF;
+
+            dest += bytesPerPixel;
+        }
+    }
+
+    return pitch;
+}
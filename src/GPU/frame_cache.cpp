@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "include/frame_cache.h"
+#include "include/texture_cache.h"
+#include "include/renderer.h"
+#include "include/helpers.h"
+
+namespace {
+    inline auto mix (u64 hash, u64 value) -> u64 {
+        return Helpers::rotl <u64> (hash ^ (value * 0x9E37'79B9'7F4A'7C15), 29) * 0xBF58'476D'1CE4'E5B9;
+    }
+
+    auto hashState (u64 hash, const DrawState& state) -> u64 { // field by field, the padding bytes are never initialized
+        hash = mix (hash, state.texpage_x | ((u64) state.texpage_y << 16) | ((u64) state.texture_depth << 32));
+        hash = mix (hash, state.clut_x | ((u64) state.clut_y << 16));
+        hash = mix (hash, state.window_u_and | ((u64) state.window_u_or << 16) | ((u64) state.window_v_and << 32) | ((u64) state.window_v_or << 48));
+        hash = mix (hash, state.semi_transparent | (state.semi_transparency << 1) | (state.dither << 3) | (state.set_mask << 4) | (state.check_mask << 5));
+        hash = mix (hash, (u16) state.clip_left | ((u64) (u16) state.clip_top << 16) | ((u64) (u16) state.clip_right << 32) | ((u64) (u16) state.clip_bottom << 48));
+        return hash;
+    }
+}
+
+auto FrameCache::hashRegion (const VRAM& vram, const Region& region) -> u64 {
+    const auto width = (u32) (region.right - region.left + 1);
+    u64 lanes[4] = { 1, 2, 3, 4 }; // 4 independent hashes, so the multiplies can overlap
+
+    for (auto y = region.top; y <= region.bottom; y++) {
+        const auto row = &vram.pixels[y * WIDTH + region.left];
+        u32 x = 0;
+
+        for (; x + 16 <= width; x += 16) {
+            for (auto i = 0; i < 4; i++) {
+                u64 word;
+                std::memcpy (&word, &row[x + i * 4], sizeof(u64));
+                lanes[i] = mix (lanes[i], word);
+            }
+        }
+
+        for (; x < width; x++)
+            lanes[0] = mix (lanes[0], row[x]);
+    }
+
+    return mix (mix (mix (lanes[0], lanes[1]), lanes[2]), lanes[3]);
+}
+
+auto FrameCache::segmentKey (VRAM& vram, const VertexArena& arena, const Region& region) -> u64 {
+    auto hash = mix (hashRegion (vram, region), arena.vertexSize());
+
+    const auto batches = arena.batchList();
+    for (u32 i = 0; i < arena.size(); i++) {
+        const auto& batch = batches[i];
+        hash = mix (hash, (u64) batch.type | ((u64) batch.flags << 8) | ((u64) batch.vertexCount << 32));
+        hash = hashState (hash, batch.state);
+
+        if (batch.type == PrimitiveType::TexturedRect || (batch.flags & Renderer::TEXTURED)) // whatever the batch samples has to be unchanged too
+            hash = mix (hash, TextureCache::sourceGeneration (vram, batch.state));
+    }
+
+    const auto vertices = arena.vertexData();
+    for (u32 i = 0; i < arena.vertexSize(); i++) {
+        const auto& vertex = vertices[i];
+        hash = mix (hash, (u32) vertex.x | ((u64) (u32) vertex.y << 32));
+        hash = mix (hash, vertex.color | ((u64) (vertex.u & 0xFF) << 32) | ((u64) (vertex.v & 0xFF) << 40));
+    }
+
+    return hash;
+}
+
+auto FrameCache::lookup (VRAM& vram, const VertexArena& arena) -> bool {
+    pending = false;
+    if (!enabled || arena.vertexSize() < MIN_VERTICES)
+        return false;
+
+    // Nothing in the segment can draw outside of the union of its drawing areas
+    Region region = { WIDTH, HEIGHT, -1, -1 };
+    const auto batches = arena.batchList();
+    u32 primitiveCount = 0;
+
+    for (u32 i = 0; i < arena.size(); i++) {
+        const auto& state = batches[i].state;
+        primitiveCount += batches[i].vertexCount / verticesPerPrimitive (batches[i].type);
+
+        if (state.clip_left > state.clip_right || state.clip_top > state.clip_bottom)
+            continue;
+
+        region.left = std::min (region.left, std::max (state.clip_left, 0));
+        region.top = std::min (region.top, std::max (state.clip_top, 0));
+        region.right = std::max (region.right, std::min (state.clip_right, WIDTH - 1));
+        region.bottom = std::max (region.bottom, std::min (state.clip_bottom, HEIGHT - 1));
+    }
+
+    if (region.left > region.right || region.top > region.bottom) // nothing can be drawn
+        return false;
+
+    const auto key = segmentKey (vram, arena, region);
+    stats.segments++;
+
+    for (auto& entry : entries) {
+        if (!entry.valid || entry.key != key || entry.region.left != region.left || entry.region.top != region.top ||
+            entry.region.right != region.right || entry.region.bottom != region.bottom)
+            continue;
+
+        // Hit. Only rows that actually differ get written back, so VRAM that already holds the output stays clean
+        const auto width = (u32) (region.right - region.left + 1);
+        for (auto y = region.top; y <= region.bottom; y++) {
+            const auto row = &vram.pixels[y * WIDTH + region.left];
+            const auto saved = &entry.pixels[(y - region.top) * width];
+
+            if (std::memcmp (row, saved, width * sizeof(u16)) != 0) {
+                std::memcpy (row, saved, width * sizeof(u16));
+                vram.markDirty (region.left, y, width, 1);
+            }
+        }
+
+        entry.lastUsed = ++useCounter;
+        stats.hits++;
+        stats.primitivesSkipped += primitiveCount;
+        return true;
+    }
+
+    pending = true;
+    pendingKey = key;
+    pendingRegion = region;
+    return false;
+}
+
+void FrameCache::store (const VRAM& vram) {
+    if (!pending)
+        return;
+
+    pending = false;
+    auto entry = std::min_element (entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { // evict the least recently used entry
+        return a.valid == b.valid ? a.lastUsed < b.lastUsed : !a.valid;
+    });
+
+    const auto& region = pendingRegion;
+    const auto width = (u32) (region.right - region.left + 1);
+    const auto height = (u32) (region.bottom - region.top + 1);
+
+    entry -> key = pendingKey;
+    entry -> valid = true;
+    entry -> region = region;
+    entry -> lastUsed = ++useCounter;
+    entry -> pixels.resize (width * height);
+
+    for (u32 y = 0; y < height; y++)
+        std::memcpy (&entry -> pixels[y * width], &vram.pixels[(region.top + y) * WIDTH + region.left], width * sizeof(u16));
+}
+
+void FrameCache::endFrame() {
+    if (!enabled || ++framesSinceReport < REPORT_INTERVAL)
+        return;
+
+    const auto hitRate = stats.segments == 0 ? 0.0 : 100.0 * stats.hits / stats.segments;
+    std::printf ("[Frame cache] %u/%u segments reused (%.1f%%), %u primitives skipped in the last %u frames\n",
+                 stats.hits, stats.segments, hitRate, stats.primitivesSkipped, REPORT_INTERVAL);
+
+    stats = Stats();
+    framesSinceReport = 0;
+}
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <cstdio>
+#include "include/frameskip.h"
+#include "include/texture_cache.h"
+
+FrameSkipper::FrameSkipper() {
+    lastSampled.fill (0);
+    frameStart = Clock::now();
+}
+
+void FrameSkipper::markSampled (u32 x, u32 y, u32 width, u32 height) {
+    if (mode == FrameSkipMode::Off)
+        return;
+
+    // Same block walk as VRAM::markDirty, wrapping around VRAM
+    auto firstColumn = (x & 0x3FF) / VRAM::BLOCK_WIDTH;
+    auto firstRow = (y & 0x1FF) / VRAM::BLOCK_HEIGHT;
+    auto columns = std::min <u32> (((x % VRAM::BLOCK_WIDTH) + width - 1) / VRAM::BLOCK_WIDTH + 1, VRAM::BLOCKS_PER_ROW);
+    auto rows = std::min <u32> (((y % VRAM::BLOCK_HEIGHT) + height - 1) / VRAM::BLOCK_HEIGHT + 1, VRAM::BLOCKS_PER_COLUMN);
+
+    for (u32 row = 0; row < rows; row++) {
+        auto base = ((firstRow + row) % VRAM::BLOCKS_PER_COLUMN) * VRAM::BLOCKS_PER_ROW;
+        for (u32 column = 0; column < columns; column++)
+            lastSampled[base + (firstColumn + column) % VRAM::BLOCKS_PER_ROW] = frame;
+    }
+}
+
+void FrameSkipper::markTextureSource (const DrawState& state) {
+    markSampled (state.texpage_x, state.texpage_y, TextureCache::pageWidth (state), 256);
+    if (TextureCache::clutWidth (state) != 0)
+        markSampled (state.clut_x, state.clut_y, TextureCache::clutWidth (state), 1);
+}
+
+auto FrameSkipper::isSampled (const DrawState& state) -> bool {
+    if (state.clip_left > state.clip_right || state.clip_top > state.clip_bottom) // empty drawing area, nothing to draw anyway
+        return false;
+
+    const auto firstColumn = std::max (state.clip_left, 0) / VRAM::BLOCK_WIDTH;
+    const auto lastColumn = std::min (state.clip_right, WIDTH - 1) / VRAM::BLOCK_WIDTH;
+    const auto firstRow = std::max (state.clip_top, 0) / VRAM::BLOCK_HEIGHT;
+    const auto lastRow = std::min (state.clip_bottom, HEIGHT - 1) / VRAM::BLOCK_HEIGHT;
+
+    for (auto row = firstRow; row <= lastRow; row++) {
+        for (auto column = firstColumn; column <= lastColumn; column++) {
+            if (frame - lastSampled[row * VRAM::BLOCKS_PER_ROW + column] <= SAMPLE_WINDOW)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+void FrameSkipper::endFrame() {
+    const auto now = Clock::now();
+    const auto frameTime = std::chrono::duration <double, std::milli> (now - frameStart).count();
+    frameStart = now;
+
+    if (skipThisFrame) {
+        stats.framesSkipped++;
+        stats.timeSaved += std::max (averageDrawTime - drawTime, 0.0); // anything drawn for readback wasn't saved
+    } else {
+        stats.framesDrawn++;
+        averageDrawTime = averageDrawTime == 0.0 ? drawTime : (averageDrawTime * 0.9 + drawTime * 0.1);
+    }
+
+    drawTime = 0.0;
+    frame++;
+
+    switch (mode) {
+        case FrameSkipMode::Off: skipThisFrame = false; break;
+        case FrameSkipMode::Fixed: skipThisFrame = consecutiveSkips < fixedSkip; break;
+        case FrameSkipMode::Auto: skipThisFrame = frameTime > budget && consecutiveSkips < MAX_CONSECUTIVE_SKIPS; break;
+    }
+
+    consecutiveSkips = skipThisFrame ? consecutiveSkips + 1 : 0;
+
+    if (mode != FrameSkipMode::Off && ++framesSinceReport == REPORT_INTERVAL) {
+        std::printf ("[Frameskip] %u frames drawn, %u skipped, %u primitives dropped, ~%.1f ms saved in the last %u frames\n",
+                     stats.framesDrawn, stats.framesSkipped, stats.primitivesDropped, stats.timeSaved, REPORT_INTERVAL);
+        stats = Stats();
+        framesSinceReport = 0;
+    }
+}
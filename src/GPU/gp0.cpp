@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include "include/gpu.h"
 #include "include/helpers.h"
@@ -34,7 +35,7 @@ void GPU::gp0_draw_mode(GP0_cmd command) {
     auto params = command.draw_mode_params;
 
     status.texture_x_page = params.texture_x_page;
-    status.texture_y_page = params.texture_x_page;
+    status.texture_y_page = params.texture_y_page;
     status.semi_transparency = params.semi_transparency;
     status.texture_depth = params.texture_depth;
 
@@ -47,6 +48,7 @@ void GPU::gp0_draw_mode(GP0_cmd command) {
 }
 
 void GPU::gp0_load_texture() {
+    flushPrimitives(); // queued primitives have to land in VRAM before the upload overwrites it
 
     fetchingTextureData = true;
     paramsFetched = 0; // this will now be used as the number of halfwords that have been fetched
@@ -68,9 +70,138 @@ void GPU::gp0_load_texture() {
     texture_upload_x_end = x_dest + x_size ;
     texture_upload_y_end = y_dest + y_size;
 
+    vram.markDirty (x_dest, y_dest, x_size, y_size); // invalidate anything cached from the destination
+
     auto size = x_size * y_size; // size in halfwords (1 halfword = 1 pixel)
     size += size & 1; // if size is odd, add 1 more halfword
     paramsToFetch = size >> 1; // fetch (size / 2) words
 
     assert (size != 0);
 }
+
+void GPU::gp0_copy_vram_to_cpu() {
+    flushPrimitives();
+    auto src = commandParameters[1];
+    auto dimensions = commandParameters[2];
+
+    auto x_src = src & 0x3FF;
+    auto y_src = (src >> 16) & 0x1FF;
+
+    auto x_size = ((dimensions - 1) & 0x3FF) + 1; // a size of 0 means 1024 (or 512 for y)
+    auto y_size = (((dimensions >> 16) - 1) & 0x1FF) + 1;
+
+    frameSkipper.markSampled (x_src, y_src, x_size, y_size);
+    vram.readRect (x_src, y_src, x_size, y_size, vramReadBuffer); // prepare the whole transfer up front
+    vramReadIndex = 0;
+    status.send_vram_ready = 1;
+}
+
+void GPU::gp0_copy_vram_to_vram() {
+    flushPrimitives();
+    auto src = commandParameters[1];
+    auto dest = commandParameters[2];
+    auto dimensions = commandParameters[3];
+
+    auto x_src = src & 0x3FF;
+    auto y_src = (src >> 16) & 0x1FF;
+    auto x_dest = dest & 0x3FF;
+    auto y_dest = (dest >> 16) & 0x1FF;
+
+    auto x_size = ((dimensions - 1) & 0x3FF) + 1; // a size of 0 means 1024 (or 512 for y)
+    auto y_size = (((dimensions >> 16) - 1) & 0x1FF) + 1;
+
+    const u16 setMask = status.set_mask_bit ? 0x8000 : 0;
+    frameSkipper.markSampled (x_src, y_src, x_size, y_size);
+    vram.copyRect (x_src, y_src, x_dest, y_dest, x_size, y_size, setMask, status.draw_pixels);
+}
+
+void GPU::update_texpage (u32 texpage) {
+    status.texture_x_page = texpage & 0xF;
+    status.texture_y_page = (texpage >> 4) & 1;
+    status.semi_transparency = (texpage >> 5) & 3;
+    status.texture_depth = (texpage >> 7) & 3;
+    status.texture_disable = (texpage >> 11) & 1;
+}
+
+auto GPU::buildDrawState (u32 clut) -> DrawState {
+    DrawState state;
+
+    state.texpage_x = status.texture_x_page * 64;
+    state.texpage_y = status.texture_y_page * 256;
+    state.texture_depth = (status.texture_depth == 3) ? 2 : status.texture_depth; // the reserved depth mode acts like 15bpp
+    state.clut_x = (clut & 0x3F) * 16;
+    state.clut_y = (clut >> 6) & 0x1FF;
+
+    state.window_u_and = ~(texture_window_x_mask * 8) & 0xFF;
+    state.window_u_or = (texture_window_x_offs & texture_window_x_mask) * 8;
+    state.window_v_and = ~(texture_window_y_mask * 8) & 0xFF;
+    state.window_v_or = (texture_window_y_offs & texture_window_y_mask) * 8;
+
+    state.semi_transparent = false;
+    state.semi_transparency = status.semi_transparency;
+    state.dither = status.dither;
+    state.set_mask = status.set_mask_bit;
+    state.check_mask = status.draw_pixels;
+
+    state.clip_left = drawing_area_left;
+    state.clip_top = drawing_area_top;
+    state.clip_right = drawing_area_right;
+    state.clip_bottom = std::min <s32> (drawing_area_bottom, HEIGHT - 1); // the drawing area can extend past the bottom of VRAM
+
+    return state;
+}
+
+void GPU::gp0_fill_vram() {
+    flushPrimitives();
+    auto color = commandParameters[0];
+    auto dest = commandParameters[1];
+    auto dimensions = commandParameters[2];
+
+    auto x_dest = dest & 0x3F0; // x is rounded down to a multiple of 16 pixels
+    auto y_dest = (dest >> 16) & 0x1FF;
+    auto x_size = ((dimensions & 0x3FF) + 0xF) & ~0xF; // and the width is rounded up to one
+    auto y_size = (dimensions >> 16) & 0x1FF;
+
+    if (x_size == 0 || y_size == 0)
+        return;
+
+    auto pixel = (u16) (((color >> 3) & 0x1F) | ((color >> 6) & 0x3E0) | ((color >> 9) & 0x7C00)); // 24-bit BGR -> 15-bit BGR
+    vram.fillRect (x_dest, y_dest, x_size, y_size, pixel);
+}
+
+void GPU::gp0_polyline_start (u32 val) {
+    fetchingPolyline = true;
+    polylineColor = val & 0xFF'FFFF; // the command word holds the color of the first vertex
+    polylineVertexCount = 0;
+    polylineShaded = (val >> 28) & 1;
+    polylineSemiTransparent = (val >> 25) & 1;
+    polylineExpectingColor = false;
+}
+
+void GPU::gp0_polyline_param (u32 val) {
+    if (polylineVertexCount >= 2 && (val & 0xF000'F000) == 0x5000'5000) { // terminator, only recognized after the first segment
+        fetchingPolyline = false;
+        return;
+    }
+
+    if (polylineExpectingColor) {
+        polylineColor = val & 0xFF'FFFF;
+        polylineExpectingColor = false;
+        return;
+    }
+
+    auto vertex = decodeVertex (val);
+    vertex.color = polylineColor;
+
+    if (polylineVertexCount != 0) { // draw the segment from the previous vertex to this one
+        auto state = buildDrawState (0);
+        state.semi_transparent = polylineSemiTransparent;
+        auto dest = allocatePrimitive (PrimitiveType::Line, polylineShaded ? Renderer::SHADED : 0, state, 2);
+        dest[0] = polylineLastVertex;
+        dest[1] = vertex;
+    }
+
+    polylineLastVertex = vertex;
+    polylineVertexCount++;
+    polylineExpectingColor = polylineShaded;
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "include/gpu.h"
 
 void GPU::gp1_softReset() {
@@ -53,10 +54,31 @@ void GPU::gp1_set_display_horizontal_range (GP1_cmd command) {
 }
 
 void GPU::gp1_set_display_vertical_range (GP1_cmd command) {
-    display_h_start = command.raw & 0x3FF;
-    display_h_end = (command.raw >> 10) & 0x3FF;
+    display_v_start = command.raw & 0x3FF;
+    display_v_end = (command.raw >> 10) & 0x3FF;
 }
 
 void GPU::gp1_display_enable(GP1_cmd command) {
     status.display_enabled = command.raw & 1;
 }
+
+auto GPU::displayArea() -> DisplayArea {
+    static constexpr u32 dotclockDividers[4] = { 10, 8, 5, 4 }; // GPU cycles per pixel for each hres1 value (256, 320, 512, 640 pixels wide)
+    DisplayArea area = { vram_x_start, vram_y_start, 0, 0, (bool) status.display_area_color_depth };
+
+    if (status.display_enabled) // (0=Enabled, 1=Disabled)
+        return area;
+
+    // The horizontal range is in GPU cycles and the vertical range is in scanlines
+    const auto divider = status.hres2 ? 7 : dotclockDividers[status.hres1]; // hres2 = 368 pixels wide
+    const auto cycles = display_h_end > display_h_start ? display_h_end - display_h_start : 0;
+    auto lines = display_v_end > display_v_start ? (u32) (display_v_end - display_v_start) : 0;
+    if (status.vres && status.vertical_interlace) // 480-line mode shows both fields
+        lines *= 2;
+
+    // The width gets rounded to a multiple of 4 pixels. Lines that would wrap around the right edge of VRAM are cut short
+    const auto maxWidth = area.is24bit ? (WIDTH - area.x) * 2 / 3 : WIDTH - area.x;
+    area.width = std::min <u32> (((cycles / divider) + 2) & ~3, maxWidth);
+    area.height = std::min <u32> (lines, HEIGHT - area.y);
+    return area;
+}
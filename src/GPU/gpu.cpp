@@ -1,71 +1,209 @@
+#include <chrono>
+#include <cstring>
 #include "include/gpu.h"
 #include "include/helpers.h"
 
 void GPU::gp0_command(u32 val) {
+    if (recorder)
+        recorder -> gp0 (val);
 
-    if (fetchingGP0Params) { // handle fetching GP0 commands
-        commandParameters[paramsFetched++] = val;
-        if (paramsFetched == paramsToFetch) { // check if the command length has been reached
-            fetchingGP0Params = false; // reset parameter fetching state
-            paramsFetched = 0;
+    gp0_word (val);
+}
 
-            switch (lastGP0Opcode) {
-                case 0x20: tri_monochrome <false>(); break;
-                case 0x22: tri_monochrome <true>(); break;
+// Hands a span of GP0 words over in one go. Whole packets are dispatched straight from the span instead of being buffered word by word,
+// and the payload of CPU->VRAM transfers is copied to VRAM as many words at a time as the span holds
+void GPU::gp0_commands (const u32* words, size_t count) {
+    if (recorder)
+        recorder -> gp0 (words, count);
 
-                case 0x28: quad_monochrome <false>(); break;
-                case 0x2A: quad_monochrome <true>(); break;
+    size_t i = 0;
+    while (i < count) {
+        if (fetchingTextureData) {
+            const auto length = (u32) std::min <size_t> (count - i, paramsToFetch - paramsFetched);
+            uploadTextureWords (&words[i], length);
+            i += length;
+            continue;
+        }
 
-                case 0x30: tri_shaded <false>(); break;
-                case 0x32: tri_shaded <true>(); break;
+        if (!fetchingGP0Params && !fetchingPolyline) { // at the start of a packet
+            const auto opcode = canonicalGP0Opcode (words[i] >> 24);
+            const auto length = commandLengths[opcode];
 
-                case 0x38: quad_shaded <false>(); break;
-                case 0x3A: quad_shaded <true>(); break;
-                case 0xA0: gp0_load_texture(); break;
-                case 0x2C: Helpers::warn ("[GPU] Tried to draw textured quadrilateral with alpha blending\n"); textured_quad_blend <false> (); break;
-                case 0xC0: Helpers::warn ("[GPU] Tried to send texture data to CPU\n"); break;
-                default: Helpers::panic ("Unknown multi-parameter GP0 opcode: %08X\n", lastGP0Opcode);
+            if (length > 1 && !isPolyline (opcode) && i + length <= count) { // the whole packet is in the span
+                lastGP0Opcode = opcode;
+                paramsToFetch = length;
+                std::copy_n (&words[i], length, commandParameters.begin());
+                executeBufferedCommand();
+                i += length;
+                continue;
             }
         }
 
-        return; // don't fall through
+        gp0_word (words[i++]); // packets split between spans, polylines and single word commands
     }
+}
 
-    else if (fetchingTextureData) { // handle fetching textures
-        std::printf ("Received texture data word: %08X\n", val);
-        paramsFetched += 1;
+void GPU::executeBufferedCommand() {
+    switch (lastGP0Opcode) {
+        case 0x20: draw_polygon <0x20>(); break;
+        case 0x21: draw_polygon <0x21>(); break;
+        case 0x22: draw_polygon <0x22>(); break;
+        case 0x23: draw_polygon <0x23>(); break;
 
-        renderer.vram.setPixel(texture_upload_x & 0x3FF, texture_upload_y & 0x1FF, val);
-        texture_upload_x += 1;
+        case 0x24: draw_polygon <0x24>(); break;
+        case 0x25: draw_polygon <0x25>(); break;
+        case 0x26: draw_polygon <0x26>(); break;
+        case 0x27: draw_polygon <0x27>(); break;
 
-        if (texture_upload_x == texture_upload_x_end) {
-            texture_upload_x = texture_upload_x_start;
-            texture_upload_y += 1;
+        case 0x28: draw_polygon <0x28>(); break;
+        case 0x29: draw_polygon <0x29>(); break;
+        case 0x2A: draw_polygon <0x2A>(); break;
+        case 0x2B: draw_polygon <0x2B>(); break;
+
+        case 0x2C: draw_polygon <0x2C>(); break;
+        case 0x2D: draw_polygon <0x2D>(); break;
+        case 0x2E: draw_polygon <0x2E>(); break;
+        case 0x2F: draw_polygon <0x2F>(); break;
+
+        case 0x30: draw_polygon <0x30>(); break;
+        case 0x31: draw_polygon <0x31>(); break;
+        case 0x32: draw_polygon <0x32>(); break;
+        case 0x33: draw_polygon <0x33>(); break;
+
+        case 0x34: draw_polygon <0x34>(); break;
+        case 0x35: draw_polygon <0x35>(); break;
+        case 0x36: draw_polygon <0x36>(); break;
+        case 0x37: draw_polygon <0x37>(); break;
+
+        case 0x38: draw_polygon <0x38>(); break;
+        case 0x39: draw_polygon <0x39>(); break;
+        case 0x3A: draw_polygon <0x3A>(); break;
+        case 0x3B: draw_polygon <0x3B>(); break;
+
+        case 0x3C: draw_polygon <0x3C>(); break;
+        case 0x3D: draw_polygon <0x3D>(); break;
+        case 0x3E: draw_polygon <0x3E>(); break;
+        case 0x3F: draw_polygon <0x3F>(); break;
+
+        case 0x40: draw_line <0x40>(); break;
+        case 0x41: draw_line <0x41>(); break;
+        case 0x42: draw_line <0x42>(); break;
+        case 0x43: draw_line <0x43>(); break;
+        case 0x44: draw_line <0x44>(); break;
+        case 0x45: draw_line <0x45>(); break;
+        case 0x46: draw_line <0x46>(); break;
+        case 0x47: draw_line <0x47>(); break;
+
+        case 0x50: draw_line <0x50>(); break;
+        case 0x51: draw_line <0x51>(); break;
+        case 0x52: draw_line <0x52>(); break;
+        case 0x53: draw_line <0x53>(); break;
+        case 0x54: draw_line <0x54>(); break;
+        case 0x55: draw_line <0x55>(); break;
+        case 0x56: draw_line <0x56>(); break;
+        case 0x57: draw_line <0x57>(); break;
+
+        case 0x60: draw_rectangle <0x60>(); break;
+        case 0x61: draw_rectangle <0x61>(); break;
+        case 0x62: draw_rectangle <0x62>(); break;
+        case 0x63: draw_rectangle <0x63>(); break;
+
+        case 0x68: draw_rectangle <0x68>(); break;
+        case 0x69: draw_rectangle <0x69>(); break;
+        case 0x6A: draw_rectangle <0x6A>(); break;
+        case 0x6B: draw_rectangle <0x6B>(); break;
+
+        case 0x70: draw_rectangle <0x70>(); break;
+        case 0x71: draw_rectangle <0x71>(); break;
+        case 0x72: draw_rectangle <0x72>(); break;
+        case 0x73: draw_rectangle <0x73>(); break;
+
+        case 0x78: draw_rectangle <0x78>(); break;
+        case 0x79: draw_rectangle <0x79>(); break;
+        case 0x7A: draw_rectangle <0x7A>(); break;
+        case 0x7B: draw_rectangle <0x7B>(); break;
+
+        case 0x64: draw_rectangle <0x64>(); break;
+        case 0x65: draw_rectangle <0x65>(); break;
+        case 0x66: draw_rectangle <0x66>(); break;
+        case 0x67: draw_rectangle <0x67>(); break;
+
+        case 0x6C: draw_rectangle <0x6C>(); break;
+        case 0x6D: draw_rectangle <0x6D>(); break;
+        case 0x6E: draw_rectangle <0x6E>(); break;
+        case 0x6F: draw_rectangle <0x6F>(); break;
+
+        case 0x74: draw_rectangle <0x74>(); break;
+        case 0x75: draw_rectangle <0x75>(); break;
+        case 0x76: draw_rectangle <0x76>(); break;
+        case 0x77: draw_rectangle <0x77>(); break;
+
+        case 0x7C: draw_rectangle <0x7C>(); break;
+        case 0x7D: draw_rectangle <0x7D>(); break;
+        case 0x7E: draw_rectangle <0x7E>(); break;
+        case 0x7F: draw_rectangle <0x7F>(); break;
+
+        case 0x02: gp0_fill_vram(); break;
+        case 0xA0: gp0_load_texture(); break;
+        case 0x80: gp0_copy_vram_to_vram(); break;
+        case 0xC0: gp0_copy_vram_to_cpu(); break;
+        default: Helpers::panic ("Unknown multi-parameter GP0 opcode: %08X\n", lastGP0Opcode);
+    }
+}
+
+void GPU::gp0_word (u32 val) {
+    if (fetchingGP0Params) { // handle fetching GP0 commands
+        commandParameters[paramsFetched++] = val;
+        if (paramsFetched == paramsToFetch) { // check if the command length has been reached
+            fetchingGP0Params = false; // reset parameter fetching state
+            paramsFetched = 0;
+
+            executeBufferedCommand();
         }
 
-        if (paramsFetched == paramsToFetch) // check if word count has been reached
-            fetchingTextureData = false;
+        return; // don't fall through
+    }
 
+    else if (fetchingTextureData) { // handle fetching textures
+        uploadTextureWords (&val, 1);
+        return; // don't fall through
+    }
+
+    else if (fetchingPolyline) { // handle polyline vertices
+        gp0_polyline_param (val);
         return; // don't fall through
     }
 
     GP0_cmd command (val);
 
-    switch (command.opcode) {
+    switch (canonicalGP0Opcode(command.opcode)) {
         case 0x00: break; // NOP
         case 0x01: Helpers::warn ("[GPU] Tried to flush texture cache\n"); break;
+        case 0x02: bufferCommand(val); break;
 
-        case 0x20: bufferCommand(val); break;
-        case 0x22: bufferCommand(val); break;
-        case 0x28: bufferCommand(val); break;
-        case 0x2A: bufferCommand(val); break;
-        case 0x30: bufferCommand(val); break;
-        case 0x32: bufferCommand(val); break;
-        case 0x38: bufferCommand(val); break;
-        case 0x3A: bufferCommand(val); break;
+        case 0x20: case 0x21: case 0x22: case 0x23: bufferCommand(val); break;
+        case 0x24: case 0x25: case 0x26: case 0x27: bufferCommand(val); break;
+        case 0x28: case 0x29: case 0x2A: case 0x2B: bufferCommand(val); break;
+        case 0x2C: case 0x2D: case 0x2E: case 0x2F: bufferCommand(val); break;
+        case 0x30: case 0x31: case 0x32: case 0x33: bufferCommand(val); break;
+        case 0x34: case 0x35: case 0x36: case 0x37: bufferCommand(val); break;
+        case 0x38: case 0x39: case 0x3A: case 0x3B: bufferCommand(val); break;
+        case 0x3C: case 0x3D: case 0x3E: case 0x3F: bufferCommand(val); break;
+        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47: bufferCommand(val); break;
+        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57: bufferCommand(val); break;
+        case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F: gp0_polyline_start(val); break;
+        case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F: gp0_polyline_start(val); break;
+        case 0x60: case 0x61: case 0x62: case 0x63: bufferCommand(val); break;
+        case 0x64: case 0x65: case 0x66: case 0x67: bufferCommand(val); break;
+        case 0x68: case 0x69: case 0x6A: case 0x6B: bufferCommand(val); break;
+        case 0x6C: case 0x6D: case 0x6E: case 0x6F: bufferCommand(val); break;
+        case 0x70: case 0x71: case 0x72: case 0x73: bufferCommand(val); break;
+        case 0x74: case 0x75: case 0x76: case 0x77: bufferCommand(val); break;
+        case 0x78: case 0x79: case 0x7A: case 0x7B: bufferCommand(val); break;
+        case 0x7C: case 0x7D: case 0x7E: case 0x7F: bufferCommand(val); break;
         case 0xA0: bufferCommand(val); break;
-        case 0x2C: bufferCommand(val); break;
         case 0xC0: bufferCommand(val); break;
+        case 0x80: bufferCommand(val); break;
 
         case 0xE1: gp0_draw_mode (command); break;
         case 0xE2: gp0_set_texture_window(command); break;
@@ -78,6 +216,9 @@ void GPU::gp0_command(u32 val) {
 }
 
 void GPU::gp1_command(u32 val) {
+    if (recorder)
+        recorder -> gp1 (val);
+
     GP1_cmd command (val);
 
     switch (command.opcode & 0x3F) { // & 0x3F because GP1(40h..FFh) are mirrors of GP1(00h..3Fh).
@@ -95,10 +236,111 @@ void GPU::gp1_command(u32 val) {
     }
 }
 
+// Each word holds 2 pixels, low halfword first. They're written a row of the upload rectangle at a time
+void GPU::uploadTextureWords (const u32* words, u32 count) {
+    const auto bytes = (const u8*) words;
+    u32 halfword = 0;
+    u32 remaining = count * 2;
+
+    while (remaining > 0 && texture_upload_y != texture_upload_y_end) { // the padding halfword of an odd-sized upload is dropped
+        const auto run = std::min (remaining, texture_upload_x_end - texture_upload_x);
+        const auto row = &vram.pixels[(texture_upload_y & 0x1FF) * WIDTH];
+        const auto x = texture_upload_x & 0x3FF;
+
+        if (x + run <= WIDTH)
+            std::memcpy (&row[x], &bytes[halfword * 2], run * sizeof(u16));
+        else { // the row wraps around VRAM horizontally
+            for (u32 i = 0; i < run; i++)
+                row[(x + i) & 0x3FF] = (u16) (words[(halfword + i) / 2] >> (((halfword + i) & 1) * 16));
+        }
+
+        halfword += run;
+        remaining -= run;
+        texture_upload_x += run;
+
+        if (texture_upload_x == texture_upload_x_end) {
+            texture_upload_x = texture_upload_x_start;
+            texture_upload_y += 1;
+        }
+    }
+
+    paramsFetched += count;
+    if (paramsFetched == paramsToFetch) // check if word count has been reached
+        fetchingTextureData = false;
+}
+
 void GPU::bufferCommand (u32 val) { // used for multi-word GPU commands, such as draw calls
-    lastGP0Opcode = val >> 24; // store the opcode
+    lastGP0Opcode = canonicalGP0Opcode(val >> 24); // store the opcode
     fetchingGP0Params = true; // start fetching GPU command parameters
     paramsFetched = 0;
     commandParameters[paramsFetched++] = val; // store the command in the param list
     paramsToFetch = commandLengths[lastGP0Opcode]; // the number params we need to fetch to execute this GP0 opcode
 }
+
+auto GPU::gpuread() -> u32 {
+    if (recorder)
+        recorder -> gpuread();
+
+    if (vramReadIndex < vramReadBuffer.size()) { // stream out the data prepared by GP0(C0h)
+        gpureadLatch = vramReadBuffer[vramReadIndex++];
+
+        if (vramReadIndex == vramReadBuffer.size()) // transfer is over
+            status.send_vram_ready = 0;
+    }
+
+    return gpureadLatch;
+}
+
+void GPU::endFrame() {
+    if (recorder)
+        recorder -> frame();
+
+    flushPrimitives();
+    renderer -> endFrame();
+    if (!frameSkipper.skipping())
+        renderer -> present (displayArea());
+
+    frameCache.endFrame();
+    frameSkipper.endFrame();
+}
+
+void GPU::flushPrimitives() {
+    if (primitives.empty())
+        return;
+
+    const auto batches = primitives.batchList();
+    const auto vertices = primitives.vertexData();
+
+    if (frameSkipper.mode != FrameSkipMode::Off) {
+        for (u32 i = 0; i < primitives.size(); i++) { // remember what gets sampled, so skipped frames know which draws feed textures
+            if (batches[i].type == PrimitiveType::TexturedRect || (batches[i].flags & Renderer::TEXTURED))
+                frameSkipper.markTextureSource (batches[i].state);
+        }
+    }
+
+    if (frameSkipper.skipping()) { // only draw what might get read back, drop the rest
+        for (u32 i = 0; i < primitives.size(); i++) {
+            if (frameSkipper.isSampled (batches[i].state))
+                renderer -> drawBatch (vertices, batches[i]);
+            else
+                frameSkipper.stats.primitivesDropped += batches[i].vertexCount / verticesPerPrimitive (batches[i].type);
+        }
+
+        primitives.reset();
+        return;
+    }
+
+    if (frameCache.lookup (vram, primitives)) { // this segment was already drawn with the same inputs, and its output is back in VRAM
+        primitives.reset();
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (u32 i = 0; i < primitives.size(); i++) // one renderer call per batch
+        renderer -> drawBatch (vertices, batches[i]);
+
+    frameSkipper.addDrawTime (std::chrono::duration <double, std::milli> (std::chrono::steady_clock::now() - start).count());
+
+    frameCache.store (vram);
+    primitives.reset();
+}
@@ -0,0 +1,65 @@
+#include <algorithm>
+#include "include/gpu_recorder.h"
+#include "include/helpers.h"
+
+GPURecorder::GPURecorder (const std::string& path) {
+    file = std::fopen (path.c_str(), "wb");
+    if (file == nullptr)
+        Helpers::panic ("Couldn't open GPU log %s for writing\n", path.c_str());
+
+    const u32 header[2] = { GPULog::MAGIC, GPULog::VERSION };
+    std::fwrite (header, sizeof(u32), 2, file);
+    pendingWords.reserve (MAX_PENDING_WORDS);
+}
+
+GPURecorder::~GPURecorder() {
+    flushPending();
+    std::fclose (file);
+}
+
+void GPURecorder::writeRecord (GPULog::Record record, const void* payload, size_t size) {
+    const auto type = (u8) record;
+    std::fwrite (&type, 1, 1, file);
+    if (size != 0)
+        std::fwrite (payload, 1, size, file);
+}
+
+void GPURecorder::flushPending() {
+    if (!pendingWords.empty()) {
+        const auto count = (u32) pendingWords.size();
+        writeRecord (GPULog::Record::GP0Words, &count, sizeof(u32));
+        std::fwrite (pendingWords.data(), sizeof(u32), count, file);
+        pendingWords.clear();
+    }
+
+    if (pendingReads != 0) {
+        writeRecord (GPULog::Record::GPURead, &pendingReads, sizeof(u32));
+        pendingReads = 0;
+    }
+}
+
+void GPURecorder::gp0 (const u32* words, size_t count) {
+    if (pendingReads != 0)
+        flushPending();
+
+    while (count > 0) {
+        const auto length = std::min <size_t> (count, MAX_PENDING_WORDS - pendingWords.size());
+        pendingWords.insert (pendingWords.end(), words, words + length);
+        words += length;
+        count -= length;
+
+        if (pendingWords.size() == MAX_PENDING_WORDS)
+            flushPending();
+    }
+}
+
+void GPURecorder::gp1 (u32 word) {
+    flushPending();
+    writeRecord (GPULog::Record::GP1Word, &word, sizeof(u32));
+}
+
+void GPURecorder::frame() {
+    flushPending();
+    writeRecord (GPULog::Record::Frame, nullptr, 0);
+    std::fflush (file);
+}
@@ -0,0 +1,431 @@
+#include <algorithm>
+#include <cstdlib>
+#include "include/rasterizer.h"
+
+namespace {
+    auto floorDiv (s64 numerator, s64 denominator) -> s64 { // denominator must be positive
+        auto quotient = numerator / denominator;
+        return (numerator % denominator < 0) ? quotient - 1 : quotient;
+    }
+
+    auto ceilDiv (s64 numerator, s64 denominator) -> s64 { // denominator must be positive
+        return -floorDiv (-numerator, denominator);
+    }
+
+    // Modulates a 5-bit texel channel with an 8-bit vertex color channel. 0x80 is the neutral vertex color
+    inline auto modulate (u32 texel, u32 color) -> u32 {
+        return std::min <u32> ((texel << 3) * color >> 7, 0xFF);
+    }
+
+    inline auto texelToFragment (u16 texel, u32 flags) -> u32 { // convert a 1555 texel to a fragment, without modulation
+        return ((texel & 0x1F) << 3) | ((texel & 0x3E0) << 6) | ((texel & 0x7C00) << 9) | ((texel & 0x8000) ? flags : 0);
+    }
+
+    inline auto modulatedFragment (u16 texel, u32 r, u32 g, u32 b, u32 flags) -> u32 {
+        return modulate (texel & 0x1F, r) | (modulate ((texel >> 5) & 0x1F, g) << 8) | (modulate ((texel >> 10) & 0x1F, b) << 16) | ((texel & 0x8000) ? flags : 0);
+    }
+}
+
+using namespace SpanKernels;
+
+// Picks the span kernel and fragment flags for the next primitive.
+// Dithering only applies to primitives whose color is interpolated or modulated, not to flat colors or raw textures
+void Rasterizer::setupPrimitive (const DrawState& state, bool textured, bool ditherable) {
+    auto blendMode = state.semi_transparent ? state.semi_transparency : BLEND_NONE;
+    spanKernel = SpanKernels::select (blendMode, state.dither && ditherable, state.set_mask, state.check_mask);
+
+    // Semi-transparent textured primitives only blend texels with bit 15 set, untextured ones blend every pixel
+    texelFlags = state.semi_transparent ? (FRAGMENT_MASK | FRAGMENT_BLEND) : FRAGMENT_MASK;
+    flatFlags = (state.semi_transparent && !textured) ? FRAGMENT_BLEND : 0;
+}
+
+auto Rasterizer::clipBounds (s32 minX, s32 minY, s32 maxX, s32 maxY, const DrawState& state, ClipRect& bounds) -> bool {
+    bounds.left = std::max (minX, state.clip_left);
+    bounds.top = std::max (minY, state.clip_top);
+    bounds.right = std::min (maxX, state.clip_right);
+    bounds.bottom = std::min (maxY, state.clip_bottom);
+
+    if (bounds.left > bounds.right || bounds.top > bounds.bottom) {
+        stats.offscreen++;
+        return false;
+    }
+
+    return true;
+}
+
+auto Rasterizer::setupTriangle (const RasterVertex* vertices, const DrawState& state, ClipRect& bounds) -> bool {
+    const auto minX = std::min ({vertices[0].x, vertices[1].x, vertices[2].x});
+    const auto maxX = std::max ({vertices[0].x, vertices[1].x, vertices[2].x});
+    const auto minY = std::min ({vertices[0].y, vertices[1].y, vertices[2].y});
+    const auto maxY = std::max ({vertices[0].y, vertices[1].y, vertices[2].y});
+
+    if (maxX - minX > (1023 << scaleShift) || maxY - minY > (511 << scaleShift)) {
+        stats.oversized++;
+        return false;
+    }
+
+    const auto area = (vertices[1].x - vertices[0].x) * (vertices[2].y - vertices[0].y) - (vertices[2].x - vertices[0].x) * (vertices[1].y - vertices[0].y);
+    if (area == 0) {
+        stats.degenerate++;
+        return false;
+    }
+
+    return clipBounds (minX, minY, maxX, maxY, state, bounds);
+}
+
+auto Rasterizer::setupLine (const RasterVertex& start, const RasterVertex& end, const DrawState& state, ClipRect& bounds) -> bool {
+    if (std::abs (end.x - start.x) > (1023 << scaleShift) || std::abs (end.y - start.y) > (511 << scaleShift)) {
+        stats.oversized++;
+        return false;
+    }
+
+    return clipBounds (std::min (start.x, end.x), std::min (start.y, end.y), std::max (start.x, end.x), std::max (start.y, end.y), state, bounds);
+}
+
+auto Rasterizer::setupRect (s32 x, s32 y, u32 width, u32 height, const DrawState& state, ClipRect& bounds) -> bool {
+    if (width == 0 || height == 0) {
+        stats.degenerate++;
+        return false;
+    }
+
+    return clipBounds (x, y, x + (s32) width - 1, y + (s32) height - 1, state, bounds);
+}
+
+/*
+ * Triangles are rasterized with edge functions. For each scanline, the span covered by the triangle is found by solving
+ * the 3 edge inequalities for x, and attributes are interpolated in 16.16 fixed point from per-triangle gradients.
+ * Edges follow a top-left fill rule, so that triangles sharing an edge never draw the same pixel twice
+*/
+
+template <const bool shaded, const bool textured, const bool raw_texture>
+void Rasterizer::rasterizeTriangle (const RasterVertex* v0, const RasterVertex* v1, const RasterVertex* v2, const DrawState& state, const ClipRect& bounds, const u16* texels) {
+    const auto& addressing = textureCache.texelAddressing();
+    s64 area = (s64) (v1 -> x - v0 -> x) * (v2 -> y - v0 -> y) - (s64) (v2 -> x - v0 -> x) * (v1 -> y - v0 -> y); // never 0, the setup stage drops degenerate triangles
+
+    if (area < 0) { // make the winding order consistent so that the inside of every edge is positive
+        std::swap (v1, v2);
+        area = -area;
+    }
+
+    // Edge function of the edge a->b: E(x, y) = A * x + B * y + C, positive on the inside of the triangle
+    struct Edge {
+        s64 a, b, c;
+        s64 bias; // 0 for top-left edges (pixels exactly on the edge are drawn), 1 for the rest
+    };
+
+    auto makeEdge = [] (const RasterVertex* from, const RasterVertex* to) {
+        Edge edge;
+        edge.a = from -> y - to -> y;
+        edge.b = to -> x - from -> x;
+        edge.c = -(edge.a * from -> x + edge.b * from -> y);
+        edge.bias = (edge.a > 0 || (edge.a == 0 && edge.b > 0)) ? 0 : 1;
+        return edge;
+    };
+
+    const Edge edges[3] = { makeEdge (v0, v1), makeEdge (v1, v2), makeEdge (v2, v0) };
+
+    // Attribute gradients in 16.16 fixed point, relative to v0
+    auto gradientX = [&] (s64 a0, s64 a1, s64 a2) -> s64 {
+        return (((a1 - a0) * (v2 -> y - v0 -> y) - (a2 - a0) * (v1 -> y - v0 -> y)) << 16) / area;
+    };
+
+    auto gradientY = [&] (s64 a0, s64 a1, s64 a2) -> s64 {
+        return (((a2 - a0) * (v1 -> x - v0 -> x) - (a1 - a0) * (v2 -> x - v0 -> x)) << 16) / area;
+    };
+
+    s64 drdx = 0, drdy = 0, dgdx = 0, dgdy = 0, dbdx = 0, dbdy = 0;
+    s64 dudx = 0, dudy = 0, dvdx = 0, dvdy = 0;
+
+    if constexpr (shaded) {
+        drdx = gradientX (v0 -> color & 0xFF, v1 -> color & 0xFF, v2 -> color & 0xFF);
+        drdy = gradientY (v0 -> color & 0xFF, v1 -> color & 0xFF, v2 -> color & 0xFF);
+        dgdx = gradientX ((v0 -> color >> 8) & 0xFF, (v1 -> color >> 8) & 0xFF, (v2 -> color >> 8) & 0xFF);
+        dgdy = gradientY ((v0 -> color >> 8) & 0xFF, (v1 -> color >> 8) & 0xFF, (v2 -> color >> 8) & 0xFF);
+        dbdx = gradientX ((v0 -> color >> 16) & 0xFF, (v1 -> color >> 16) & 0xFF, (v2 -> color >> 16) & 0xFF);
+        dbdy = gradientY ((v0 -> color >> 16) & 0xFF, (v1 -> color >> 16) & 0xFF, (v2 -> color >> 16) & 0xFF);
+    }
+
+    if constexpr (textured) {
+        dudx = gradientX (v0 -> u, v1 -> u, v2 -> u);
+        dudy = gradientY (v0 -> u, v1 -> u, v2 -> u);
+        dvdx = gradientX (v0 -> v, v1 -> v, v2 -> v);
+        dvdy = gradientY (v0 -> v, v1 -> v, v2 -> v);
+    }
+
+    const u32 flatColor = v0 -> color & 0xFF'FFFF; // monochrome primitives use the color of the first vertex
+    const u32 flatR = flatColor & 0xFF;
+    const u32 flatG = (flatColor >> 8) & 0xFF;
+    const u32 flatB = flatColor >> 16;
+
+    for (auto y = bounds.top; y <= bounds.bottom; y++) {
+        s64 left = bounds.left;
+        s64 right = bounds.right;
+
+        for (const auto& edge : edges) { // narrow down the span to the part inside all 3 edges
+            auto k = edge.b * y + edge.c;
+
+            if (edge.a > 0)
+                left = std::max (left, ceilDiv (edge.bias - k, edge.a));
+            else if (edge.a < 0)
+                right = std::min (right, floorDiv (k - edge.bias, -edge.a));
+            else if (k < edge.bias) { // horizontal edge with the whole scanline outside of it
+                left = 1;
+                right = 0;
+            }
+        }
+
+        if (left > right)
+            continue;
+
+        const auto count = (u32) (right - left + 1);
+        const auto dx = left - v0 -> x;
+        const auto dy = y - v0 -> y;
+
+        // attribute values at the start of the span, with 0.5 added for rounding
+        s32 r = 0, g = 0, b = 0, u = 0, v = 0;
+        if constexpr (shaded) {
+            r = (s32) (((s64) (v0 -> color & 0xFF) << 16) + drdx * dx + drdy * dy + 0x8000);
+            g = (s32) (((s64) ((v0 -> color >> 8) & 0xFF) << 16) + dgdx * dx + dgdy * dy + 0x8000);
+            b = (s32) (((s64) ((v0 -> color >> 16) & 0xFF) << 16) + dbdx * dx + dbdy * dy + 0x8000);
+        }
+
+        if constexpr (textured) {
+            u = (s32) (((s64) v0 -> u << 16) + dudx * dx + dudy * dy + 0x8000);
+            v = (s32) (((s64) v0 -> v << 16) + dvdx * dx + dvdy * dy + 0x8000);
+        }
+
+        for (u32 i = 0; i < count; i++) {
+            u32 red = flatR, green = flatG, blue = flatB;
+
+            if constexpr (shaded) {
+                red = std::clamp (r >> 16, 0, 0xFF);
+                green = std::clamp (g >> 16, 0, 0xFF);
+                blue = std::clamp (b >> 16, 0, 0xFF);
+                r += (s32) drdx; g += (s32) dgdx; b += (s32) dbdx;
+            }
+
+            if constexpr (textured) {
+                const auto texelU = (((u32) u >> 16) & state.window_u_and) | state.window_u_or;
+                const auto texelV = (((u32) v >> 16) & state.window_v_and) | state.window_v_or;
+                u += (s32) dudx; v += (s32) dvdx;
+
+                const auto texel = texels[addressing.row[texelV] + addressing.column[texelU]];
+                if (texel == 0) // texel 0000h is fully transparent
+                    fragments[i] = FRAGMENT_DISCARD;
+                else if constexpr (raw_texture)
+                    fragments[i] = texelToFragment (texel, texelFlags);
+                else
+                    fragments[i] = modulatedFragment (texel, red, green, blue, texelFlags);
+            }
+
+            else
+                fragments[i] = red | (green << 8) | (blue << 16) | flatFlags;
+        }
+
+        writeSpan ((s32) left, y, count);
+    }
+}
+
+template <const bool raw_texture>
+void Rasterizer::rasterizeTexturedRect (s32 x, s32 y, u32 u, u32 v, u32 color, const DrawState& state, const ClipRect& bounds, bool hflip, bool vflip) {
+    const auto left = bounds.left, top = bounds.top, right = bounds.right, bottom = bounds.bottom;
+
+    const s32 du = hflip ? -1 : 1;
+    const s32 dv = vflip ? -1 : 1;
+    // Texel offsets skip the clipped part. In a scaled target every texel covers a square of (1 << scaleShift) pixels
+    const auto startV = (s32) v + dv * ((top - y) >> scaleShift);
+    const auto endV = (s32) v + dv * ((bottom - y) >> scaleShift);
+
+    const auto texels = textureCache.fetch (state, std::min (startV, endV), std::max (startV, endV));
+    const auto& addressing = textureCache.texelAddressing();
+    const auto count = (u32) (right - left + 1);
+    const u32 r = color & 0xFF, g = (color >> 8) & 0xFF, b = (color >> 16) & 0xFF;
+
+    for (u32 i = 0; i < count; i++) { // every row samples the same columns, so their offsets are only worked out once
+        const auto texelU = (u32) ((s32) u + du * ((left - x + (s32) i) >> scaleShift)) & 0xFF;
+        texelColumns[i] = addressing.column[(texelU & state.window_u_and) | state.window_u_or];
+    }
+
+    for (auto line = top; line <= bottom; line++) {
+        const auto texelV = (((u32) ((s32) v + dv * ((line - y) >> scaleShift)) & 0xFF) & state.window_v_and) | state.window_v_or;
+        const auto row = &texels[addressing.row[texelV]];
+
+        for (u32 i = 0; i < count; i++) {
+            const auto texel = row[texelColumns[i]];
+
+            if (texel == 0) // texel 0000h is fully transparent
+                fragments[i] = FRAGMENT_DISCARD;
+            else if constexpr (raw_texture)
+                fragments[i] = texelToFragment (texel, texelFlags);
+            else
+                fragments[i] = modulatedFragment (texel, r, g, b, texelFlags);
+        }
+
+        writeSpan (left, line, count);
+    }
+}
+
+template <const bool shaded, const bool textured, const bool raw_texture>
+void Rasterizer::drawTriangle (const RasterVertex* vertices, const DrawState& state) {
+    ClipRect bounds;
+    if (!setupTriangle (vertices, state, bounds))
+        return;
+
+    const u16* texels = nullptr;
+    if constexpr (textured) {
+        auto vMin = std::min ({vertices[0].v, vertices[1].v, vertices[2].v});
+        auto vMax = std::max ({vertices[0].v, vertices[1].v, vertices[2].v});
+        texels = textureCache.fetch (state, (s32) vMin - 1, (s32) vMax + 1); // 1 row of margin for rounding
+    }
+
+    stats.drawn++;
+    setupPrimitive (state, textured, shaded || (textured && !raw_texture));
+    rasterizeTriangle <shaded, textured, raw_texture> (&vertices[0], &vertices[1], &vertices[2], state, bounds, texels);
+    markDrawn (bounds);
+}
+
+template <const bool shaded, const bool textured, const bool raw_texture>
+void Rasterizer::drawQuad (const RasterVertex* vertices, const DrawState& state) { // quads are drawn as the triangles (v1, v2, v3) and (v2, v3, v4)
+    // Reject quads that are entirely off the drawing area in one go, before looking at their triangles
+    if (std::max ({vertices[0].x, vertices[1].x, vertices[2].x, vertices[3].x}) < state.clip_left ||
+        std::min ({vertices[0].x, vertices[1].x, vertices[2].x, vertices[3].x}) > state.clip_right ||
+        std::max ({vertices[0].y, vertices[1].y, vertices[2].y, vertices[3].y}) < state.clip_top ||
+        std::min ({vertices[0].y, vertices[1].y, vertices[2].y, vertices[3].y}) > state.clip_bottom) {
+        stats.offscreen += 2;
+        return;
+    }
+
+    drawTriangle <shaded, textured, raw_texture> (&vertices[0], state);
+    drawTriangle <shaded, textured, raw_texture> (&vertices[1], state);
+}
+
+template <const bool raw_texture>
+void Rasterizer::drawTexturedRect (s32 x, s32 y, u32 width, u32 height, u32 u, u32 v, u32 color, const DrawState& state, bool hflip, bool vflip) {
+    ClipRect bounds;
+    if (!setupRect (x, y, width, height, state, bounds))
+        return;
+
+    stats.drawn++;
+    setupPrimitive (state, true, false); // rectangles are never dithered
+    rasterizeTexturedRect <raw_texture> (x, y, u, v, color, state, bounds, hflip, vflip);
+    markDrawn (bounds);
+}
+
+void Rasterizer::drawFlatRect (s32 x, s32 y, u32 width, u32 height, u32 color, const DrawState& state) {
+    ClipRect bounds;
+    if (!setupRect (x, y, width, height, state, bounds))
+        return;
+
+    const auto left = bounds.left, top = bounds.top, bottom = bounds.bottom;
+    const auto count = (u32) (bounds.right - left + 1);
+    stats.drawn++;
+    markDrawn (bounds);
+
+    if (!state.semi_transparent && !state.check_mask) { // opaque, unmasked rectangles are plain row fills
+        auto pixel = (u16) (((color >> 3) & 0x1F) | ((color >> 6) & 0x3E0) | ((color >> 9) & 0x7C00));
+        if (state.set_mask)
+            pixel |= 0x8000;
+
+        for (auto line = top; line <= bottom; line++)
+            VRAM::fillSpan (&target[line * targetWidth + left], count, pixel);
+
+        stats.pixels += (u64) count * (bottom - top + 1);
+
+        return;
+    }
+
+    setupPrimitive (state, false, false);
+    std::fill_n (fragments.begin(), count, (color & 0xFF'FFFF) | flatFlags); // every row uses the same fragments
+
+    for (auto line = top; line <= bottom; line++)
+        writeSpan (left, line, count);
+}
+
+// Lines are stepped along their major axis in 16.16 fixed point, one pixel at a time, both endpoints included
+// In a scaled target they're (1 << scaleShift) pixels thick across their minor axis, centered on the stepped position
+template <const bool shaded>
+void Rasterizer::drawLine (const RasterVertex& start, const RasterVertex& end, const DrawState& state) {
+    ClipRect bounds;
+    if (!setupLine (start, end, state, bounds))
+        return;
+
+    stats.drawn++;
+    const s32 dx = end.x - start.x;
+    const s32 dy = end.y - start.y;
+    const s32 steps = std::max (std::abs (dx), std::abs (dy));
+
+    setupPrimitive (state, false, shaded);
+
+    auto channel = [] (u32 color, int index) -> s32 { return (s32) ((color >> (index * 8)) & 0xFF) << 16; };
+    s32 x = (start.x << 16) + 0x8000, y = (start.y << 16) + 0x8000;
+    s32 r = channel (start.color, 0), g = channel (start.color, 1), b = channel (start.color, 2);
+    s32 xStep = 0, yStep = 0, rStep = 0, gStep = 0, bStep = 0;
+
+    if (steps != 0) {
+        xStep = (dx << 16) / steps;
+        yStep = (dy << 16) / steps;
+
+        if constexpr (shaded) {
+            rStep = (channel (end.color, 0) - r) / steps;
+            gStep = (channel (end.color, 1) - g) / steps;
+            bStep = (channel (end.color, 2) - b) / steps;
+        }
+    }
+
+    const s32 thickness = 1 << scaleShift;
+    const bool xMajor = std::abs (dx) >= std::abs (dy);
+
+    for (s32 i = 0; i <= steps; i++) {
+        const auto pixelX = x >> 16;
+        const auto pixelY = y >> 16;
+        const auto fragment = (r >> 16) | ((g >> 16) << 8) | ((b >> 16) << 16) | flatFlags;
+
+        if (xMajor) { // a vertical run of pixels
+            if (pixelX >= state.clip_left && pixelX <= state.clip_right) {
+                const auto runTop = std::max (pixelY - thickness / 2, state.clip_top);
+                const auto runBottom = std::min (pixelY - thickness / 2 + thickness - 1, state.clip_bottom);
+
+                for (auto line = runTop; line <= runBottom; line++) {
+                    fragments[0] = fragment;
+                    writeSpan (pixelX, line, 1);
+                }
+            }
+        }
+
+        else if (pixelY >= state.clip_top && pixelY <= state.clip_bottom) { // a horizontal span
+            const auto spanLeft = std::max (pixelX - thickness / 2, state.clip_left);
+            const auto spanRight = std::min (pixelX - thickness / 2 + thickness - 1, state.clip_right);
+
+            if (spanLeft <= spanRight) {
+                std::fill_n (fragments.begin(), spanRight - spanLeft + 1, fragment);
+                writeSpan (spanLeft, pixelY, (u32) (spanRight - spanLeft + 1));
+            }
+        }
+
+        x += xStep; y += yStep;
+        r += rStep; g += gStep; b += bStep;
+    }
+
+    markDrawn (bounds);
+}
+
+// Instantiate every variant of the draw functions, so they can live in this file instead of the header
+template void Rasterizer::drawTriangle <false, false, false> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawTriangle <true, false, false> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawTriangle <false, true, false> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawTriangle <false, true, true> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawTriangle <true, true, false> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawTriangle <true, true, true> (const RasterVertex*, const DrawState&);
+
+template void Rasterizer::drawQuad <false, false, false> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawQuad <true, false, false> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawQuad <false, true, false> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawQuad <false, true, true> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawQuad <true, true, false> (const RasterVertex*, const DrawState&);
+template void Rasterizer::drawQuad <true, true, true> (const RasterVertex*, const DrawState&);
+
+template void Rasterizer::drawTexturedRect <false> (s32, s32, u32, u32, u32, u32, u32, const DrawState&, bool, bool);
+template void Rasterizer::drawTexturedRect <true> (s32, s32, u32, u32, u32, u32, u32, const DrawState&, bool, bool);
+
+template void Rasterizer::drawLine <false> (const RasterVertex&, const RasterVertex&, const DrawState&);
+template void Rasterizer::drawLine <true> (const RasterVertex&, const RasterVertex&, const DrawState&);
@@ -0,0 +1,38 @@
+#include "include/renderer.h"
+#include "include/null_renderer.h"
+#include "include/software_renderer.h"
+#include "include/helpers.h"
+
+#ifndef PSX_HEADLESS // headless builds leave the SFML backend out entirely, so they don't need SFML to build or run
+#include "include/window_renderer.h"
+#endif
+
+auto Renderer::create (RendererType type, VRAM& vram, u32 scale, [[maybe_unused]] bool downsample) -> std::unique_ptr <Renderer> {
+    switch (type) {
+        case RendererType::Null: return std::make_unique <NullRenderer>();
+        case RendererType::Software: return std::make_unique <SoftwareRenderer> (vram, scale);
+
+        case RendererType::Window:
+        #ifdef PSX_HEADLESS
+            Helpers::warn ("This is a headless build, falling back to the software renderer\n");
+            return std::make_unique <SoftwareRenderer> (vram, scale);
+        #else
+            return std::make_unique <BeegRenderer> (vram, WIDTH, HEIGHT, "Poopstation", scale, downsample);
+        #endif
+    }
+
+    Helpers::panic ("Unknown renderer type\n");
+}
+
+auto Renderer::parseType (const std::string& name, RendererType& type) -> bool {
+    if (name == "null")
+        type = RendererType::Null;
+    else if (name == "software")
+        type = RendererType::Software;
+    else if (name == "window")
+        type = RendererType::Window;
+    else
+        return false;
+
+    return true;
+}
@@ -0,0 +1,102 @@
+#include "include/software_renderer.h"
+#include "include/helpers.h"
+
+// Draw every primitive of a batch. The type and flags are template parameters, so the loop calls straight into the right rasterizer variant
+template <const PrimitiveType type, const u32 flags>
+void SoftwareRenderer::drawPrimitives (Rasterizer& rasterizer, const RasterVertex* vertices, const Batch& batch) {
+    constexpr bool shaded = flags & SHADED;
+    constexpr bool textured = flags & TEXTURED;
+    constexpr bool raw_texture = flags & RAW_TEXTURE;
+
+    const auto& state = batch.state;
+    const auto end = batch.firstVertex + batch.vertexCount;
+
+    if constexpr (type == PrimitiveType::Triangle) {
+        for (auto i = batch.firstVertex; i < end; i += 3)
+            rasterizer.drawTriangle <shaded, textured, raw_texture> (&vertices[i], state);
+    }
+
+    else if constexpr (type == PrimitiveType::Quad) {
+        for (auto i = batch.firstVertex; i < end; i += 4)
+            rasterizer.drawQuad <shaded, textured, raw_texture> (&vertices[i], state);
+    }
+
+    else if constexpr (type == PrimitiveType::TexturedRect) {
+        const bool hflip = batch.flags & H_FLIP;
+        const bool vflip = batch.flags & V_FLIP;
+
+        for (auto i = batch.firstVertex; i < end; i += 2) {
+            const auto& corner = vertices[i];
+            const auto& size = vertices[i + 1];
+            rasterizer.drawTexturedRect <raw_texture> (corner.x, corner.y, size.x, size.y, corner.u, corner.v, corner.color, state, hflip, vflip);
+        }
+    }
+
+    else if constexpr (type == PrimitiveType::FlatRect) {
+        for (auto i = batch.firstVertex; i < end; i += 2)
+            rasterizer.drawFlatRect (vertices[i].x, vertices[i].y, vertices[i + 1].x, vertices[i + 1].y, vertices[i].color, state);
+    }
+
+    else if constexpr (type == PrimitiveType::Line) {
+        for (auto i = batch.firstVertex; i < end; i += 2)
+            rasterizer.drawLine <shaded> (vertices[i], vertices[i + 1], state);
+    }
+}
+
+void SoftwareRenderer::rasterizeBatch (Rasterizer& rasterizer, const RasterVertex* vertices, const Batch& batch) {
+    using Type = PrimitiveType;
+    const auto flags = batch.flags & ~(H_FLIP | V_FLIP); // flipping is handled at runtime
+
+    switch (batch.type) {
+        case Type::Triangle:
+            switch (flags) {
+                case 0: drawPrimitives <Type::Triangle, 0> (rasterizer, vertices, batch); return;
+                case SHADED: drawPrimitives <Type::Triangle, SHADED> (rasterizer, vertices, batch); return;
+                case TEXTURED: drawPrimitives <Type::Triangle, TEXTURED> (rasterizer, vertices, batch); return;
+                case SHADED | TEXTURED: drawPrimitives <Type::Triangle, SHADED | TEXTURED> (rasterizer, vertices, batch); return;
+                case TEXTURED | RAW_TEXTURE: drawPrimitives <Type::Triangle, TEXTURED | RAW_TEXTURE> (rasterizer, vertices, batch); return;
+                case SHADED | TEXTURED | RAW_TEXTURE: drawPrimitives <Type::Triangle, SHADED | TEXTURED | RAW_TEXTURE> (rasterizer, vertices, batch); return;
+            }
+            break;
+
+        case Type::Quad:
+            switch (flags) {
+                case 0: drawPrimitives <Type::Quad, 0> (rasterizer, vertices, batch); return;
+                case SHADED: drawPrimitives <Type::Quad, SHADED> (rasterizer, vertices, batch); return;
+                case TEXTURED: drawPrimitives <Type::Quad, TEXTURED> (rasterizer, vertices, batch); return;
+                case SHADED | TEXTURED: drawPrimitives <Type::Quad, SHADED | TEXTURED> (rasterizer, vertices, batch); return;
+                case TEXTURED | RAW_TEXTURE: drawPrimitives <Type::Quad, TEXTURED | RAW_TEXTURE> (rasterizer, vertices, batch); return;
+                case SHADED | TEXTURED | RAW_TEXTURE: drawPrimitives <Type::Quad, SHADED | TEXTURED | RAW_TEXTURE> (rasterizer, vertices, batch); return;
+            }
+            break;
+
+        case Type::TexturedRect:
+            if (flags & RAW_TEXTURE)
+                drawPrimitives <Type::TexturedRect, RAW_TEXTURE> (rasterizer, vertices, batch);
+            else
+                drawPrimitives <Type::TexturedRect, 0> (rasterizer, vertices, batch);
+            return;
+
+        case Type::FlatRect: drawPrimitives <Type::FlatRect, 0> (rasterizer, vertices, batch); return;
+
+        case Type::Line:
+            if (flags & SHADED)
+                drawPrimitives <Type::Line, SHADED> (rasterizer, vertices, batch);
+            else
+                drawPrimitives <Type::Line, 0> (rasterizer, vertices, batch);
+            return;
+    }
+
+    Helpers::panic ("Invalid batch (type: %d, flags: %X)\n", (int) batch.type, batch.flags);
+}
+
+void SoftwareRenderer::drawBatch (const RasterVertex* vertices, const Batch& batch) {
+    if (!upscaler) {
+        rasterizeBatch (rasterizer, vertices, batch);
+        return;
+    }
+
+    upscaler -> sync(); // the scaled pass draws over whatever VRAM transfers left in the target
+    rasterizeBatch (rasterizer, vertices, batch);
+    upscaler -> draw (vertices, batch);
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <array>
+#include "include/span_kernels.h"
+#include "include/simd.h"
+
+namespace {
+    using namespace SpanKernels;
+
+    constexpr s16 ditherMatrix[4][4] = { // offsets added to the 8-bit color channels before they're truncated to 5 bits
+        { -4,  0, -3,  1 },
+        {  2, -2,  3, -1 },
+        { -3,  1, -4,  0 },
+        {  3, -1,  2, -2 }
+    };
+
+    template <const u32 blendMode>
+    inline auto blendChannel (s32 background, s32 foreground) -> s32 {
+        if constexpr (blendMode == 0) return (background + foreground) >> 1; // B/2 + F/2
+        if constexpr (blendMode == 1) return std::min (background + foreground, 31); // B + F
+        if constexpr (blendMode == 2) return std::max (background - foreground, 0); // B - F
+        if constexpr (blendMode == 3) return std::min (background + (foreground >> 2), 31); // B + F/4
+        return foreground;
+    }
+
+    // Scalar version of the kernel. Used for the leftover pixels of each span, and on hosts without SSE2
+    template <const u32 blendMode, const bool dither, const bool setMask, const bool checkMask>
+    inline void shadePixel (u16* dest, u32 fragment, s32 ditherOffset) {
+        const auto background = *dest;
+        if ((fragment & FRAGMENT_DISCARD) || (checkMask && (background & 0x8000)))
+            return;
+
+        s32 channels[3];
+        for (auto i = 0; i < 3; i++) {
+            auto value = (s32) ((fragment >> (i * 8)) & 0xFF);
+            if constexpr (dither)
+                value = std::clamp (value + ditherOffset, 0, 0xFF);
+
+            auto foreground = value >> 3;
+            if constexpr (blendMode != BLEND_NONE) {
+                if (fragment & FRAGMENT_BLEND)
+                    foreground = blendChannel <blendMode> ((background >> (i * 5)) & 0x1F, foreground);
+            }
+
+            channels[i] = foreground;
+        }
+
+        auto pixel = channels[0] | (channels[1] << 5) | (channels[2] << 10) | ((fragment & FRAGMENT_MASK) >> 9);
+        if constexpr (setMask)
+            pixel |= 0x8000;
+
+        *dest = (u16) pixel;
+    }
+
+#ifdef PSX_SSE2
+    template <const u32 blendMode>
+    inline auto blendChannels (__m128i background, __m128i foreground) -> __m128i { // 8 5-bit channels in 16-bit lanes
+        const auto max = _mm_set1_epi16 (31);
+
+        if constexpr (blendMode == 0) return _mm_srli_epi16 (_mm_add_epi16 (background, foreground), 1);
+        if constexpr (blendMode == 1) return _mm_min_epi16 (_mm_add_epi16 (background, foreground), max);
+        if constexpr (blendMode == 2) return _mm_max_epi16 (_mm_sub_epi16 (background, foreground), _mm_setzero_si128());
+        if constexpr (blendMode == 3) return _mm_min_epi16 (_mm_add_epi16 (background, _mm_srli_epi16 (foreground, 2)), max);
+        return foreground;
+    }
+#endif
+
+    template <const u32 blendMode, const bool dither, const bool setMask, const bool checkMask>
+    void spanKernel (u16* dest, const u32* fragments, u32 count, s32 x, s32 y) {
+        const auto ditherRow = ditherMatrix[y & 3];
+        u32 i = 0;
+
+#ifdef PSX_SSE2
+        // 8 pixels per iteration. Fragments are unpacked into 16-bit lanes, one vector per channel
+        const auto byteMask = _mm_set1_epi32 (0xFF);
+        const auto channelMask = _mm_set1_epi16 (0x1F);
+        const auto blendFlag = _mm_set1_epi16 ((s16) (FRAGMENT_BLEND >> 24));
+        const auto discardFlag = _mm_set1_epi16 ((s16) (FRAGMENT_DISCARD >> 24));
+        const auto maskFlag = _mm_set1_epi16 ((s16) (FRAGMENT_MASK >> 24));
+        const auto ditherOffsets = _mm_setr_epi16 (ditherRow[x & 3], ditherRow[(x + 1) & 3], ditherRow[(x + 2) & 3], ditherRow[(x + 3) & 3],
+                                                   ditherRow[x & 3], ditherRow[(x + 1) & 3], ditherRow[(x + 2) & 3], ditherRow[(x + 3) & 3]);
+
+        for (; i + 8 <= count; i += 8) {
+            const auto low = _mm_loadu_si128 ((const __m128i*) &fragments[i]);
+            const auto high = _mm_loadu_si128 ((const __m128i*) &fragments[i + 4]);
+            const auto flags = _mm_packs_epi32 (_mm_srli_epi32 (low, 24), _mm_srli_epi32 (high, 24));
+            const auto background = _mm_loadu_si128 ((const __m128i*) &dest[i]);
+            const auto blend = _mm_cmpeq_epi16 (_mm_and_si128 (flags, blendFlag), blendFlag);
+
+            __m128i channels[3];
+            for (auto c = 0; c < 3; c++) {
+                const auto fragmentShift = _mm_cvtsi32_si128 (c * 8);
+                const auto pixelShift = _mm_cvtsi32_si128 (c * 5);
+                auto value = _mm_packs_epi32 (_mm_and_si128 (_mm_srl_epi32 (low, fragmentShift), byteMask), _mm_and_si128 (_mm_srl_epi32 (high, fragmentShift), byteMask));
+                if constexpr (dither) {
+                    value = _mm_add_epi16 (value, ditherOffsets);
+                    value = _mm_min_epi16 (_mm_max_epi16 (value, _mm_setzero_si128()), _mm_set1_epi16 (0xFF));
+                }
+
+                auto foreground = _mm_srli_epi16 (value, 3);
+                if constexpr (blendMode != BLEND_NONE) {
+                    const auto blended = blendChannels <blendMode> (_mm_and_si128 (_mm_srl_epi16 (background, pixelShift), channelMask), foreground);
+                    foreground = _mm_or_si128 (_mm_and_si128 (blend, blended), _mm_andnot_si128 (blend, foreground));
+                }
+
+                channels[c] = foreground;
+            }
+
+            auto pixels = _mm_or_si128 (_mm_or_si128 (channels[0], _mm_slli_epi16 (channels[1], 5)), _mm_slli_epi16 (channels[2], 10));
+            pixels = _mm_or_si128 (pixels, _mm_slli_epi16 (_mm_and_si128 (flags, maskFlag), 15));
+            if constexpr (setMask)
+                pixels = _mm_or_si128 (pixels, _mm_set1_epi16 ((s16) 0x8000));
+
+            auto keep = _mm_cmpeq_epi16 (_mm_and_si128 (flags, discardFlag), discardFlag); // lanes that keep the old VRAM value
+            if constexpr (checkMask)
+                keep = _mm_or_si128 (keep, _mm_srai_epi16 (background, 15));
+
+            const auto result = _mm_or_si128 (_mm_and_si128 (keep, background), _mm_andnot_si128 (keep, pixels));
+            _mm_storeu_si128 ((__m128i*) &dest[i], result);
+        }
+#endif
+
+        for (; i < count; i++)
+            shadePixel <blendMode, dither, setMask, checkMask> (&dest[i], fragments[i], ditherRow[(x + i) & 3]);
+    }
+
+    template <const u32 blendMode>
+    constexpr auto kernelsForMode() -> std::array <Kernel, 8> { // indexed by (dither << 2) | (setMask << 1) | checkMask
+        return {
+            spanKernel <blendMode, false, false, false>, spanKernel <blendMode, false, false, true>,
+            spanKernel <blendMode, false, true, false>, spanKernel <blendMode, false, true, true>,
+            spanKernel <blendMode, true, false, false>, spanKernel <blendMode, true, false, true>,
+            spanKernel <blendMode, true, true, false>, spanKernel <blendMode, true, true, true>
+        };
+    }
+
+    const std::array <std::array <Kernel, 8>, 5> kernels = {
+        kernelsForMode <0>(), kernelsForMode <1>(), kernelsForMode <2>(), kernelsForMode <3>(), kernelsForMode <BLEND_NONE>()
+    };
+}
+
+auto SpanKernels::select (u32 blendMode, bool dither, bool setMask, bool checkMask) -> Kernel {
+    return kernels[blendMode][(dither << 2) | (setMask << 1) | (u32) checkMask];
+}
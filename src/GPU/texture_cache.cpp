@@ -0,0 +1,131 @@
+#include <algorithm>
+#include "include/texture_cache.h"
+
+TextureCache::TextureCache (VRAM& _vram) : vram(_vram) {
+    for (auto& entry : entries)
+        entry.texels.resize (256 * 256);
+
+    setLayout (TexelLayout::Linear);
+}
+
+void TextureCache::setLayout (TexelLayout newLayout) {
+    layout = newLayout;
+
+    for (u32 i = 0; i < 256; i++) {
+        if (layout == TexelLayout::Linear) {
+            addressing.row[i] = i * 256;
+            addressing.column[i] = i;
+        } else { // 32 tiles per row of tiles, 64 texels per tile
+            addressing.row[i] = (i / 8) * (32 * 64) + (i % 8) * 8;
+            addressing.column[i] = (i / 8) * 64 + (i % 8);
+        }
+    }
+
+    for (auto& entry : entries) { // everything already decoded is in the old layout
+        entry.key = 0xFFFF'FFFF;
+        entry.validBands = 0;
+    }
+}
+
+auto TextureCache::makeKey (const DrawState& state) -> u32 {
+    auto key = (state.texpage_x / 64) | ((state.texpage_y / 256) << 4) | (state.texture_depth << 5);
+
+    if (state.texture_depth != 2) // 15bpp textures don't use a CLUT
+        key |= ((state.clut_x / 16) << 7) | (state.clut_y << 13);
+
+    return key;
+}
+
+auto TextureCache::sourceGeneration (VRAM& vram, const DrawState& state) -> u64 {
+    auto generation = vram.generation (state.texpage_x, state.texpage_y, pageWidth (state), 256);
+    if (clutWidth (state) != 0)
+        generation += vram.generation (state.clut_x, state.clut_y, clutWidth (state), 1);
+
+    return generation;
+}
+
+void TextureCache::decodeBand (Entry& entry, const DrawState& state, u32 band) {
+    std::array <u16, 256> clut;
+    auto clutRow = &vram.pixels[state.clut_y * WIDTH];
+    auto clutSize = (state.texture_depth == 0) ? 16 : 256;
+
+    if (state.texture_depth != 2) { // fetch the CLUT once for the whole band
+        for (auto i = 0; i < clutSize; i++)
+            clut[i] = clutRow[(state.clut_x + i) & 0x3FF];
+    }
+
+    for (u32 row = band * BAND_HEIGHT; row < (band + 1) * BAND_HEIGHT; row++) {
+        auto src = &vram.pixels[((state.texpage_y + row) & 0x1FF) * WIDTH];
+        auto dest = &entry.texels[addressing.row[row]];
+        const auto& column = addressing.column;
+
+        switch (state.texture_depth) {
+            case 0: // 4bpp, 4 texels per halfword
+                for (u32 u = 0; u < 256; u += 4) {
+                    auto indices = src[(state.texpage_x + u / 4) & 0x3FF];
+                    dest[column[u]] = clut[indices & 0xF];
+                    dest[column[u + 1]] = clut[(indices >> 4) & 0xF];
+                    dest[column[u + 2]] = clut[(indices >> 8) & 0xF];
+                    dest[column[u + 3]] = clut[indices >> 12];
+                }
+                break;
+
+            case 1: // 8bpp, 2 texels per halfword
+                for (u32 u = 0; u < 256; u += 2) {
+                    auto indices = src[(state.texpage_x + u / 2) & 0x3FF];
+                    dest[column[u]] = clut[indices & 0xFF];
+                    dest[column[u + 1]] = clut[indices >> 8];
+                }
+                break;
+
+            default: // 15bpp, texels are copied as is
+                for (u32 u = 0; u < 256; u++)
+                    dest[column[u]] = src[(state.texpage_x + u) & 0x3FF];
+                break;
+        }
+    }
+
+    entry.validBands |= 1 << band;
+}
+
+auto TextureCache::fetch (const DrawState& state, s32 vMin, s32 vMax) -> const u16* {
+    auto key = makeKey (state);
+    auto generation = sourceGeneration (vram, state);
+    Entry* entry = &entries[0];
+
+    for (auto& candidate : entries) { // find the entry for this page, or the least recently used one to evict
+        if (candidate.key == key) {
+            entry = &candidate;
+            break;
+        }
+
+        if (candidate.lastUsed < entry -> lastUsed)
+            entry = &candidate;
+    }
+
+    if (entry -> key != key || entry -> generation != generation) { // page not cached, or VRAM changed since it was decoded
+        entry -> key = key;
+        entry -> generation = generation;
+        entry -> validBands = 0;
+    }
+
+    entry -> lastUsed = ++useCounter;
+
+    u32 neededBands;
+    if (state.window_v_and != 0xFF || vMax - vMin >= 255) // the texture window can scatter rows all over the page, so decode it all
+        neededBands = 0xFFFF;
+
+    else {
+        neededBands = 0;
+        for (auto v = vMin; v <= vMax + (s32) BAND_HEIGHT; v += BAND_HEIGHT) // step through every band in [vMin, vMax], wrapping at 256
+            neededBands |= 1 << ((std::min (v, vMax) & 0xFF) / BAND_HEIGHT);
+    }
+
+    auto missingBands = neededBands & ~entry -> validBands;
+    for (u32 band = 0; missingBands != 0; band++, missingBands >>= 1) {
+        if (missingBands & 1)
+            decodeBand (*entry, state, band);
+    }
+
+    return entry -> texels.data();
+}
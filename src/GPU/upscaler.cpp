@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstring>
+#include "include/upscaler.h"
+#include "include/software_renderer.h"
+#include "include/helpers.h"
+
+Upscaler::Upscaler (VRAM& _vram, u32 scale) : vram(_vram), scaleShift(scale == 4 ? 2 : 1) {
+    if (scale != 2 && scale != 4)
+        Helpers::panic ("Unsupported resolution scale %u (expected 2 or 4)\n", scale);
+
+    target.resize ((WIDTH << scaleShift) * (HEIGHT << scaleShift));
+    syncedGenerations.fill (0xFFFF'FFFF); // the first sync copies all of VRAM
+    scaledVertices.reserve (VertexArena::VERTEX_CAPACITY);
+
+    const auto threads = std::clamp <u32> (std::thread::hardware_concurrency(), 1, MAX_THREADS); // hardware_concurrency is 0 if unknown
+    const auto rows = (s32) (HEIGHT << scaleShift);
+
+    for (u32 i = 0; i < threads; i++) {
+        Band band;
+        band.rasterizer = std::make_unique <Rasterizer> (vram, target.data(), scaleShift);
+        band.top = rows * (s32) i / (s32) threads;
+        band.bottom = rows * (s32) (i + 1) / (s32) threads - 1;
+        bands.push_back (std::move (band));
+    }
+
+    for (u32 i = 1; i < threads; i++)
+        workers.emplace_back (&Upscaler::workerLoop, this, i);
+}
+
+Upscaler::~Upscaler() {
+    {
+        std::lock_guard <std::mutex> lock (mutex);
+        quit = true;
+    }
+
+    workReady.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void Upscaler::setTextureLayout (TexelLayout layout) {
+    for (auto& band : bands)
+        band.rasterizer -> setTextureLayout (layout);
+}
+
+void Upscaler::newFrame() {
+    for (auto& band : bands)
+        band.rasterizer -> newFrame();
+}
+
+void Upscaler::copyBlock (u32 column, u32 row) {
+    const auto scale = 1u << scaleShift;
+    const auto targetWidth = WIDTH << scaleShift;
+    const auto x = column * VRAM::BLOCK_WIDTH;
+
+    for (u32 line = 0; line < VRAM::BLOCK_HEIGHT; line++) {
+        const auto y = row * VRAM::BLOCK_HEIGHT + line;
+        const auto src = &vram.pixels[y * WIDTH + x];
+        const auto dest = &target[(y << scaleShift) * targetWidth + (x << scaleShift)];
+
+        for (u32 i = 0; i < VRAM::BLOCK_WIDTH; i++)
+            std::fill_n (&dest[i << scaleShift], scale, src[i]);
+
+        for (u32 copy = 1; copy < scale; copy++) // the other rows of the scaled line are the same
+            std::memcpy (&dest[copy * targetWidth], dest, (VRAM::BLOCK_WIDTH << scaleShift) * sizeof(u16));
+    }
+}
+
+void Upscaler::sync() {
+    for (u32 i = 0; i < syncedGenerations.size(); i++) {
+        if (syncedGenerations[i] != vram.generations[i]) {
+            copyBlock (i % VRAM::BLOCKS_PER_ROW, i / VRAM::BLOCKS_PER_ROW);
+            syncedGenerations[i] = vram.generations[i];
+        }
+    }
+}
+
+void Upscaler::drawBand (Band& band, bool clipToBand) {
+    if (!clipToBand) {
+        SoftwareRenderer::rasterizeBatch (*band.rasterizer, scaledVertices.data(), scaledBatch);
+        return;
+    }
+
+    auto batch = scaledBatch;
+    batch.state.clip_top = std::max (batch.state.clip_top, band.top);
+    batch.state.clip_bottom = std::min (batch.state.clip_bottom, band.bottom);
+
+    if (batch.state.clip_top <= batch.state.clip_bottom) // skip bands the drawing area doesn't reach
+        SoftwareRenderer::rasterizeBatch (*band.rasterizer, scaledVertices.data(), batch);
+}
+
+void Upscaler::workerLoop (u32 index) {
+    u32 lastJob = 0;
+
+    while (true) {
+        {
+            std::unique_lock <std::mutex> lock (mutex);
+            workReady.wait (lock, [&] { return quit || job != lastJob; });
+            if (quit)
+                return;
+
+            lastJob = job;
+        }
+
+        drawBand (bands[index], true);
+
+        std::lock_guard <std::mutex> lock (mutex);
+        if (--busyWorkers == 0)
+            workDone.notify_one();
+    }
+}
+
+void Upscaler::draw (const RasterVertex* vertices, const Batch& batch) {
+    // Whatever changed in VRAM since the last sync was drawn by this batch, which is about to be drawn into the target as well
+    syncedGenerations = vram.generations;
+
+    const s32 scale = 1 << scaleShift;
+    const s32 center = batch.type == PrimitiveType::Line ? scale / 2 : 0; // lines are drawn thick, around the middle of each pixel's square
+    const auto src = &vertices[batch.firstVertex];
+    scaledVertices.resize (batch.vertexCount);
+
+    for (u32 i = 0; i < batch.vertexCount; i++) { // this also scales up the size of rectangles, which is stored in their 2nd vertex
+        scaledVertices[i] = src[i];
+        scaledVertices[i].x = src[i].x * scale + center;
+        scaledVertices[i].y = src[i].y * scale + center;
+    }
+
+    scaledBatch = batch;
+    scaledBatch.firstVertex = 0;
+
+    auto& state = scaledBatch.state;
+    state.clip_left *= scale;
+    state.clip_top *= scale;
+    state.clip_right = (state.clip_right + 1) * scale - 1;
+    state.clip_bottom = (state.clip_bottom + 1) * scale - 1;
+
+    if (workers.empty() || batch.vertexCount / verticesPerPrimitive (batch.type) < PARALLEL_MIN_PRIMITIVES) {
+        drawBand (bands[0], false);
+        return;
+    }
+
+    {
+        std::lock_guard <std::mutex> lock (mutex);
+        busyWorkers = (u32) workers.size();
+        job++;
+    }
+
+    workReady.notify_all();
+    drawBand (bands[0], true);
+
+    std::unique_lock <std::mutex> lock (mutex);
+    workDone.wait (lock, [&] { return busyWorkers == 0; });
+}
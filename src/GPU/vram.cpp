@@ -1,15 +1,143 @@
-#include "include/renderer.h"
-const auto WIDTH = 1024;
-const auto HEIGHT = 512;
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include "include/vram.h"
+#include "include/simd.h"
 
 VRAM::VRAM () {
     pixels.resize (WIDTH * HEIGHT);
+    generations.fill (0);
 }
 
-u32 VRAM::getPixel24bit(int x, int y) {
+u16 VRAM::getPixel(int x, int y) {
     return pixels[x + y * WIDTH];
 }
 
-void VRAM::setPixel(int x, int y, u32 color) {
+u32 VRAM::getPixel24bit(int x, int y) { // in 24bpp mode, pixels are packed as 3 bytes each, crossing halfword boundaries
+    auto bytes = (u8*) &pixels[y * WIDTH];
+    auto offset = (x * 3) & 0x7FF; // wrap inside the row
+
+    u32 b0 = bytes[offset];
+    u32 b1 = bytes[(offset + 1) & 0x7FF];
+    u32 b2 = bytes[(offset + 2) & 0x7FF];
+    return b0 | (b1 << 8) | (b2 << 16);
+}
+
+void VRAM::setPixel(int x, int y, u16 color) {
     pixels[x + y * WIDTH] = color;
 }
+
+void VRAM::copyRect (u32 srcX, u32 srcY, u32 destX, u32 destY, u32 width, u32 height, u16 setMask, bool checkMask) {
+    const bool wrapsHorizontally = (srcX + width > WIDTH) || (destX + width > WIDTH);
+    const bool fastPath = !wrapsHorizontally && setMask == 0 && !checkMask; // plain row moves, no per-pixel work
+    std::array <u16, WIDTH> row; // staging buffer for rows that need per-pixel handling
+
+    markDirty (destX, destY, width, height);
+
+    // If the destination is below the source, copy from the bottom row up so that we don't overwrite rows we haven't read yet
+    const bool bottomUp = destY > srcY;
+
+    for (u32 i = 0; i < height; i++) {
+        auto line = bottomUp ? (height - 1 - i) : i;
+        auto srcRow = &pixels[((srcY + line) & 0x1FF) * WIDTH];
+        auto destRow = &pixels[((destY + line) & 0x1FF) * WIDTH];
+
+        if (fastPath) {
+            std::memmove (&destRow[destX], &srcRow[srcX], width * sizeof(u16));
+            continue;
+        }
+
+        for (u32 x = 0; x < width; x++) // read the whole row first, so that overlapping copies behave like memmove
+            row[x] = srcRow[(srcX + x) & 0x3FF];
+
+        for (u32 x = 0; x < width; x++) {
+            auto& pixel = destRow[(destX + x) & 0x3FF];
+            if (checkMask && (pixel & 0x8000)) // don't draw over masked pixels
+                continue;
+
+            pixel = row[x] | setMask;
+        }
+    }
+}
+
+void VRAM::readRect (u32 x, u32 y, u32 width, u32 height, std::vector <u32>& dest) {
+    auto size = width * height;
+    dest.resize ((size + 1) >> 1); // 2 pixels per word, round up
+    auto output = (u16*) dest.data();
+    if (size & 1) // zero the padding halfword if the pixel count is odd
+        output[size] = 0;
+
+    for (u32 line = 0; line < height; line++) {
+        auto srcRow = &pixels[((y + line) & 0x1FF) * WIDTH];
+
+        if (x + width <= WIDTH) // the row does not wrap around, copy it in one go
+            std::memcpy (output, &srcRow[x], width * sizeof(u16));
+        else {
+            for (u32 i = 0; i < width; i++)
+                output[i] = srcRow[(x + i) & 0x3FF];
+        }
+
+        output += width;
+    }
+}
+
+void VRAM::markDirty (u32 x, u32 y, u32 width, u32 height) {
+    auto firstColumn = (x & 0x3FF) / BLOCK_WIDTH;
+    auto firstRow = (y & 0x1FF) / BLOCK_HEIGHT;
+    auto columns = std::min <u32> (((x % BLOCK_WIDTH) + width - 1) / BLOCK_WIDTH + 1, BLOCKS_PER_ROW);
+    auto rows = std::min <u32> (((y % BLOCK_HEIGHT) + height - 1) / BLOCK_HEIGHT + 1, BLOCKS_PER_COLUMN);
+
+    for (u32 row = 0; row < rows; row++) {
+        auto base = ((firstRow + row) % BLOCKS_PER_COLUMN) * BLOCKS_PER_ROW;
+        for (u32 column = 0; column < columns; column++)
+            generations[base + (firstColumn + column) % BLOCKS_PER_ROW]++;
+    }
+}
+
+auto VRAM::generation (u32 x, u32 y, u32 width, u32 height) -> u64 {
+    auto firstColumn = (x & 0x3FF) / BLOCK_WIDTH;
+    auto firstRow = (y & 0x1FF) / BLOCK_HEIGHT;
+    auto columns = std::min <u32> (((x % BLOCK_WIDTH) + width - 1) / BLOCK_WIDTH + 1, BLOCKS_PER_ROW);
+    auto rows = std::min <u32> (((y % BLOCK_HEIGHT) + height - 1) / BLOCK_HEIGHT + 1, BLOCKS_PER_COLUMN);
+    u64 sum = 0;
+
+    for (u32 row = 0; row < rows; row++) {
+        auto base = ((firstRow + row) % BLOCKS_PER_COLUMN) * BLOCKS_PER_ROW;
+        for (u32 column = 0; column < columns; column++)
+            sum += generations[base + (firstColumn + column) % BLOCKS_PER_ROW];
+    }
+
+    return sum;
+}
+
+void VRAM::fillSpan (u16* dest, u32 count, u16 color) {
+    u32 i = 0;
+
+#ifdef PSX_SSE2
+    const auto colors = _mm_set1_epi16 ((s16) color);
+    for (; i < count && ((uintptr_t) &dest[i] & 15) != 0; i++) // store single pixels until we're 16-byte aligned
+        dest[i] = color;
+
+    for (; i + 8 <= count; i += 8)
+        _mm_store_si128 ((__m128i*) &dest[i], colors);
+#endif
+
+    for (; i < count; i++)
+        dest[i] = color;
+}
+
+void VRAM::fillRect (u32 x, u32 y, u32 width, u32 height, u16 color) {
+    markDirty (x, y, width, height);
+
+    // split the rectangle at the right edge of VRAM if it wraps around
+    const auto firstWidth = std::min <u32> (width, WIDTH - x);
+    const auto secondWidth = width - firstWidth;
+
+    for (u32 line = 0; line < height; line++) {
+        auto row = &pixels[((y + line) & 0x1FF) * WIDTH];
+        fillSpan (&row[x], firstWidth, color);
+
+        if (secondWidth != 0)
+            fillSpan (row, secondWidth, color);
+    }
+}
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include "include/window_renderer.h"
+
+BeegRenderer::BeegRenderer (VRAM& _vram, int width, int height, std::string title, u32 _scale, bool _downsample) :
+    SoftwareRenderer (_vram, _scale),
+    context_settings (0, 0, 0, 1, 1, sf::ContextSettings::Attribute::Default, true),
+    window (sf::VideoMode(width, height), title.c_str(), sf::Style::Default, context_settings),
+    scale (_scale), downsample (_downsample) {
+
+    window.clear(); // init color to 0xDEADBEFF;
+    poll_events();
+    window.display();
+
+    surface.create (WIDTH * scale, HEIGHT * scale);
+    surface.setSmooth (scale != 1); // filter the scaled target when it's shrunk down to the window
+    staging.resize (WIDTH * VRAM::BLOCK_HEIGHT * scale * scale); // the biggest upload is a full row of blocks
+    presentedGenerations.fill (0xFFFF'FFFF); // nothing has been uploaded yet
+}
+
+void BeegRenderer::poll_events() {
+    sf::Event event;
+
+    while (window.pollEvent(event)) {
+        switch (event.type) {
+            case sf::Event::Closed: close(); break;
+            case sf::Event::Resized: redraw = true; break;
+            // if you want to handle other events, add the code here
+        }
+    }
+}
+
+void BeegRenderer::uploadRect (u32 x, u32 y, u32 width, u32 height) {
+    if (!upscaler) {
+        for (u32 line = 0; line < height; line++)
+            Display::convert15ToRGBA (&vram.pixels[(y + line) * WIDTH + x], &staging[line * width], width);
+
+        surface.update ((u8*) staging.data(), width, height, x, y);
+        return;
+    }
+
+    // The scaled target changes in step with VRAM, so VRAM's generations say which parts of it are stale too
+    x *= scale; y *= scale; width *= scale; height *= scale;
+    for (u32 line = 0; line < height; line++)
+        Display::convert15ToRGBA (&upscaler -> pixels()[(y + line) * WIDTH * scale + x], &staging[line * width], width);
+
+    surface.update ((u8*) staging.data(), width, height, x, y);
+}
+
+void BeegRenderer::uploadDirtyBlocks (const DisplayArea& area) {
+    const auto firstColumn = area.x / VRAM::BLOCK_WIDTH;
+    const auto lastColumn = (area.x + area.width - 1) / VRAM::BLOCK_WIDTH;
+    const auto firstRow = area.y / VRAM::BLOCK_HEIGHT;
+    const auto lastRow = (area.y + area.height - 1) / VRAM::BLOCK_HEIGHT;
+
+    // Whole blocks are uploaded, even the ones that stick out of the display area, so a block is either fully up to date or stale
+    // Runs of stale blocks in the same row are merged into one upload
+    for (auto row = firstRow; row <= lastRow; row++) {
+        const auto base = row * VRAM::BLOCKS_PER_ROW;
+        auto column = firstColumn;
+
+        while (column <= lastColumn) {
+            if (presentedGenerations[base + column] == vram.generations[base + column]) {
+                column++;
+                continue;
+            }
+
+            const auto runStart = column;
+            while (column <= lastColumn && presentedGenerations[base + column] != vram.generations[base + column]) {
+                presentedGenerations[base + column] = vram.generations[base + column];
+                column++;
+            }
+
+            uploadRect (runStart * VRAM::BLOCK_WIDTH, row * VRAM::BLOCK_HEIGHT, (column - runStart) * VRAM::BLOCK_WIDTH, VRAM::BLOCK_HEIGHT);
+            redraw = true;
+        }
+    }
+}
+
+void BeegRenderer::updateExtractedFrame (const DisplayArea& area) {
+    const auto generation = vram.generation (area.x, area.y, area.vramWidth(), area.height);
+    if (!redraw && generation == extractedGeneration) // redraw is already set if the display area changed
+        return;
+
+    if (extractedWidth != area.width || extractedHeight != area.height) {
+        extracted.create (area.width, area.height);
+        extractedWidth = area.width;
+        extractedHeight = area.height;
+    }
+
+    if (area.is24bit)
+        Display::extract (vram, area, Display::PixelFormat::RGBA8888, extractedPixels);
+    else
+        Display::extractScaled (upscaler -> pixels(), scale, area, Display::PixelFormat::RGBA8888, true, extractedPixels);
+
+    extracted.update (extractedPixels.data(), area.width, area.height, 0, 0);
+    extractedGeneration = generation;
+    redraw = true;
+}
+
+void BeegRenderer::present (const DisplayArea& area) {
+    poll_events();
+
+    if (!(area == lastDisplayArea)) {
+        lastDisplayArea = area;
+        redraw = true;
+    }
+
+    const bool visible = area.width != 0 && area.height != 0;
+    if (visible) {
+        if (extracts (area))
+            updateExtractedFrame (area);
+        else
+            uploadDirtyBlocks (area);
+    }
+
+    if (!redraw) // nothing on screen changed, leave the window as it is
+        return;
+
+    window.clear();
+    if (visible) { // a disabled display is just black
+        if (extracts (area))
+            window.draw (sf::Sprite (extracted, sf::IntRect (0, 0, area.width, area.height)));
+
+        else {
+            sf::Sprite sprite (surface, sf::IntRect (area.x * scale, area.y * scale, area.width * scale, area.height * scale));
+            sprite.setScale (1.f / scale, 1.f / scale);
+            window.draw (sprite);
+        }
+    }
+
+    window.display();
+    redraw = false;
+}
@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <cstring>
+#include "include/spu.h"
+#include "include/simd.h"
+
+namespace {
+    auto clamp16 (s32 value) -> s16 {
+        return (s16) std::clamp (value, -0x8000, 0x7FFF);
+    }
+
+    // dest[i] = sum of (taps[j][i] * volumes[j]) >> 15 over the 4 comb taps
+    void combine (const s16* const* taps, const s16* volumes, s16* dest, u32 count) {
+        u32 i = 0;
+#if defined(PSX_SSE2)
+        for (; i + 8 <= count; i += 8) {
+            auto sumLow = _mm_setzero_si128();
+            auto sumHigh = _mm_setzero_si128();
+
+            for (int tap = 0; tap < 4; tap++) {
+                __m128i low, high;
+                mulShift15 (_mm_loadu_si128 ((const __m128i*) &taps[tap][i]), _mm_set1_epi16 (volumes[tap]), low, high);
+                sumLow = _mm_add_epi32 (sumLow, low);
+                sumHigh = _mm_add_epi32 (sumHigh, high);
+            }
+
+            _mm_storeu_si128 ((__m128i*) &dest[i], _mm_packs_epi32 (sumLow, sumHigh));
+        }
+#endif
+        for (; i < count; i++) {
+            s32 sum = 0;
+            for (int tap = 0; tap < 4; tap++)
+                sum += (taps[tap][i] * volumes[tap]) >> 15;
+            dest[i] = clamp16 (sum);
+        }
+    }
+
+    // stored[i] = input[i] - delayed[i] * volume, the value the all-pass writes back to the buffer, and
+    // out[i] = stored[i] * volume + delayed[i]. out can be input
+    void allPass (const s16* input, const s16* delayed, s16 volume, s16* stored, s16* out, u32 count) {
+        u32 i = 0;
+#if defined(PSX_SSE2)
+        const auto volumes = _mm_set1_epi16 (volume);
+
+        for (; i + 8 <= count; i += 8) {
+            const auto in = _mm_loadu_si128 ((const __m128i*) &input[i]);
+            const auto delay = _mm_loadu_si128 ((const __m128i*) &delayed[i]);
+            __m128i low, high;
+
+            mulShift15 (delay, volumes, low, high);
+            const auto inLow = _mm_srai_epi32 (_mm_unpacklo_epi16 (in, in), 16); // sign extend to 32 bits
+            const auto inHigh = _mm_srai_epi32 (_mm_unpackhi_epi16 (in, in), 16);
+            const auto store = _mm_packs_epi32 (_mm_sub_epi32 (inLow, low), _mm_sub_epi32 (inHigh, high));
+            _mm_storeu_si128 ((__m128i*) &stored[i], store);
+
+            mulShift15 (store, volumes, low, high);
+            const auto delayLow = _mm_srai_epi32 (_mm_unpacklo_epi16 (delay, delay), 16);
+            const auto delayHigh = _mm_srai_epi32 (_mm_unpackhi_epi16 (delay, delay), 16);
+            _mm_storeu_si128 ((__m128i*) &out[i], _mm_packs_epi32 (_mm_add_epi32 (low, delayLow), _mm_add_epi32 (high, delayHigh)));
+        }
+#endif
+        for (; i < count; i++) {
+            const auto store = clamp16 (input[i] - ((delayed[i] * volume) >> 15));
+            const auto delay = delayed[i];
+            stored[i] = store;
+            out[i] = clamp16 (((store * volume) >> 15) + delay);
+        }
+    }
+}
+
+auto SPU::reverbAddressOf (s32 offset) const -> u32 {
+    const auto size = (s64) (RAM_SIZE - reverbBase);
+    auto relative = ((s64) reverbAddress - reverbBase + offset) % size;
+    if (relative < 0)
+        relative += size;
+
+    return reverbBase + (u32) relative;
+}
+
+auto SPU::readReverb (s32 offset) const -> s16 {
+    s16 value;
+    std::memcpy (&value, &RAM[reverbAddressOf (offset)], sizeof (s16));
+    return value;
+}
+
+void SPU::writeReverb (s32 offset, s16 value) {
+    if (control & 0x80)
+        std::memcpy (&RAM[reverbAddressOf (offset)], &value, sizeof (s16));
+}
+
+void SPU::readReverbRun (s32 offset, u32 count, s16* dest) const {
+    auto address = reverbAddressOf (offset);
+    for (u32 done = 0; done < count; address = reverbBase) { // wrap back to the start of the work area
+        const auto length = std::min (count - done, (RAM_SIZE - address) / 2);
+        std::memcpy (&dest[done], &RAM[address], length * sizeof (s16));
+        done += length;
+    }
+}
+
+void SPU::writeReverbRun (s32 offset, u32 count, const s16* src) {
+    if (!(control & 0x80))
+        return;
+
+    auto address = reverbAddressOf (offset);
+    for (u32 done = 0; done < count; address = reverbBase) {
+        const auto length = std::min (count - done, (RAM_SIZE - address) / 2);
+        std::memcpy (&RAM[address], &src[done], length * sizeof (s16));
+        done += length;
+    }
+}
+
+// Runs the reverb on every other sample, and holds each output for 2 samples
+void SPU::processReverb (const s32* inLeft, const s32* inRight, s16* outLeft, s16* outRight, u32 count) {
+    s16 tickInLeft[REVERB_BLOCK_TICKS], tickInRight[REVERB_BLOCK_TICKS];
+    s16 tickOutLeft[REVERB_BLOCK_TICKS], tickOutRight[REVERB_BLOCK_TICKS];
+    u32 tickSamples[REVERB_BLOCK_TICKS];
+    u32 ticks = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        reverbPhase = !reverbPhase;
+        if (reverbPhase) {
+            tickSamples[ticks] = i;
+            tickInLeft[ticks] = clamp16 (inLeft[i]);
+            tickInRight[ticks] = clamp16 (inRight[i]);
+            ticks++;
+        }
+    }
+
+    if (reverbScheduleDirty)
+        updateReverbSchedule();
+
+    for (u32 done = 0; done < ticks;) {
+        if (reverbReference || reverbBlockTicks == 0) {
+            reverbStep (tickInLeft[done], tickInRight[done], tickOutLeft[done], tickOutRight[done]);
+            done++;
+        }
+
+        else {
+            const auto length = std::min (ticks - done, reverbBlockTicks);
+            reverbBlock (&tickInLeft[done], &tickInRight[done], &tickOutLeft[done], &tickOutRight[done], length);
+            done += length;
+        }
+    }
+
+    for (u32 i = 0, tick = 0; i < count; i++) {
+        if (tick < ticks && tickSamples[tick] == i) {
+            reverbOutLeft = tickOutLeft[tick];
+            reverbOutRight = tickOutRight[tick];
+            tick++;
+        }
+
+        outLeft[i] = reverbOutLeft;
+        outRight[i] = reverbOutRight;
+    }
+}
+
+// Same side (L->L, R->R) and different side (R->L, L->R) reflections. Each is an IIR: the input plus a "wall" tap of the work
+// area, low passed against what the filter wrote to the buffer the tick before. Each one writes its result before the next one
+// reads, in psx-spx order, so a layout where one reflection's output is another's wall or previous sample sees the new value
+void SPU::reverbReflect (s16 inLeft, s16 inRight) {
+    const auto left = (inLeft * (s16) reverbRegister (vLIN)) >> 15;
+    const auto right = (inRight * (s16) reverbRegister (vRIN)) >> 15;
+
+    const auto reflect = [this] (s32 input, ReverbRegister wall, ReverbRegister target) {
+        const s32 previous = readReverb (reverbRegister (target) * 8 - 2);
+        const auto x = clamp16 (input + ((readReverb (reverbRegister (wall) * 8) * (s16) reverbRegister (vWALL)) >> 15) - previous);
+        writeReverb (reverbRegister (target) * 8, clamp16 (((x * (s16) reverbRegister (vIIR)) >> 15) + previous));
+    };
+
+    reflect (left, dLSAME, mLSAME);
+    reflect (right, dRSAME, mRSAME);
+    reflect (left, dRDIFF, mLDIFF);
+    reflect (right, dLDIFF, mRDIFF);
+}
+
+void SPU::reverbStep (s16 inLeft, s16 inRight, s16& outLeft, s16& outRight) {
+    const auto at = [this] (ReverbRegister reg) { return (s32) reverbRegister (reg) * 8; };
+    const auto volume = [this] (ReverbRegister reg) { return (s32) (s16) reverbRegister (reg); };
+
+    reverbReflect (inLeft, inRight);
+
+    // Early echo: comb filters over 4 taps of the work area
+    const auto comb = [&] (ReverbRegister tap1, ReverbRegister tap2, ReverbRegister tap3, ReverbRegister tap4) -> s16 {
+        return clamp16 (((readReverb (at (tap1)) * volume (vCOMB1)) >> 15) + ((readReverb (at (tap2)) * volume (vCOMB2)) >> 15) +
+                        ((readReverb (at (tap3)) * volume (vCOMB3)) >> 15) + ((readReverb (at (tap4)) * volume (vCOMB4)) >> 15));
+    };
+
+    // Late reverb: 2 all-pass filters in a row, each with its own delay line in the work area
+    const auto allPass = [&] (s16 input, ReverbRegister target, ReverbRegister delay, ReverbRegister gain) -> s16 {
+        const s32 delayed = readReverb (at (target) - at (delay));
+        const auto stored = clamp16 (input - ((delayed * volume (gain)) >> 15));
+        writeReverb (at (target), stored);
+        return clamp16 (((stored * volume (gain)) >> 15) + delayed);
+    };
+
+    auto left = comb (mLCOMB1, mLCOMB2, mLCOMB3, mLCOMB4);
+    auto right = comb (mRCOMB1, mRCOMB2, mRCOMB3, mRCOMB4);
+    left = allPass (left, mLAPF1, dAPF1, vAPF1);
+    right = allPass (right, mRAPF1, dAPF1, vAPF1);
+    left = allPass (left, mLAPF2, dAPF2, vAPF2);
+    right = allPass (right, mRAPF2, dAPF2, vAPF2);
+
+    outLeft = left;
+    outRight = right;
+    reverbAddress = reverbAddressOf (2);
+}
+
+// The same as running reverbStep for every tick, but stage by stage: first the reads reverbEarlyReads picks, then the reflections
+// tick by tick (they're IIRs, so they can't go any other way), then the combs and all-passes over all ticks at once.
+// Every access moves up a halfword per tick, so over a block each one covers a contiguous run of the work area
+void SPU::reverbBlock (const s16* inLeft, const s16* inRight, s16* outLeft, s16* outRight, u32 ticks) {
+    const auto at = [this] (ReverbRegister reg) { return (s32) reverbRegister (reg) * 8; };
+    const auto volume = [this] (ReverbRegister reg) { return (s16) reverbRegister (reg); };
+
+    // The comb taps and all-pass delay lines, in reverbEarlyReads bit order
+    const s32 readOffsets[12] = {
+        at (mLCOMB1), at (mLCOMB2), at (mLCOMB3), at (mLCOMB4), at (mRCOMB1), at (mRCOMB2), at (mRCOMB3), at (mRCOMB4),
+        at (mLAPF1) - at (dAPF1), at (mRAPF1) - at (dAPF1), at (mLAPF2) - at (dAPF2), at (mRAPF2) - at (dAPF2)
+    };
+    s16 reads[12][REVERB_BLOCK_TICKS];
+    const auto read = [&] (u32 index, bool early) {
+        if (((reverbEarlyReads >> index) & 1) == early)
+            readReverbRun (readOffsets[index], ticks, reads[index]);
+    };
+
+    for (u32 index = 0; index < 12; index++)
+        read (index, true);
+
+    const auto start = reverbAddress;
+    for (u32 tick = 0; tick < ticks; tick++) {
+        reverbReflect (inLeft[tick], inRight[tick]);
+        reverbAddress = reverbAddressOf (2);
+    }
+    reverbAddress = start;
+
+    for (u32 index = 0; index < 8; index++)
+        read (index, false);
+
+    const s16 combVolumes[4] = { volume (vCOMB1), volume (vCOMB2), volume (vCOMB3), volume (vCOMB4) };
+    const s16* leftTaps[4] = { reads[0], reads[1], reads[2], reads[3] };
+    const s16* rightTaps[4] = { reads[4], reads[5], reads[6], reads[7] };
+    combine (leftTaps, combVolumes, outLeft, ticks);
+    combine (rightTaps, combVolumes, outRight, ticks);
+
+    s16 stored[REVERB_BLOCK_TICKS];
+    const auto allPassStage = [&] (u32 index, s16* samples, ReverbRegister target, ReverbRegister gain) {
+        read (index, false);
+        allPass (samples, reads[index], volume (gain), stored, samples, ticks);
+        writeReverbRun (at (target), ticks, stored);
+    };
+
+    allPassStage (8, outLeft, mLAPF1, vAPF1);
+    allPassStage (9, outRight, mRAPF1, vAPF1);
+    allPassStage (10, outLeft, mLAPF2, vAPF2);
+    allPassStage (11, outRight, mRAPF2, vAPF2);
+
+    reverbAddress = reverbAddressOf (ticks * 2);
+}
+
+// reverbBlock reorders accesses: within a block, a stage runs for every tick before the next stage starts. That only changes
+// the result if a write and another access to the same address end up on the other side of each other. Access A at tick t hits
+// the address access B hits at tick t + k, for k in a fixed residue class, so for every write and every other access we find the
+// nearest k at which their order flips, and keep blocks shorter than that. Comb and all-pass reads can also go in front of the
+// reflections, for when a reflection writes their address a few ticks after they read it (the stock presets do that)
+void SPU::updateReverbSchedule() {
+    enum Stage : u32 { // in the order reverbBlock runs them
+        Early, Reflections, Combs, LeftAPF1Read, LeftAPF1Write, RightAPF1Read, RightAPF1Write,
+        LeftAPF2Read, LeftAPF2Write, RightAPF2Read, RightAPF2Write
+    };
+
+    struct Access {
+        s32 offset; // bytes from the buffer address
+        bool write;
+        Stage stage;
+        s32 earlyBit; // reverbEarlyReads bit for reads that can move to Early, -1 for the rest
+    };
+
+    const auto at = [this] (ReverbRegister reg) { return (s32) reverbRegister (reg) * 8; };
+
+    // Every access of a tick, in the order reverbStep does them
+    const Access accesses[] = {
+        { at (mLSAME) - 2, false, Reflections, -1 }, { at (dLSAME), false, Reflections, -1 }, { at (mLSAME), true, Reflections, -1 },
+        { at (mRSAME) - 2, false, Reflections, -1 }, { at (dRSAME), false, Reflections, -1 }, { at (mRSAME), true, Reflections, -1 },
+        { at (mLDIFF) - 2, false, Reflections, -1 }, { at (dRDIFF), false, Reflections, -1 }, { at (mLDIFF), true, Reflections, -1 },
+        { at (mRDIFF) - 2, false, Reflections, -1 }, { at (dLDIFF), false, Reflections, -1 }, { at (mRDIFF), true, Reflections, -1 },
+
+        { at (mLCOMB1), false, Combs, 0 }, { at (mLCOMB2), false, Combs, 1 }, { at (mLCOMB3), false, Combs, 2 }, { at (mLCOMB4), false, Combs, 3 },
+        { at (mRCOMB1), false, Combs, 4 }, { at (mRCOMB2), false, Combs, 5 }, { at (mRCOMB3), false, Combs, 6 }, { at (mRCOMB4), false, Combs, 7 },
+
+        { at (mLAPF1) - at (dAPF1), false, LeftAPF1Read, 8 }, { at (mLAPF1), true, LeftAPF1Write, -1 },
+        { at (mRAPF1) - at (dAPF1), false, RightAPF1Read, 9 }, { at (mRAPF1), true, RightAPF1Write, -1 },
+        { at (mLAPF2) - at (dAPF2), false, LeftAPF2Read, 10 }, { at (mLAPF2), true, LeftAPF2Write, -1 },
+        { at (mRAPF2) - at (dAPF2), false, RightAPF2Read, 11 }, { at (mRAPF2), true, RightAPF2Write, -1 }
+    };
+    constexpr auto count = sizeof (accesses) / sizeof (accesses[0]);
+    constexpr s64 unlimited = REVERB_BLOCK_TICKS;
+    const auto halfwords = (s64) (RAM_SIZE - reverbBase) / 2;
+
+    // The longest block that keeps first (which comes before second within a tick) and second in order, if they run in these stages
+    const auto limit = [halfwords] (const Access& first, Stage firstStage, const Access& second, Stage secondStage) -> s64 {
+        if ((!first.write && !second.write) || firstStage == secondStage) // the reflections keep their order, they run tick by tick
+            return unlimited;
+
+        // first at tick t + k and second at tick t hit the same address
+        const auto k = (((second.offset - first.offset) / 2) % halfwords + halfwords) % halfwords;
+
+        if (firstStage < secondStage) // first runs for the whole block first, so it mustn't get to second's address at a later tick
+            return k > 0 ? k : halfwords;
+        else // second runs first, so it mustn't get to first's address at the same or a later tick
+            return k > 0 ? halfwords - k : 0;
+    };
+
+    auto ticks = unlimited;
+    reverbEarlyReads = 0;
+
+    if (control & 0x80) { // with writes off there's nothing to clash
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = i + 1; j < count; j++) {
+                if (accesses[i].earlyBit < 0 && accesses[j].earlyBit < 0)
+                    ticks = std::min (ticks, limit (accesses[i], accesses[i].stage, accesses[j], accesses[j].stage));
+            }
+        }
+
+        for (size_t i = 0; i < count; i++) { // movable reads only clash with writes, and none of those can move
+            const auto& read = accesses[i];
+            if (read.earlyBit < 0)
+                continue;
+
+            auto early = unlimited, late = unlimited;
+            for (size_t j = 0; j < count; j++) {
+                const auto& other = accesses[j];
+                if (!other.write)
+                    continue;
+
+                if (j < i) {
+                    early = std::min (early, limit (other, other.stage, read, Early));
+                    late = std::min (late, limit (other, other.stage, read, read.stage));
+                } else {
+                    early = std::min (early, limit (read, Early, other, other.stage));
+                    late = std::min (late, limit (read, read.stage, other, other.stage));
+                }
+            }
+
+            if (early > late)
+                reverbEarlyReads |= 1 << read.earlyBit;
+            ticks = std::min (ticks, std::max (early, late));
+        }
+    }
+
+    reverbBlockTicks = (u32) ticks;
+    reverbScheduleDirty = false;
+}
@@ -0,0 +1,633 @@
+#include <algorithm>
+#include <cstring>
+#include "include/spu.h"
+#include "include/helpers.h"
+#include "include/simd.h"
+
+namespace {
+    constexpr s32 POSITIVE_WEIGHTS[5] = { 0, 60, 115, 98, 122 }; // prediction filters, in 64ths
+    constexpr s32 NEGATIVE_WEIGHTS[5] = { 0, 0, -52, -55, -60 };
+
+    // Gaussian interpolation table, from psx-spx. Every output sample is the sum of 4 ADPCM samples weighted by
+    // GAUSS[0xFF - i], GAUSS[0x1FF - i], GAUSS[0x100 + i] and GAUSS[i] (oldest first), where i is the interpolation point
+    constexpr s16 GAUSS[512] = {
+        -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001,
+        0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0001, 0x0001, 0x0001, 0x0001, 0x0002, 0x0002, 0x0002, 0x0003, 0x0003,
+        0x0003, 0x0004, 0x0004, 0x0005, 0x0005, 0x0006, 0x0007, 0x0007, 0x0008, 0x0009, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E,
+        0x000F, 0x0010, 0x0011, 0x0012, 0x0013, 0x0015, 0x0016, 0x0018, 0x0019, 0x001B, 0x001C, 0x001E, 0x0020, 0x0021, 0x0023, 0x0025,
+        0x0027, 0x0029, 0x002C, 0x002E, 0x0030, 0x0033, 0x0035, 0x0038, 0x003A, 0x003D, 0x0040, 0x0043, 0x0046, 0x0049, 0x004D, 0x0050,
+        0x0054, 0x0057, 0x005B, 0x005F, 0x0063, 0x0067, 0x006B, 0x006F, 0x0074, 0x0078, 0x007D, 0x0082, 0x0087, 0x008C, 0x0091, 0x0096,
+        0x009C, 0x00A1, 0x00A7, 0x00AD, 0x00B3, 0x00BA, 0x00C0, 0x00C7, 0x00CD, 0x00D4, 0x00DB, 0x00E3, 0x00EA, 0x00F2, 0x00FA, 0x0101,
+        0x010A, 0x0112, 0x011B, 0x0123, 0x012C, 0x0135, 0x013F, 0x0148, 0x0152, 0x015C, 0x0166, 0x0171, 0x017B, 0x0186, 0x0191, 0x019C,
+        0x01A8, 0x01B4, 0x01C0, 0x01CC, 0x01D9, 0x01E5, 0x01F2, 0x0200, 0x020D, 0x021B, 0x0229, 0x0237, 0x0246, 0x0255, 0x0264, 0x0273,
+        0x0283, 0x0293, 0x02A3, 0x02B4, 0x02C4, 0x02D6, 0x02E7, 0x02F9, 0x030B, 0x031D, 0x0330, 0x0343, 0x0356, 0x036A, 0x037E, 0x0392,
+        0x03A7, 0x03BC, 0x03D1, 0x03E7, 0x03FC, 0x0413, 0x042A, 0x0441, 0x0458, 0x0470, 0x0488, 0x04A0, 0x04B9, 0x04D2, 0x04EC, 0x0506,
+        0x0520, 0x053B, 0x0556, 0x0572, 0x058E, 0x05AA, 0x05C7, 0x05E4, 0x0601, 0x061F, 0x063E, 0x065C, 0x067C, 0x069B, 0x06BB, 0x06DC,
+        0x06FD, 0x071E, 0x0740, 0x0762, 0x0784, 0x07A7, 0x07CB, 0x07EF, 0x0813, 0x0838, 0x085D, 0x0883, 0x08A9, 0x08D0, 0x08F7, 0x091E,
+        0x0946, 0x096F, 0x0998, 0x09C1, 0x09EB, 0x0A16, 0x0A40, 0x0A6C, 0x0A98, 0x0AC4, 0x0AF1, 0x0B1E, 0x0B4C, 0x0B7A, 0x0BA9, 0x0BD8,
+        0x0C07, 0x0C38, 0x0C68, 0x0C99, 0x0CCB, 0x0CFD, 0x0D30, 0x0D63, 0x0D97, 0x0DCB, 0x0E00, 0x0E35, 0x0E6B, 0x0EA1, 0x0ED7, 0x0F0F,
+        0x0F46, 0x0F7F, 0x0FB7, 0x0FF1, 0x102A, 0x1065, 0x109F, 0x10DB, 0x1116, 0x1153, 0x118F, 0x11CD, 0x120B, 0x1249, 0x1288, 0x12C7,
+        0x1307, 0x1347, 0x1388, 0x13C9, 0x140B, 0x144D, 0x1490, 0x14D4, 0x1517, 0x155C, 0x15A0, 0x15E6, 0x162C, 0x1672, 0x16B9, 0x1700,
+        0x1747, 0x1790, 0x17D8, 0x1821, 0x186B, 0x18B5, 0x1900, 0x194B, 0x1996, 0x19E2, 0x1A2E, 0x1A7B, 0x1AC8, 0x1B16, 0x1B64, 0x1BB3,
+        0x1C02, 0x1C51, 0x1CA1, 0x1CF1, 0x1D42, 0x1D93, 0x1DE5, 0x1E37, 0x1E89, 0x1EDC, 0x1F2F, 0x1F82, 0x1FD6, 0x202A, 0x207F, 0x20D4,
+        0x2129, 0x217F, 0x21D5, 0x222C, 0x2282, 0x22DA, 0x2331, 0x2389, 0x23E1, 0x2439, 0x2492, 0x24EB, 0x2545, 0x259E, 0x25F8, 0x2653,
+        0x26AD, 0x2708, 0x2763, 0x27BE, 0x281A, 0x2876, 0x28D2, 0x292E, 0x298B, 0x29E7, 0x2A44, 0x2AA1, 0x2AFF, 0x2B5C, 0x2BBA, 0x2C18,
+        0x2C76, 0x2CD4, 0x2D33, 0x2D91, 0x2DF0, 0x2E4F, 0x2EAE, 0x2F0D, 0x2F6C, 0x2FCC, 0x302B, 0x308B, 0x30EA, 0x314A, 0x31AA, 0x3209,
+        0x3269, 0x32C9, 0x3329, 0x3389, 0x33E9, 0x3449, 0x34A9, 0x3509, 0x3569, 0x35C9, 0x3629, 0x3689, 0x36E8, 0x3748, 0x37A8, 0x3807,
+        0x3867, 0x38C6, 0x3926, 0x3985, 0x39E4, 0x3A43, 0x3AA2, 0x3B00, 0x3B5F, 0x3BBD, 0x3C1B, 0x3C79, 0x3CD7, 0x3D35, 0x3D92, 0x3DEF,
+        0x3E4C, 0x3EA9, 0x3F05, 0x3F62, 0x3FBD, 0x4019, 0x4074, 0x40D0, 0x412A, 0x4185, 0x41DF, 0x4239, 0x4292, 0x42EB, 0x4344, 0x439C,
+        0x43F4, 0x444C, 0x44A3, 0x44FA, 0x4550, 0x45A6, 0x45FC, 0x4651, 0x46A6, 0x46FA, 0x474E, 0x47A1, 0x47F4, 0x4846, 0x4898, 0x48E9,
+        0x493A, 0x498A, 0x49D9, 0x4A29, 0x4A77, 0x4AC5, 0x4B13, 0x4B5F, 0x4BAC, 0x4BF7, 0x4C42, 0x4C8D, 0x4CD7, 0x4D20, 0x4D68, 0x4DB0,
+        0x4DF7, 0x4E3E, 0x4E84, 0x4EC9, 0x4F0E, 0x4F52, 0x4F95, 0x4FD7, 0x5019, 0x505A, 0x509A, 0x50DA, 0x5118, 0x5156, 0x5194, 0x51D0,
+        0x520C, 0x5247, 0x5281, 0x52BA, 0x52F3, 0x532A, 0x5361, 0x5397, 0x53CC, 0x5401, 0x5434, 0x5467, 0x5499, 0x54CA, 0x54FA, 0x5529,
+        0x5558, 0x5585, 0x55B2, 0x55DE, 0x5609, 0x5632, 0x565B, 0x5684, 0x56AB, 0x56D1, 0x56F6, 0x571B, 0x573E, 0x5761, 0x5782, 0x57A3,
+        0x57C3, 0x57E2, 0x57FF, 0x581C, 0x5838, 0x5853, 0x586D, 0x5886, 0x589E, 0x58B5, 0x58CB, 0x58E0, 0x58F4, 0x5907, 0x5919, 0x592A,
+        0x593A, 0x5949, 0x5958, 0x5965, 0x5971, 0x597C, 0x5986, 0x598F, 0x5997, 0x599E, 0x59A4, 0x59A9, 0x59AD, 0x59B0, 0x59B2, 0x59B3
+    };
+
+    auto clamp16 (s32 value) -> s16 {
+        return (s16) std::clamp (value, -0x8000, 0x7FFF);
+    }
+
+#if defined(PSX_SSE2)
+    void accumulate (s32* dest, __m128i low, __m128i high) { // dest[0-7] += the 8 s32s in low and high
+        _mm_storeu_si128 ((__m128i*) dest, _mm_add_epi32 (_mm_loadu_si128 ((const __m128i*) dest), low));
+        _mm_storeu_si128 ((__m128i*) (dest + 4), _mm_add_epi32 (_mm_loadu_si128 ((const __m128i*) (dest + 4)), high));
+    }
+#endif
+
+    // dest[i] = sum of (taps[j][i] * weights[j][i]) >> 15 over the 4 taps
+    void interpolate (const s16 (*taps)[32], const s16 (*weights)[32], s16* dest, u32 count) {
+        u32 i = 0;
+#if defined(PSX_SSE2)
+        for (; i + 8 <= count; i += 8) {
+            auto sumLow = _mm_setzero_si128();
+            auto sumHigh = _mm_setzero_si128();
+
+            for (int tap = 0; tap < 4; tap++) {
+                __m128i low, high;
+                mulShift15 (_mm_loadu_si128 ((const __m128i*) &taps[tap][i]), _mm_loadu_si128 ((const __m128i*) &weights[tap][i]), low, high);
+                sumLow = _mm_add_epi32 (sumLow, low);
+                sumHigh = _mm_add_epi32 (sumHigh, high);
+            }
+
+            _mm_storeu_si128 ((__m128i*) &dest[i], _mm_packs_epi32 (sumLow, sumHigh));
+        }
+#endif
+        for (; i < count; i++) {
+            s32 sum = 0;
+            for (int tap = 0; tap < 4; tap++)
+                sum += (taps[tap][i] * weights[tap][i]) >> 15;
+            dest[i] = clamp16 (sum);
+        }
+    }
+
+    // out[i] = (samples[i] * envelope[i]) >> 15, then mixed into mixLeft/mixRight scaled by the voice's volumes,
+    // and into reverbLeft/reverbRight too unless they're null
+    void applyVoice (const s16* samples, const s16* envelope, s16 volumeLeft, s16 volumeRight, s16* out, s32* mixLeft, s32* mixRight,
+                     s32* reverbLeft, s32* reverbRight, u32 count) {
+        u32 i = 0;
+#if defined(PSX_SSE2)
+        const auto left = _mm_set1_epi16 (volumeLeft);
+        const auto right = _mm_set1_epi16 (volumeRight);
+
+        for (; i + 8 <= count; i += 8) {
+            __m128i low, high;
+            mulShift15 (_mm_loadu_si128 ((const __m128i*) &samples[i]), _mm_loadu_si128 ((const __m128i*) &envelope[i]), low, high);
+            const auto scaled = _mm_packs_epi32 (low, high);
+            _mm_storeu_si128 ((__m128i*) &out[i], scaled);
+
+            mulShift15 (scaled, left, low, high);
+            accumulate (&mixLeft[i], low, high);
+            if (reverbLeft)
+                accumulate (&reverbLeft[i], low, high);
+
+            mulShift15 (scaled, right, low, high);
+            accumulate (&mixRight[i], low, high);
+            if (reverbRight)
+                accumulate (&reverbRight[i], low, high);
+        }
+#endif
+        for (; i < count; i++) {
+            const auto scaled = clamp16 ((samples[i] * envelope[i]) >> 15);
+            const auto left = (scaled * volumeLeft) >> 15;
+            const auto right = (scaled * volumeRight) >> 15;
+
+            out[i] = scaled;
+            mixLeft[i] += left;
+            mixRight[i] += right;
+            if (reverbLeft) {
+                reverbLeft[i] += left;
+                reverbRight[i] += right;
+            }
+        }
+    }
+
+    // Expand the 28 nibbles of an ADPCM block to (nibble << 12) >> shift. dest gets 32 samples, the first 4 come from the header
+    // bytes and are junk
+    void expandNibbles (const u8* block, u32 shift, s16* dest) {
+#if defined(PSX_SSE2)
+        const auto bytes = _mm_loadu_si128 ((const __m128i*) block);
+        const auto mask = _mm_set1_epi8 (0xF);
+        const auto zero = _mm_setzero_si128();
+        const auto count = _mm_cvtsi32_si128 ((int) shift);
+
+        // Interleave the low and high nibbles, then move every nibble to the top of its own halfword
+        const auto low = _mm_and_si128 (bytes, mask);
+        const auto high = _mm_and_si128 (_mm_srli_epi16 (bytes, 4), mask);
+        const auto first = _mm_slli_epi16 (_mm_unpacklo_epi8 (low, high), 4);
+        const auto second = _mm_slli_epi16 (_mm_unpackhi_epi8 (low, high), 4);
+
+        _mm_storeu_si128 ((__m128i*) &dest[0], _mm_sra_epi16 (_mm_unpacklo_epi8 (zero, first), count));
+        _mm_storeu_si128 ((__m128i*) &dest[8], _mm_sra_epi16 (_mm_unpackhi_epi8 (zero, first), count));
+        _mm_storeu_si128 ((__m128i*) &dest[16], _mm_sra_epi16 (_mm_unpacklo_epi8 (zero, second), count));
+        _mm_storeu_si128 ((__m128i*) &dest[24], _mm_sra_epi16 (_mm_unpackhi_epi8 (zero, second), count));
+#else
+        for (u32 i = 0; i < 32; i++) {
+            const auto byte = block[i / 2];
+            dest[i] = (s16) (((i & 1) ? byte >> 4 : byte & 0xF) << 12) >> shift;
+        }
+#endif
+    }
+}
+
+SPU::SPU (Scheduler* _scheduler, AudioRing& _cdAudio, std::function <void()> _irq) : scheduler(_scheduler), cdAudio(_cdAudio), irq(std::move (_irq)) {
+    RAM.resize (RAM_SIZE, 0);
+    scheduler -> setHandler (SchedulerEvent::SPU, [this] {
+        catchUp();
+        scheduler -> schedule (SchedulerEvent::SPU, BLOCK_SAMPLES * CYCLES_PER_SAMPLE);
+    });
+    scheduler -> schedule (SchedulerEvent::SPU, BLOCK_SAMPLES * CYCLES_PER_SAMPLE);
+}
+
+void SPU::catchUp() {
+    auto due = (scheduler -> timestamp - lastTimestamp) / CYCLES_PER_SAMPLE;
+    lastTimestamp += due * CYCLES_PER_SAMPLE;
+
+    while (due > 0) {
+        const auto count = (u32) std::min <u64> (due, BLOCK_SAMPLES);
+        mixBlock (count);
+        due -= count;
+    }
+}
+
+void SPU::mixBlock (u32 count) {
+    s32 mixLeft[BLOCK_SAMPLES] = {};
+    s32 mixRight[BLOCK_SAMPLES] = {};
+    s32 reverbInLeft[BLOCK_SAMPLES] = {};
+    s32 reverbInRight[BLOCK_SAMPLES] = {};
+    s16 reverbLeft[BLOCK_SAMPLES];
+    s16 reverbRight[BLOCK_SAMPLES];
+    s16 noise[BLOCK_SAMPLES];
+
+    // The noise generator is shared by every voice in noise mode. SPUCNT bits 8-9 are its step, 10-13 its shift
+    const auto noiseStep = (s32) ((control >> 8) & 3) + 4;
+    const auto noiseShift = (control >> 10) & 0xF;
+    for (u32 i = 0; i < count; i++) {
+        const auto parity = ((noiseLevel >> 15) ^ (noiseLevel >> 12) ^ (noiseLevel >> 11) ^ (noiseLevel >> 10) ^ 1) & 1;
+        noiseTimer -= noiseStep;
+        if (noiseTimer < 0) {
+            noiseLevel = (u16) ((noiseLevel << 1) | parity);
+            noiseTimer += 0x20000 >> noiseShift;
+            if (noiseTimer < 0)
+                noiseTimer += 0x20000 >> noiseShift;
+        }
+
+        noise[i] = (s16) noiseLevel;
+    }
+
+    for (u32 voice = 0; voice < VOICE_COUNT; voice++)
+        renderVoice (voice, count, noise, mixLeft, mixRight, reverbInLeft, reverbInRight);
+
+    for (u32 i = 0; i < count; i++) {
+        const auto cd = cdAudio.pop(); // the CD keeps streaming whether it's mixed in or not
+        const auto cdLeft = clamp16 ((cd.left * cdVolumeLeft) >> 15);
+        const auto cdRight = clamp16 ((cd.right * cdVolumeRight) >> 15);
+
+        // Capture buffers, 0x200 halfwords each: CD left, CD right, voice 1, voice 3
+        const s16 captures[4] = { cdLeft, cdRight, voiceOutput[1][i], voiceOutput[3][i] };
+        for (u32 buffer = 0; buffer < 4; buffer++) {
+            const auto address = buffer * 0x400 + captureIndex * 2;
+            checkIRQ (address, 2);
+            std::memcpy (&RAM[address], &captures[buffer], sizeof (s16));
+        }
+        captureIndex = (captureIndex + 1) & 0x1FF;
+
+        if (control & 1) { // CD audio enable
+            mixLeft[i] += cdLeft;
+            mixRight[i] += cdRight;
+        }
+        if (control & 4) { // CD audio reverb
+            reverbInLeft[i] += cdLeft;
+            reverbInRight[i] += cdRight;
+        }
+    }
+
+    processReverb (reverbInLeft, reverbInRight, reverbLeft, reverbRight, count);
+    if (out == nullptr)
+        return;
+
+    for (u32 i = 0; i < count; i++) {
+        mixLeft[i] += (reverbLeft[i] * reverbVolumeLeft) >> 15;
+        mixRight[i] += (reverbRight[i] * reverbVolumeRight) >> 15;
+
+        // Bit 14 unmutes the output, bit 15 turns the SPU on
+        if ((control & 0xC000) != 0xC000) {
+            out -> push ({ 0, 0 });
+            continue;
+        }
+
+        out -> push ({ clamp16 ((clamp16 (mixLeft[i]) * mainVolumeLeft) >> 15), clamp16 ((clamp16 (mixRight[i]) * mainVolumeRight) >> 15) });
+    }
+}
+
+void SPU::renderVoice (u32 index, u32 count, const s16* noise, s32* mixLeft, s32* mixRight, s32* reverbLeft, s32* reverbRight) {
+    auto& voice = voices[index];
+    auto& output = voiceOutput[index];
+
+    if (voice.phase == EnvelopePhase::Off) {
+        std::fill_n (output.begin(), count, (s16) 0);
+        return;
+    }
+
+    s16 taps[4][BLOCK_SAMPLES];
+    s16 weights[4][BLOCK_SAMPLES];
+    s16 envelope[BLOCK_SAMPLES];
+    s16 interpolated[BLOCK_SAMPLES];
+    const auto modulated = index > 0 && (pitchModVoices & (1 << index)); // voice 0 has nothing to be modulated by
+    const auto noiseMode = (noiseVoices & (1 << index)) != 0;
+
+    // Walk the pitch counter, gathering the 4 samples and weights behind every output sample. This is the sequential part:
+    // crossing into the next ADPCM block decodes it, and the envelope steps once per sample
+    for (u32 i = 0; i < count; i++) {
+        const auto position = voice.counter >> 12;
+        const auto point = (voice.counter >> 4) & 0xFF;
+
+        for (int tap = 0; tap < 4; tap++)
+            taps[tap][i] = voice.samples[position + tap];
+        weights[0][i] = GAUSS[0xFF - point];
+        weights[1][i] = GAUSS[0x1FF - point];
+        weights[2][i] = GAUSS[0x100 + point];
+        weights[3][i] = GAUSS[point];
+        envelope[i] = (s16) voice.envelope;
+
+        u32 step = voice.pitch;
+        if (modulated) { // the previous voice's output scales the step by 0 to 1.99, with the hardware's sign glitch for pitches above 0x7FFF
+            const auto factor = (s32) voiceOutput[index - 1][i] + 0x8000;
+            step = (u32) (((s32) (s16) step * factor) >> 15) & 0xFFFF;
+        }
+
+        voice.counter += std::min <u32> (step, 0x4000);
+        while ((voice.counter >> 12) >= SAMPLES_PER_ADPCM_BLOCK) {
+            voice.counter -= SAMPLES_PER_ADPCM_BLOCK << 12;
+            nextBlock (voice, index);
+        }
+
+        tickEnvelope (voice);
+    }
+
+    if (noiseMode)
+        std::copy_n (noise, count, interpolated);
+    else
+        interpolate (taps, weights, interpolated, count);
+
+    const auto reverb = (reverbVoices & (1 << index)) != 0;
+    applyVoice (interpolated, envelope, voice.volumeLeft, voice.volumeRight, output.data(), mixLeft, mixRight,
+                reverb ? reverbLeft : nullptr, reverb ? reverbRight : nullptr, count);
+}
+
+// A block is a shift/filter byte, a flags byte and 28 4-bit samples
+void SPU::decodeBlock (Voice& voice) {
+    checkIRQ (voice.blockAddress, 16);
+
+    u8 block[16];
+    if (voice.blockAddress + 16 <= RAM_SIZE)
+        std::memcpy (block, &RAM[voice.blockAddress], 16);
+    else {
+        for (u32 i = 0; i < 16; i++)
+            block[i] = RAM[(voice.blockAddress + i) & (RAM_SIZE - 1)];
+    }
+
+    const auto shift = (block[0] & 0xF) > 12 ? 9 : block[0] & 0xF; // shifts 13-15 act like 9
+    const auto filter = std::min ((block[0] >> 4) & 7, 4);
+    const auto positive = POSITIVE_WEIGHTS[filter];
+    const auto negative = NEGATIVE_WEIGHTS[filter];
+
+    voice.blockFlags = block[1];
+    if (block[1] & 4) // loop start
+        voice.repeatAddress = (u16) (voice.blockAddress / 8);
+
+    s16 expanded[32];
+    expandNibbles (block, shift, expanded);
+
+    // The last 3 samples of the previous block stay in front, for interpolating across the boundary
+    std::copy_n (voice.samples.end() - 3, 3, voice.samples.begin());
+    for (u32 i = 0; i < SAMPLES_PER_ADPCM_BLOCK; i++) {
+        const auto sample = clamp16 (expanded[i + 4] + ((voice.old * positive + voice.older * negative + 32) >> 6));
+        voice.older = voice.old;
+        voice.old = sample;
+        voice.samples[3 + i] = sample;
+    }
+}
+
+void SPU::nextBlock (Voice& voice, u32 index) {
+    if (voice.blockFlags & 1) { // loop end: jump to the repeat address, and without the repeat flag silence the voice
+        endedVoices |= 1 << index;
+        voice.blockAddress = voice.repeatAddress * 8;
+
+        if (!(voice.blockFlags & 2)) {
+            voice.phase = EnvelopePhase::Release;
+            voice.envelope = 0;
+        }
+    }
+
+    else
+        voice.blockAddress = (voice.blockAddress + 16) & (RAM_SIZE - 1);
+
+    decodeBlock (voice);
+}
+
+void SPU::keyOn (u32 index) {
+    auto& voice = voices[index];
+    voice.blockAddress = voice.startAddress * 8;
+    voice.counter = 0;
+    voice.samples.fill (0);
+    voice.old = voice.older = 0;
+    voice.phase = EnvelopePhase::Attack;
+    voice.envelope = 0;
+    voice.envelopeWait = 0;
+    endedVoices &= ~(1 << index);
+
+    decodeBlock (voice);
+}
+
+void SPU::keyOff (u32 index) {
+    auto& voice = voices[index];
+    if (voice.phase != EnvelopePhase::Off) {
+        voice.phase = EnvelopePhase::Release;
+        voice.envelopeWait = 0;
+    }
+}
+
+// Every phase moves the level by a step every so many samples, both derived from its shift. Exponential increases slow down
+// above 0x6000, exponential decreases are proportional to the level
+void SPU::tickEnvelope (Voice& voice) {
+    if (voice.phase == EnvelopePhase::Off)
+        return;
+
+    if (voice.envelopeWait > 1) {
+        voice.envelopeWait--;
+        return;
+    }
+
+    bool exponential, decreasing;
+    s32 shift, step;
+
+    switch (voice.phase) {
+        case EnvelopePhase::Attack:
+            exponential = (voice.adsrLow >> 15) != 0;
+            decreasing = false;
+            shift = (voice.adsrLow >> 10) & 0x1F;
+            step = 7 - ((voice.adsrLow >> 8) & 3);
+            break;
+
+        case EnvelopePhase::Decay:
+            exponential = true;
+            decreasing = true;
+            shift = (voice.adsrLow >> 4) & 0xF;
+            step = -8;
+            break;
+
+        case EnvelopePhase::Sustain:
+            exponential = (voice.adsrHigh >> 15) != 0;
+            decreasing = ((voice.adsrHigh >> 14) & 1) != 0;
+            shift = (voice.adsrHigh >> 8) & 0x1F;
+            step = decreasing ? -8 + ((voice.adsrHigh >> 6) & 3) : 7 - ((voice.adsrHigh >> 6) & 3);
+            break;
+
+        default: // Release
+            exponential = ((voice.adsrHigh >> 5) & 1) != 0;
+            decreasing = true;
+            shift = voice.adsrHigh & 0x1F;
+            step = -8;
+            break;
+    }
+
+    u32 wait = 1 << std::max (0, shift - 11);
+    s32 delta = step * (1 << std::max (0, 11 - shift));
+
+    if (exponential && !decreasing && voice.envelope > 0x6000)
+        wait *= 4;
+    if (exponential && decreasing)
+        delta = (delta * voice.envelope) >> 15;
+
+    voice.envelope = std::clamp (voice.envelope + delta, 0, 0x7FFF);
+    voice.envelopeWait = wait;
+
+    switch (voice.phase) {
+        case EnvelopePhase::Attack:
+            if (voice.envelope == 0x7FFF) {
+                voice.phase = EnvelopePhase::Decay;
+                voice.envelopeWait = 0;
+            }
+            break;
+
+        case EnvelopePhase::Decay:
+            if (voice.envelope <= std::min (((voice.adsrLow & 0xF) + 1) * 0x800, 0x7FFF)) {
+                voice.phase = EnvelopePhase::Sustain;
+                voice.envelopeWait = 0;
+            }
+            break;
+
+        case EnvelopePhase::Release:
+            if (voice.envelope == 0)
+                voice.phase = EnvelopePhase::Off;
+            break;
+
+        default: break;
+    }
+}
+
+void SPU::checkIRQ (u32 address, u32 size) {
+    if (!(control & 0x40) || irqFlag) // IRQs disabled, or one is already pending
+        return;
+
+    if (((irqAddress * 8 - address) & (RAM_SIZE - 1)) < size) {
+        irqFlag = true;
+        irq();
+    }
+}
+
+void SPU::writeRAM (u16 value) {
+    checkIRQ (transferAddress, 2);
+    std::memcpy (&RAM[transferAddress], &value, sizeof (u16));
+    transferAddress = (transferAddress + 2) & (RAM_SIZE - 1);
+}
+
+void SPU::flushFifo() {
+    for (u32 i = 0; i < fifoSize; i++)
+        writeRAM (fifo[i]);
+    fifoSize = 0;
+}
+
+void SPU::writeVolume (u16 value, s16& volume) {
+    if (!(value & 0x8000)) // fixed volume, bits 0-14 are half the volume
+        volume = (s16) (value << 1);
+}
+
+void SPU::writeVoiceRegister (u32 index, u32 offset, u16 value) {
+    auto& voice = voices[index];
+
+    switch (offset) {
+        case 0x0: writeVolume (value, voice.volumeLeft); break;
+        case 0x2: writeVolume (value, voice.volumeRight); break;
+        case 0x4: voice.pitch = value; break;
+        case 0x6: voice.startAddress = value; break;
+        case 0x8: voice.adsrLow = value; break;
+        case 0xA: voice.adsrHigh = value; break;
+        case 0xC: voice.envelope = value & 0x7FFF; break;
+        case 0xE: voice.repeatAddress = value; break;
+    }
+}
+
+auto SPU::read16 (u32 address) -> u16 {
+    catchUp();
+    const auto offset = address & 0x3FE;
+
+    if (offset < VOICE_COUNT * 16) {
+        if ((offset & 0xF) == 0xC) // current envelope level
+            return (u16) voices[offset >> 4].envelope;
+        if ((offset & 0xF) == 0xE) // loop start flags move the repeat address
+            return voices[offset >> 4].repeatAddress;
+        return registers[offset / 2];
+    }
+
+    if (offset >= 0x200 && offset < 0x200 + VOICE_COUNT * 4) { // current voice volumes
+        const auto& voice = voices[(offset - 0x200) / 4];
+        return (u16) ((offset & 2) ? voice.volumeRight : voice.volumeLeft);
+    }
+
+    switch (offset) {
+        case 0x19C: return (u16) endedVoices;
+        case 0x19E: return (u16) (endedVoices >> 16);
+        case 0x1A6: return transferAddressRegister;
+        case 0x1AA: return control;
+        case 0x1AE: { // SPUSTAT. Transfers are instant, so the busy flag never is
+            const auto mode = (TransferMode) ((control >> 4) & 3);
+            u16 status = control & 0x3F;
+            status |= irqFlag << 6;
+            status |= ((control >> 5) & 1) << 7; // DMA request
+            status |= (mode == TransferMode::DMAWrite) << 8;
+            status |= (mode == TransferMode::DMARead) << 9;
+            status |= (captureIndex >= 0x100) << 11; // which half of the capture buffers is being written
+            return status;
+        }
+        case 0x1B8: return (u16) mainVolumeLeft;
+        case 0x1BA: return (u16) mainVolumeRight;
+    }
+
+    if (offset < 0x200)
+        return registers[offset / 2];
+
+    return 0;
+}
+
+void SPU::write16 (u32 address, u16 value) {
+    catchUp();
+    const auto offset = address & 0x3FE;
+
+    if (offset < 0x200)
+        registers[offset / 2] = value;
+
+    if (offset < VOICE_COUNT * 16) {
+        writeVoiceRegister (offset >> 4, offset & 0xF, value);
+        return;
+    }
+
+    // KON, KOFF and the voice flag registers come in halves, voices 0-15 then 16-23
+    const auto setHalf = [offset, value] (u32& flags) {
+        const auto shift = (offset & 2) ? 16 : 0;
+        flags = (flags & ~(0xFFFFu << shift)) | (value << shift);
+    };
+    const auto forEachVoice = [offset, value] (auto action) {
+        const auto first = (offset & 2) ? 16u : 0u;
+        for (u32 bit = 0; bit < 16 && first + bit < VOICE_COUNT; bit++) {
+            if (value & (1 << bit))
+                action (first + bit);
+        }
+    };
+
+    switch (offset) {
+        case 0x180: writeVolume (value, mainVolumeLeft); break;
+        case 0x182: writeVolume (value, mainVolumeRight); break;
+        case 0x184: reverbVolumeLeft = (s16) value; break;
+        case 0x186: reverbVolumeRight = (s16) value; break;
+        case 0x188: case 0x18A: setHalf (keyOnVoices); forEachVoice ([this] (u32 voice) { keyOn (voice); }); break;
+        case 0x18C: case 0x18E: setHalf (keyOffVoices); forEachVoice ([this] (u32 voice) { keyOff (voice); }); break;
+        case 0x190: case 0x192: setHalf (pitchModVoices); break;
+        case 0x194: case 0x196: setHalf (noiseVoices); break;
+        case 0x198: case 0x19A: setHalf (reverbVoices); break;
+        case 0x19C: case 0x19E: break; // ENDX is read only
+        case 0x1A2:
+            reverbBase = (value * 8) & (RAM_SIZE - 1);
+            reverbAddress = reverbBase;
+            reverbScheduleDirty = true;
+            break;
+
+        case 0x1A4: irqAddress = value; break;
+        case 0x1A6:
+            transferAddressRegister = value;
+            transferAddress = (value * 8) & (RAM_SIZE - 1);
+            break;
+
+        case 0x1A8: // sound RAM data FIFO, written out once manual write mode is selected
+            if (fifoSize < FIFO_SIZE)
+                fifo[fifoSize++] = value;
+            if ((TransferMode) ((control >> 4) & 3) == TransferMode::ManualWrite)
+                flushFifo();
+            break;
+
+        case 0x1AA:
+            control = value;
+            if (!(control & 0x40)) // clearing the IRQ enable acknowledges the IRQ
+                irqFlag = false;
+            reverbScheduleDirty = true; // bit 7 turns reverb writes on and off
+            if ((TransferMode) ((control >> 4) & 3) == TransferMode::ManualWrite)
+                flushFifo();
+            break;
+
+        case 0x1B0: cdVolumeLeft = (s16) value; break;
+        case 0x1B2: cdVolumeRight = (s16) value; break;
+        default: // everything else is only kept in the register mirror
+            if (offset >= 0x1C0 && offset < 0x200) // reverb settings
+                reverbScheduleDirty = true;
+            break;
+    }
+}
+
+auto SPU::dmaRequested() const -> bool {
+    const auto mode = (TransferMode) ((control >> 4) & 3);
+    return mode == TransferMode::DMAWrite || mode == TransferMode::DMARead;
+}
+
+void SPU::dmaWrite (const u32* words, size_t count) {
+    catchUp();
+    for (size_t i = 0; i < count; i++) {
+        writeRAM ((u16) words[i]);
+        writeRAM ((u16) (words[i] >> 16));
+    }
+}
+
+void SPU::dmaRead (u32* words, size_t count) {
+    catchUp();
+    for (size_t i = 0; i < count; i++) {
+        u16 halves[2];
+        for (auto& half : halves) {
+            checkIRQ (transferAddress, 2);
+            std::memcpy (&half, &RAM[transferAddress], sizeof (u16));
+            transferAddress = (transferAddress + 2) & (RAM_SIZE - 1);
+        }
+
+        words[i] = halves[0] | (halves[1] << 16);
+    }
+}
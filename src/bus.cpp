@@ -1,13 +1,17 @@
+#include <algorithm>
+#include <cstring>
 #include "include/types.h"
 #include "include/helpers.h"
 #include "include/bus.h"
 
-Bus::Bus(class GPU* _gpu) : gpu(_gpu) {
+Bus::Bus(class GPU* _gpu, Scheduler* _scheduler) : gpu(_gpu), scheduler(_scheduler), cdrom(_scheduler, [this] { interruptStatus |= IRQ_CDROM; }),
+    spu(_scheduler, cdrom.audio(), [this] { interruptStatus |= IRQ_SPU; }) {
     constexpr auto kilobyte = 1024;
 
     BIOS = Helpers::loadROM("D:/Repos/Top secret/TopSecret/ROMs/BIOS.bin");
     RAM.resize (2048 * kilobyte, 0);
     scratchpad.resize (kilobyte, 0);
+    LLVisited.resize (RAM.size() / 4, 0);
 
     DMAControl.raw = 0x07654321; // default value on boot
     DMAInterruptControl.raw = 0;
@@ -16,6 +20,21 @@ Bus::Bus(class GPU* _gpu) : gpu(_gpu) {
     for (int i = 0; i < 7; i++) {
         DMAChannels[i].channelNumber = i; // initialize indices
     }
+
+    scheduler -> setHandler (SchedulerEvent::DMA, [this] { DMA_step(); });
+}
+
+void Bus::loadToRAM (u32 address, const u8* data, size_t size) {
+    address &= 0x1F'FFFF;
+
+    while (size > 0) {
+        const auto length = std::min <size_t> (size, RAM.size() - address);
+        std::memcpy (&RAM[address], data, length);
+
+        address = 0;
+        data += length;
+        size -= length;
+    }
 }
 
 auto Bus::read8 (u32 address) -> u8 {
@@ -32,10 +51,8 @@ auto Bus::read8 (u32 address) -> u8 {
     else if (address >= 0x1FC0'0000 && address <= 0x1FC8'0000)
         return *(u8*) &BIOS[address & 0x7FFFF];
 
-    else if (address == 0x1F801800) {
-        Helpers::warn ("Read from CDROM status\n");
-        return 0;
-    }
+    else if (address >= 0x1F801800 && address <= 0x1F801803)
+        return cdrom.read (address);
 
     else
         Helpers::panic("Read from unimplemented address %08X\n", address);
@@ -53,19 +70,13 @@ auto Bus::read16 (u32 address) -> u16 {
     }
 
     else if (address >= 0x1F801000 && address < 0x1F803000) {
-        if (address >= 0x1F801C00 && address <= 0x1F801DC0) { // SPU regs
-            return 0;
-        }
+        if (address >= 0x1F801C00 && address < 0x1F802000) // SPU regs
+            return spu.read16 (address);
 
         switch (address) {
-        /*
-            case 0x1F801DAE: printf("Read from SPU Status\n"); return 0;
-            case 0x1F801DAA: printf("Read from SPU Control\n"); return 0;
-            case 0x1F801D88: case 0x1F801D8A: case 0x1F801D8C: case 0x1F801D8E: printf("Read from SPU voice\n"); return 0;
-            case 0x1F801DAC: printf("Read from SPU transfer control register\n"); return 0;
-        */
-
-            case 0x1F801074: printf("Read from interrupt mask reg\n"); return 0;
+
+            case 0x1F801070: return (u16) interruptStatus;
+            case 0x1F801074: return (u16) interruptMask;
             case 0x1F801814: printf("Read from GPUSTAT (16-bit) (Unimplemented)\n"); return 0;
             default: Helpers::panic("16-bit read from unimplemented IO addr %08X\n  ", address);
         }
@@ -89,22 +100,20 @@ auto Bus::read32 (u32 address) -> u32 {
         return *(u32*) &BIOS[address & 0x7FFFF];
 
     else if (address >= 0x1F801000 && address < 0x1F803000) {
-        if (address >= 0x1F801C00 && address <= 0x1F801DC0) { // SPU regs
-            return 0;
-        }
+        if (address >= 0x1F801C00 && address < 0x1F802000) // SPU regs, as 2 halfwords
+            return spu.read16 (address) | (spu.read16 (address + 2) << 16);
+
+        if (address >= 0x1F801080 && address < 0x1F8010F0) // DMA channel registers
+            return readDMARegister (address);
 
         switch (address) {
-        /*
-            case 0x1F801DAE: printf("Read from SPU Status\n"); return 0;
-            case 0x1F801DAA: printf("Read from SPU Control\n"); return 0;
-            case 0x1F801D88: case 0x1F801D8A: case 0x1F801D8C: case 0x1F801D8E: printf("Read from SPU voice\n"); return 0;
-            case 0x1F801DAC: printf("Read from SPU transfer control register\n"); return 0;
-        */
-
-            case 0x1F801074: printf("Read from interrupt mask reg\n"); return 0;
+            case 0x1F801070: return interruptStatus;
+            case 0x1F801074: return interruptMask;
             case 0x1F8010F0: printf("Read from DPCR\n"); return DMAControl.raw;
             case 0x1F8010F4: printf("Read from DICR\n"); return DMAInterruptControl.raw;
-            case 0x1F801810: printf("Read from GPUREAD (Stubbed)\n"); return 0;
+            case 0x1F801810: return gpu -> gpuread();
+            case 0x1F801820: return mdec.readData();
+            case 0x1F801824: return mdec.readStatus();
             case 0x1F801814: printf("Read from GPUSTAT (Stubbed)\n"); return gpu -> status.raw & ~(1 << 19); // Signal that the GPU is ready to receive stuff from the CPU/DMAC. Turning off bit 19 because of some shit that makes the BIOS hang.
 
             default: Helpers::warn("32-bit read from unimplemented IO addr %08X\n", address); return 0;
@@ -128,6 +137,9 @@ void Bus::write8 (u32 address, u8 value) {
     else if (address >= 0x1F80'0000 && address <= 0x1F80'0400)
         *(u8*) &scratchpad[address & 0xFFF] = value;
 
+    else if (address >= 0x1F80'1800 && address <= 0x1F80'1803)
+        cdrom.write (address, value);
+
     else if (address >= 0x1F80'1000 && address < 0x1F80'2000)
         printf("8-bit write to unimplemented IO address %08X (val: %02X)\n", address, value);
 
@@ -161,6 +173,18 @@ void Bus::write16 (u32 address, u16 value) {
     else if (address >= 0x1F80'0000 && address <= 0x1F80'0400)
         *(u16*) &scratchpad[address & 0xFFF] = value;
 
+    else if (address == 0x1F80'1070) // I_STAT, writing 0 to a bit acknowledges its IRQ
+        interruptStatus &= value;
+
+    else if (address == 0x1F80'1074) // I_MASK
+        interruptMask = value & 0x7FF;
+
+    else if (address >= 0x1F80'1C00 && address < 0x1F80'2000) { // SPU regs
+        spu.write16 (address, value);
+        if (address == 0x1F80'1DAA) // SPUCNT picks the transfer mode, which may be a DMA4 request
+            DMA_kick();
+    }
+
     else if (address >= 0x1F80'1000 && address < 0x1F80'2000)
         printf("16-bit write to unimplemented IO address %08X (val: %04X)\n", address, value);
 
@@ -189,18 +213,20 @@ void Bus::write32 (u32 address, u32 value) {
 
 
     else if (address >= 0x1F801000 && address < 0x1F803000) {
-        //if (address >= 0x1F801C00 && address <= 0x1F801DC0) { // SPU regs
-            //return;
-        //}
+        if (address >= 0x1F801C00 && address < 0x1F802000) { // SPU regs, as 2 halfwords
+            spu.write16 (address, (u16) value);
+            spu.write16 (address + 2, (u16) (value >> 16));
+            if (address == 0x1F801DA8) // the 32-bit pair covering SPUCNT
+                DMA_kick();
+            return;
+        }
 
         switch (address) {
 
-            case 0x1F801074: printf("Wrote to interrupt mask reg\n"); break;
-            case 0x1F8010F0: printf("Wrote to DPCR\n"); DMAControl.raw = value; break;
-            case 0x1F8010F4:
-                printf("Wrote to DICR\n");
-                DMAInterruptControl.raw = (DMAInterruptControl.raw & ~(value & 0x7F000000)) | (value & ~0x7F000000); // masking is to make it so that writes to the acknowledge bits actually disable the bits
-                break;
+            case 0x1F801070: interruptStatus &= value; break; // writing 0 to a bit acknowledges its IRQ
+            case 0x1F801074: interruptMask = value & 0x7FF; break;
+            case 0x1F8010F0: printf("Wrote to DPCR\n"); writeToDPCR (value); break;
+            case 0x1F8010F4: printf("Wrote to DICR\n"); writeToDICR (value); break;
 
             // DMA registers
             // DMA base addresses (only 24-bits are taken into account)
@@ -230,6 +256,8 @@ void Bus::write32 (u32 address, u32 value) {
             case 0x1F8010D8: writeToDMAControl (5, value); break; // DMA5 control register
             case 0x1F8010E8: writeToDMAControl (6, value); break; // DMA6 control register
 
+            case 0x1F801820: mdec.writeCommand (value); DMA_kick(); break; // new output may be what DMA1 is waiting for
+            case 0x1F801824: mdec.writeControl (value); DMA_kick(); break; // so may newly enabled DMA requests
             case 0x1F801810: printf("Wrote to GP0 set command (Stubbed)\nCommand: %08X\n", value); gpu -> gp0_command (value); break;
             case 0x1F801814: printf("Wrote to GP1 set command (Stubbed)\nCommand: %08X\n", value); gpu -> gp1_command (value); break;
             default: printf("32-bit write to unimplemented IO addr %08X\n", address); break;
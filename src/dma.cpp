@@ -1,54 +1,322 @@
+#include <algorithm>
 #include "include/bus.h"
 #include "include/dma.h"
+#include "include/simd.h"
+
+/*
+ * DMA runs in the background of the CPU. Starting a channel only sets up its transfer, then the scheduler calls DMA_step, which
+ * gives the bus to one ready channel at a time, moves one slice of its transfer and keeps the CPU off the bus for as long as the slice takes.
+ * A slice is all of a sync mode 0 transfer, one block in sync mode 1, or a run of linked list nodes. With chopping on, slices are
+ * at most 1 << choppingDMAWindowSize words, and the channel waits 1 << choppingCPUWindowSize cycles before the next one.
+ * Between blocks and linked list runs it waits for the device to request more data, which is when the CPU gets to run
+*/
+
+namespace {
+    // Approximate bus cycles per word transferred, per device. The GPU, MDEC and OTC keep up with the bus, the rest are slower
+    constexpr std::array <u32, 7> CYCLES_PER_WORD = { 1, 1, 1, 24, 4, 20, 1 };
+    // Approximate cycles between a block finishing and the device requesting the next one
+    constexpr std::array <u32, 7> REQUEST_GAP = { 64, 64, 16, 0, 16, 0, 0 };
+    constexpr u32 LL_SLICE_WORDS = 256; // linked list nodes are sent in runs of at least this many words (headers included) per bus grant
+
+    // Call func (pointer, words) on the runs of RAM that count words starting at addr cover. A transfer that runs past the end of RAM wraps
+    // around to the start, so it can take 2 runs
+    template <typename Func>
+    void forEachSpan (std::vector <u8>& RAM, u32 addr, u32 count, Func func) {
+        addr &= 0x1F'FFFC;
+
+        while (count > 0) {
+            const auto length = std::min <u32> (count, (0x20'0000 - addr) / 4);
+            func ((u32*) &RAM[addr], length);
+
+            addr = (addr + length * 4) & 0x1F'FFFC;
+            count -= length;
+        }
+    }
+
+    // dest[i] = (first + i * 4) & 0x1F'FFFF, the ordering table entries of a run of RAM with no wrap in it
+    void fillPointerChain (u32* dest, u32 first, u32 count) {
+        u32 i = 0;
+
+#if defined(PSX_AVX2)
+        const auto mask8 = _mm256_set1_epi32 (0x1F'FFFF);
+        const auto step8 = _mm256_set1_epi32 (32);
+        auto values8 = _mm256_add_epi32 (_mm256_set1_epi32 ((s32) first), _mm256_setr_epi32 (0, 4, 8, 12, 16, 20, 24, 28));
+
+        for (; i + 8 <= count; i += 8) {
+            _mm256_storeu_si256 ((__m256i*) &dest[i], _mm256_and_si256 (values8, mask8));
+            values8 = _mm256_add_epi32 (values8, step8);
+        }
+#endif
+
+#if defined(PSX_SSE2)
+        const auto mask = _mm_set1_epi32 (0x1F'FFFF);
+        const auto step = _mm_set1_epi32 (16);
+        auto values = _mm_add_epi32 (_mm_set1_epi32 ((s32) (first + i * 4)), _mm_setr_epi32 (0, 4, 8, 12));
+
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_si128 ((__m128i*) &dest[i], _mm_and_si128 (values, mask));
+            values = _mm_add_epi32 (values, step);
+        }
+#endif
+
+        for (; i < count; i++)
+            dest[i] = (first + i * 4) & 0x1F'FFFF;
+    }
+}
 
 void Bus::writeToDMAControl (int channel, u32 val) {
-    DMAChannels[channel].control.raw = val;
-    auto isEnabled = DMAChannels[channel].isEnabled();
+    auto& dma = DMAChannels[channel];
+    dma.control.raw = val;
+
+    if (dma.active) {
+        if (!dma.control.enable) // clearing the enable bit stops the transfer where it is, without an IRQ
+            dma.active = dma.finishing = false;
 
-    if (!isEnabled) // if the DMA is not enabled, dip early
         return;
+    }
 
-    constexpr std::array <u32, 2> offsets = {4, -4};
+    if (!dma.isEnabled()) // if the DMA is not enabled, dip early
+        return;
 
-    auto control = DMAChannels[channel].control;
-    auto syncMode = (SyncMode) control.syncMode;
-    auto direction = (Direction) control.direction;
-    auto device = (Device) channel;
+    DMA_start (channel);
+}
 
-    auto offset = offsets [control.decrement]; // if decrement bit is 0 => offset is 4. If 1 => offset is -4
-    auto baseAddr = DMAChannels[channel].baseAddr;
-    auto blockSettings = DMAChannels[channel].blockControl;
-    s64 length; // length in words (unused for LL transfers, because that's how LLs work)
+void Bus::writeToDPCR (u32 val) {
+    DMAControl.raw = val;
+    DMA_kick(); // channels that were waiting on their enable bit may be able to go now
+}
 
-    if (syncMode == 0)
-        length = (blockSettings.blockSize == 0) ? 0x10000 : blockSettings.blockSize; // if the size is 0, it gets set to 0x10000 instead
+void Bus::DMA_start (int channel) {
+    auto& dma = DMAChannels[channel];
+    auto syncMode = (SyncMode) dma.control.syncMode;
+    auto direction = (Direction) dma.control.direction;
+    auto device = (Device) channel;
+    auto blockSettings = dma.blockControl;
 
-    else
-        length = blockSettings.blockSize * blockSettings.blockAmount;
+    Helpers::debug_printf ("DMA requested\nSync mode: %d, direction: %s, device: %d\nDecrement: %d, base addr: %08X, block control: %08X\n",
+                            syncMode, direction ? "From RAM" : "To RAM", device, dma.control.decrement, dma.baseAddr, blockSettings.raw);
 
     switch (syncMode) {
-        case SyncMode::Immediate: DMA_transferBlock(syncMode, direction, device, offset, baseAddr, length); break;
-        case SyncMode::SyncToDMARequests: DMA_transferBlock(syncMode, direction, device, offset, baseAddr, length); break; // This should actually run the CPU between blocks. Tekken 3 depends on this...
-        case SyncMode::LinkedList: DMA_transferLLs(direction, device, offset, baseAddr); break;
+        case SyncMode::Immediate:
+            dma.wordsLeft = (blockSettings.blockSize == 0) ? 0x10000 : blockSettings.blockSize; // if the size is 0, it gets set to 0x10000 instead
+            break;
+
+        case SyncMode::SyncToDMARequests:
+            dma.wordsLeft = blockSettings.blockSize * ((blockSettings.blockAmount == 0) ? 0x10000 : blockSettings.blockAmount); // a block count of 0 means 0x10000 blocks
+            dma.blockWordsLeft = blockSettings.blockSize;
+            break;
+
+        case SyncMode::LinkedList:
+            if (direction != Direction::FromRAM || device != Device::GPU || dma.control.decrement)
+                Helpers::panic ("Weird Linked List DMA configuration.\nDirection: %s, device: %d, decrement: %d", direction ? "From RAM" : "To RAM", device, dma.control.decrement);
+
+            if (++LLGeneration == 0) { // the marks of old walks would look current once the generation wraps around, so wipe them
+                std::fill (LLVisited.begin(), LLVisited.end(), 0);
+                LLGeneration = 1;
+            }
+
+            LLStart = dma.baseAddr & 0x1F'FFFC;
+            LLNodes = 0;
+            break;
+
         case SyncMode::Reserved: Helpers::panic ("Illegal DMA\n"); break;
     }
+
+    dma.control.trigger = 0; // the manual start bit clears as soon as the transfer starts
+    dma.currentAddr = dma.baseAddr & 0x1F'FFFC; // Wrap around the WRAM, forcibly word-align the address
+    dma.readyAt = scheduler -> timestamp;
+    dma.active = true;
+    dma.finishing = syncMode != SyncMode::LinkedList && dma.wordsLeft == 0; // empty block transfers complete right away
+
+    DMA_kick();
+}
+
+// Make sure a DMA step is pending. A step that's already scheduled looks at every channel when it runs, so there's no need to pull it forward
+void Bus::DMA_kick() {
+    if (!scheduler -> isScheduled (SchedulerEvent::DMA))
+        scheduler -> schedule (SchedulerEvent::DMA, 0);
+}
+
+auto Bus::DMA_canRun (int channel) -> bool {
+    return (DMAControl.raw >> (channel * 4 + 3)) & 1; // DPCR master enable bit of the channel
+}
+
+// Whether the device asks for the channel's next slice. Devices that always keep up with the bus aren't asked
+auto Bus::DMA_deviceReady (int channel) -> bool {
+    switch ((Device) channel) {
+        case Device::MDECIn: return mdec.dataInRequested();
+        case Device::MDECOut: return mdec.dataOutRequested (DMA_sliceWords (DMAChannels[channel]));
+        case Device::SPU: return spu.dmaRequested();
+        default: return true;
+    }
+}
+
+// Words the next slice of a sync mode 0 or 1 transfer moves
+auto Bus::DMA_sliceWords (const DMAChannel& dma) -> u32 {
+    const auto words = (SyncMode) dma.control.syncMode == SyncMode::SyncToDMARequests ? dma.blockWordsLeft : dma.wordsLeft;
+    return dma.control.chopping ? std::min (words, 1u << dma.control.choppingDMAWindowSize) : words;
+}
+
+auto Bus::DMA_priority (int channel) -> u32 {
+    return (DMAControl.raw >> (channel * 4)) & 7;
+}
+
+void Bus::DMA_step() {
+    const auto now = scheduler -> timestamp;
+    u64 wakeUp = ~0ull; // when the next channel that's waiting gets ready
+    int next = -1;
+
+    for (int channel = 6; channel >= 0; channel--) { // walking down, so on equal priorities the higher channel wins
+        auto& dma = DMAChannels[channel];
+        if (!dma.active)
+            continue;
+
+        if (dma.readyAt > now) {
+            wakeUp = std::min (wakeUp, dma.readyAt);
+            continue;
+        }
+
+        if (dma.finishing)
+            markDMAComplete (channel);
+
+        else if (DMA_canRun (channel) && DMA_deviceReady (channel) && (next == -1 || DMA_priority (channel) < DMA_priority (next)))
+            next = channel;
+    }
+
+    if (next == -1) {
+        if (wakeUp != ~0ull)
+            scheduler -> schedule (SchedulerEvent::DMA, wakeUp - now);
+
+        return;
+    }
+
+    const auto cycles = DMA_runSlice (next);
+    scheduler -> stall (cycles); // the CPU can't touch the bus while the slice is transferred
+    scheduler -> schedule (SchedulerEvent::DMA, cycles);
+}
+
+// Transfer the next slice of a channel's transfer, returns how many cycles it took
+auto Bus::DMA_runSlice (int channel) -> u32 {
+    auto& dma = DMAChannels[channel];
+    const auto device = (Device) channel;
+    const auto direction = (Direction) dma.control.direction;
+    const auto chopping = dma.control.chopping;
+    const auto choppedGap = 1u << dma.control.choppingCPUWindowSize;
+
+    u32 words = 0;
+    u32 gap = chopping ? choppedGap : 0; // cycles the CPU gets before the channel wants the bus again
+    bool done;
+
+    switch ((SyncMode) dma.control.syncMode) {
+        case SyncMode::Immediate:
+            words = DMA_sliceWords (dma);
+            DMA_transferWords (direction, device, dma, words);
+            done = dma.wordsLeft == 0;
+            break;
+
+        case SyncMode::SyncToDMARequests:
+            words = DMA_sliceWords (dma);
+            DMA_transferWords (direction, device, dma, words);
+            dma.blockWordsLeft -= words;
+
+            if (dma.blockWordsLeft == 0) { // block done, the device has to request the next one
+                dma.blockWordsLeft = dma.blockControl.blockSize;
+                dma.blockControl.blockAmount--; // the registers follow the transfer, so software can watch it progress
+                dma.baseAddr = dma.currentAddr;
+                gap = REQUEST_GAP[channel];
+            }
+
+            done = dma.wordsLeft == 0;
+            break;
+
+        default: // linked list, DMA_start has turned away the other modes
+            done = DMA_transferLLs (dma, words);
+            gap = REQUEST_GAP[channel];
+            break;
+    }
+
+    const auto cycles = std::max (words * CYCLES_PER_WORD[channel], 1u);
+    dma.finishing = done;
+    dma.readyAt = scheduler -> timestamp + cycles + (done ? 0 : gap);
+    return cycles;
 }
 
-void Bus::DMA_transferBlock (SyncMode syncMode, Direction direction, Device device, u32 offset, u32 baseAddr, s64 length) {
-    Helpers::debug_printf ("DMA requested\nSync mode: %d, direction: %s, device: %d\nOffset: %d, base addr: %08X, length in words: %08X\n",
-                            syncMode, direction ? "From RAM" : "To RAM", device, offset, baseAddr, length);
+// Move count words between RAM at dma.currentAddr and the device, advancing the channel past them
+void Bus::DMA_transferWords (Direction direction, Device device, DMAChannel& dma, u32 count) {
+    const u32 offset = dma.control.decrement ? -4 : 4; // if decrement bit is 0 => offset is 4. If 1 => offset is -4
+    auto addr = dma.currentAddr;
+    auto length = count;
 
     if (direction == ToRAM) {
         if (device ==  Device::OrderingTableClear) {
+            DMA_clearOrderingTable (dma, count);
+            return;
+        }
+
+        else if (device == Device::GPU) { // VRAM->RAM transfers, fed by GPUREAD
             while (length > 0) {
-                auto addr = baseAddr & 0x1F'FFFC; // Wrap around the WRAM, forcibly word-align the address
-                auto val = (length != 1) ? ((addr - 4) & 0x1FFFFF) : 0xFFFFFF; // the value to write to the OT is based on the current DMA addr and it's supposed to be a pointer to the previous entry
-                                                                               // the last unit however points to the end of the table (0xFF'FFFF)
-                                                                               // TODO: Optimize out the conditional, unconditionally set the last transferred word to 0xFFFFFF
-                *(u32*) &RAM[addr] = val; // write value to RAM
-                baseAddr += offset; // increment or decrement by 4 as appropriate
+                addr &= 0x1F'FFFC; // Wrap around the WRAM, forcibly word-align the address
+                *(u32*) &RAM[addr] = gpu -> gpuread();
+
+                addr += offset; // increment or decrement by 4 as appropriate
                 length -= 1; // decrement unit counter
             }
+
+            dma.wordsLeft -= count;
+        }
+
+        else if (device == Device::CDROM) { // sector data, out of the data FIFO
+            if (offset == 4) {
+                forEachSpan (RAM, addr, count, [&] (u32* words, u32 length) { cdrom.readData ((u8*) words, length * 4); });
+                addr += count * 4;
+            }
+
+            else {
+                while (length > 0) {
+                    addr &= 0x1F'FFFC;
+                    cdrom.readData (&RAM[addr], 4);
+                    addr += offset;
+                    length -= 1;
+                }
+            }
+
+            dma.wordsLeft -= count;
+        }
+
+        else if (device == Device::MDECOut) {
+            if (offset == 4) {
+                forEachSpan (RAM, addr, count, [&] (u32* words, u32 length) { mdec.readData (words, length); });
+                addr += count * 4;
+            }
+
+            else {
+                while (length > 0) {
+                    addr &= 0x1F'FFFC;
+                    *(u32*) &RAM[addr] = mdec.readData();
+                    addr += offset;
+                    length -= 1;
+                }
+            }
+
+            dma.wordsLeft -= count;
+        }
+
+        else if (device == Device::SPU) { // sound RAM, from the transfer address on
+            if (offset == 4) {
+                forEachSpan (RAM, addr, count, [&] (u32* words, u32 length) { spu.dmaRead (words, length); });
+                addr += count * 4;
+            }
+
+            else {
+                while (length > 0) {
+                    addr &= 0x1F'FFFC;
+                    spu.dmaRead ((u32*) &RAM[addr], 1);
+                    addr += offset;
+                    length -= 1;
+                }
+            }
+
+            dma.wordsLeft -= count;
         }
 
         else
@@ -57,62 +325,186 @@ void Bus::DMA_transferBlock (SyncMode syncMode, Direction direction, Device devi
 
     else { // DMA from RAM
         if (device == Device::GPU) {
-            while (length > 0) {
-                auto addr = baseAddr & 0x1F'FFFC; // Wrap around the WRAM, forcibly word-align the address
-                auto val = *(u32*) &RAM[addr]; // read 32 bits
-                gpu -> gp0_command(val);
+            if (offset == 4) { // incrementing transfers are contiguous in RAM
+                DMA_sendToGP0 (addr, count);
+                addr += count * 4;
+            }
+
+            else {
+                while (length > 0) {
+                    addr &= 0x1F'FFFC; // Wrap around the WRAM, forcibly word-align the address
+                    auto val = *(u32*) &RAM[addr]; // read 32 bits
+                    gpu -> gp0_command(val);
+
+                    addr += offset; // increment or decrement by 4 as appropriate
+                    length -= 1;  // decrement unit counter
+                }
+            }
+
+            dma.wordsLeft -= count;
+        }
 
-                baseAddr += offset; // increment or decrement by 4 as appropriate
-                length -= 1;  // decrement unit counter
+        else if (device == Device::MDECIn) {
+            if (offset == 4) {
+                forEachSpan (RAM, addr, count, [&] (const u32* words, u32 length) { mdec.writeCommands (words, length); });
+                addr += count * 4;
             }
+
+            else {
+                while (length > 0) {
+                    addr &= 0x1F'FFFC;
+                    mdec.writeCommand (*(u32*) &RAM[addr]);
+                    addr += offset;
+                    length -= 1;
+                }
+            }
+
+            dma.wordsLeft -= count;
+        }
+
+        else if (device == Device::SPU) {
+            if (offset == 4) {
+                forEachSpan (RAM, addr, count, [&] (const u32* words, u32 length) { spu.dmaWrite (words, length); });
+                addr += count * 4;
+            }
+
+            else {
+                while (length > 0) {
+                    addr &= 0x1F'FFFC;
+                    spu.dmaWrite ((const u32*) &RAM[addr], 1);
+                    addr += offset;
+                    length -= 1;
+                }
+            }
+
+            dma.wordsLeft -= count;
         }
 
         else
             Helpers::panic ("DMA from RAM to unknown device: %d\n", device);
     }
 
-    markDMAComplete((int) device); // signal that the DMA has finished
+    dma.currentAddr = addr & 0x1F'FFFC;
 }
 
-void Bus::DMA_transferLLs(Direction direction, Device device, u32 offset, u32 baseAddr) {
-    if (direction != Direction::FromRAM || device != Device::GPU || offset == 0xFFFFFFFC) {
-        Helpers::panic ("Weird Linked List DMA configuration.\nDirection: %s, device: %d, offset: %d", direction ? "From RAM" : "To RAM", device, offset);
+// Write count ordering table entries going down from dma.currentAddr. Each entry points at the one below it, and the last entry of the table
+// is the end marker. OTC always walks down, whatever the decrement bit says. Read upwards, a run of entries is a run of ascending pointers,
+// so everything between RAM wraps is filled with vector stores, and the end marker gets written on its own at the end
+void Bus::DMA_clearOrderingTable (DMAChannel& dma, u32 count) {
+    auto addr = dma.currentAddr;
+    auto length = count;
+
+    while (length > 0) {
+        const auto chunk = std::min (length, addr / 4 + 1); // entries left before the walk wraps past the start of RAM
+        const auto low = addr - (chunk - 1) * 4;
+        fillPointerChain ((u32*) &RAM[low], low - 4, chunk);
+
+        addr = (low - 4) & 0x1F'FFFC;
+        length -= chunk;
     }
 
-    Helpers::debug_printf ("Linked List DMA requested\nDirection: %s, device: %d\nOffset: %d, base addr: %08X\n",
-                            direction ? "From RAM" : "To RAM", device, offset, baseAddr);
+    dma.wordsLeft -= count;
+    if (dma.wordsLeft == 0)
+        *(u32*) &RAM[(addr + 4) & 0x1F'FFFC] = 0xFF'FFFF; // the last entry written ends the table
+
+    dma.currentAddr = addr;
+}
 
-    baseAddr &= 0x1F'FFFC; // force word-align address, mask so that addr wraps around VRAM
+// Send linked list nodes to the GPU until the list ends or the run is long enough. Returns whether the list ended, words is set to how many were read.
+// Every node header gets marked with the generation of the walk, so running into a marked one means the list loops back on itself.
+// The hardware would send that loop forever, here it's a fatal error that says where the loop is, instead of a hang
+auto Bus::DMA_transferLLs (DMAChannel& dma, u32& words) -> bool {
+    auto addr = dma.currentAddr;
     LinkedListNode node;
+    words = 0;
+
+    while (true) { // loop won't be broken till the last LL node gets encountered, or the run is over
+        if (LLVisited[addr / 4] == LLGeneration || ++LLNodes > LL_MAX_NODES)
+            Helpers::panic ("Linked list DMA loops back to node %06X (list starts at %06X, %u nodes sent)\n", addr, LLStart, LLNodes);
+
+        LLVisited[addr / 4] = LLGeneration;
+        node.raw = *(u32*) &RAM[addr]; // read a word. top byte of the word will show us how many commands to transfer to GPU
+        addr += 4; // increment pointer
+
+        const auto last = (node.next & 0x80'0000) != 0; // lists usually end with 0xFF'FFFF, but the DMA stops at any address with bit 23 set
+        const auto next = node.next & 0x1F'FFFC;
+        if (!last) { // get the next node's header and the start of its packet on the way while this one gets parsed
+            prefetch (&RAM[next]);
+            prefetch (&RAM[std::min <u32> (next + 64, 0x1F'FFFC)]);
+        }
+
+        DMA_sendToGP0 (addr, node.commandCount); // the node's commands follow its header
+        words += node.commandCount + 1;
+        LLStats.nodes++;
+        LLStats.emptyNodes += node.commandCount == 0;
+        LLStats.words += node.commandCount + 1;
 
-    while (true) { // loop won't be broken till a LL with a word count of 0xFF'FFFF gets encountered
-        node.raw = *(u32*) &RAM[baseAddr]; // read a word. top byte of the word will show us how many commands to transfer to GPU
-        baseAddr += 4; // increment pointer
-
-        while (node.commandCount > 0) {
-            baseAddr &= 0x1F'FFFC; // wrap addr around WRAM and force-align
-            auto command = *(u32*) &RAM[baseAddr]; // read a command from memory
-            std::printf ("GPU command %08X\n", command);
-            gpu -> gp0_command(command);
-            baseAddr += 4; // increment pointer
-            node.commandCount -= 1; // decrement command count
+        if (last) {
+            dma.baseAddr = 0xFF'FFFF; // the base address register is left holding the end marker
+            LLStats.lists++;
+            return true;
         }
 
-        if (node.next == 0xFF'FFFF) // 0xFF'FFFF is the marker of the last LL node
-            break; // so if we encounter this, end the DMA
+        addr = next; // start sending the next LL
+        if (words >= LL_SLICE_WORDS)
+            break;
+    }
+
+    dma.currentAddr = addr;
+    dma.baseAddr = addr; // the base address register points at the next node while the list is being walked
+    return false;
+}
+
+// The GPU parses the words right out of RAM
+void Bus::DMA_sendToGP0 (u32 addr, u32 count) {
+    forEachSpan (RAM, addr, count, [&] (const u32* words, u32 length) { gpu -> gp0_commands (words, length); });
+}
+
+auto Bus::readDMARegister (u32 address) -> u32 {
+    auto& dma = DMAChannels[(address >> 4) & 7]; // 0x1F801080 + channel * 0x10
 
-        baseAddr = node.next; // start sending the next LL
+    switch (address & 0xF) {
+        case 0: return dma.baseAddr;
+        case 4: return dma.blockControl.raw;
+        case 8: return dma.control.raw;
+        default: Helpers::warn ("Read from unused DMA register %08X\n", address); return 0;
     }
+}
+
+void Bus::writeToDICR (u32 val) {
+    auto& dicr = DMAInterruptControl;
+    dicr.raw = (dicr.raw & 0x7F00'0000 & ~val) | (val & 0x00FF'803F); // writing 1 to a flag acknowledges it, the master flag is read only
+    updateDMAIRQ();
+}
+
+// The master flag is set while an IRQ is forced, or while the master enable is on and any enabled channel has its flag set.
+// The DMA IRQ in I_STAT goes up when the master flag does
+void Bus::updateDMAIRQ() {
+    auto& dicr = DMAInterruptControl;
+    const bool wasSet = dicr.IRQMasterFlag;
+    const auto enabled = (dicr.raw >> 16) & 0x7F;
+    const auto flags = (dicr.raw >> 24) & 0x7F;
 
-    markDMAComplete((int) Device::GPU);
+    dicr.IRQMasterFlag = dicr.forceIRQ || (dicr.IRQMasterEnable && (enabled & flags) != 0);
+    if (!wasSet && dicr.IRQMasterFlag)
+        interruptStatus |= IRQ_DMA;
+}
+
+void Bus::newFrame() {
+    Helpers::debug_printf ("[DMA] %u linked lists, %u nodes (%u empty), %llu words\n",
+                           LLStats.lists, LLStats.nodes, LLStats.emptyNodes, (unsigned long long) LLStats.words);
+    lastFrameLLStats = LLStats;
+    LLStats = LinkedListStats();
 }
 
 void Bus::markDMAComplete (int channel) {
-    DMAChannels[channel].control.enable = 0; // turn off the busy bits
-    DMAChannels[channel].control.trigger = 0;
+    auto& dma = DMAChannels[channel];
+    dma.active = dma.finishing = false;
+    dma.control.enable = 0; // turn off the busy bits
+    dma.control.trigger = 0;
 
-    auto interruptSettings = DMAInterruptControl;
-    if (interruptSettings.forceIRQ || interruptSettings.IRQMasterEnable) { // Check if IRQs enabled for DMA and panic
-        Helpers::warn ("Tried to fire DMA interrupt\n");
-    }
+    if ((DMAInterruptControl.raw >> (16 + channel)) & 1) // the channel's flag only gets set if its IRQ is enabled
+        DMAInterruptControl.raw |= 1 << (24 + channel);
+
+    updateDMAIRQ();
 }
@@ -1,13 +1,99 @@
 #include <iostream>
 #include <chrono>
+#include <climits>
+#include <cstdlib>
 #include "include/psx.h"
+#include <string>
 #include "include/renderer.h"
+#include "include/helpers.h"
 
 constexpr auto CYCLES_PER_FRAME = 33'868'800 / 60 / 2;
 
+namespace {
+    // Numbers given to options. Anything that isn't a whole number in range panics, like bad values of the other options do
+    auto parseCount (const char* option, const char* value) -> u32 {
+        char* end;
+        const auto result = std::strtoull (value, &end, 10);
+        if (value[0] < '0' || value[0] > '9' || *end != '\0' || result > UINT_MAX)
+            Helpers::panic ("Bad value %s for %s (expected a whole number)\n", value, option);
+
+        return (u32) result;
+    }
+
+    auto parseMilliseconds (const char* option, const char* value) -> double {
+        char* end;
+        const auto result = std::strtod (value, &end);
+        if (end == value || *end != '\0' || !(result > 0.0))
+            Helpers::panic ("Bad value %s for %s (expected a positive number of milliseconds)\n", value, option);
+
+        return result;
+    }
+}
+
 auto main(int argc, char *argv[]) -> int {
-    auto psx = new PSX ("D:/Repos/Top secret/TopSecret/ROMs/CPUDIV.exe");
+    GPUConfig gpuConfig;
+    std::string discPath;
+    bool fastBoot = false;
+
+    for (int i = 1; i < argc; i++) {
+        const auto arg = std::string (argv[i]);
+
+        if (arg == "--renderer" && i + 1 < argc) { // --renderer null|software|window picks the renderer backend
+            if (!Renderer::parseType (argv[++i], gpuConfig.renderer))
+                Helpers::panic ("Unknown renderer %s (expected null, software or window)\n", argv[i]);
+        }
+
+        else if (arg == "--frame-cache") // skip drawing segments that were already drawn with the same inputs
+            gpuConfig.frameCache = true;
+
+        else if (arg == "--frameskip" && i + 1 < argc) { // --frameskip N skips N frames after each drawn one, --frameskip auto skips to stay in budget
+            const auto value = std::string (argv[++i]);
+            if (value == "auto")
+                gpuConfig.frameskip = FrameSkipMode::Auto;
+            else {
+                gpuConfig.frameskip = FrameSkipMode::Fixed;
+                gpuConfig.frameskipFixed = parseCount ("--frameskip", value.c_str());
+            }
+        }
+
+        else if (arg == "--frame-budget" && i + 1 < argc) // host time budget per frame for --frameskip auto, in ms
+            gpuConfig.frameBudget = parseMilliseconds ("--frame-budget", argv[++i]);
+
+        else if (arg == "--texture-layout" && i + 1 < argc) { // --texture-layout linear|tiled picks how decoded textures are stored
+            const auto value = std::string (argv[++i]);
+            if (value == "linear")
+                gpuConfig.textureLayout = TexelLayout::Linear;
+            else if (value == "tiled")
+                gpuConfig.textureLayout = TexelLayout::Tiled;
+            else
+                Helpers::panic ("Unknown texture layout %s (expected linear or tiled)\n", value.c_str());
+        }
+
+        else if (arg == "--scale" && i + 1 < argc) { // --scale 1|2|4 sets the internal resolution of the software renderer
+            gpuConfig.resolutionScale = parseCount ("--scale", argv[++i]);
+            if (gpuConfig.resolutionScale != 1 && gpuConfig.resolutionScale != 2 && gpuConfig.resolutionScale != 4)
+                Helpers::panic ("Unsupported resolution scale %s (expected 1, 2 or 4)\n", argv[i]);
+        }
+
+        else if (arg == "--downsample") // average the higher internal resolution back down to the native one when presenting
+            gpuConfig.downsample = true;
+
+        else if (arg == "--record-gpu" && i + 1 < argc) // log everything sent to the GPU, for tools/gpu_replay
+            gpuConfig.recordPath = argv[++i];
+
+        else if (arg == "--disc" && i + 1 < argc) // insert a disc image (.cue, .bin or .cdz)
+            discPath = argv[++i];
+
+        else if (arg == "--fast-boot") // boot the disc's EXE as soon as the kernel is up, skipping the shell
+            fastBoot = true;
+    }
+
+    auto psx = new PSX ("D:/Repos/Top secret/TopSecret/ROMs/CPUDIV.exe", gpuConfig);
     // psx -> sideload();
+    if (!discPath.empty())
+        psx -> insertDisc (discPath);
+    if (fastBoot)
+        psx -> fastBoot();
 
     while (true) {
         //auto start = std::chrono::system_clock::now();
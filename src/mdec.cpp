@@ -0,0 +1,475 @@
+#include <algorithm>
+#include "include/mdec.h"
+#include "include/helpers.h"
+#include "include/simd.h"
+
+namespace {
+    // zagzig[k] is where the k-th coefficient of a block's run goes in the 8x8 block
+    constexpr std::array <u8, 64> zagzig = {
+         0,  1,  8, 16,  9,  2,  3, 10,
+        17, 24, 32, 25, 18, 11,  4,  5,
+        12, 19, 26, 33, 40, 48, 41, 34,
+        27, 20, 13,  6,  7, 14, 21, 28,
+        35, 42, 49, 56, 57, 50, 43, 36,
+        29, 22, 15, 23, 30, 37, 44, 51,
+        58, 59, 52, 45, 38, 31, 39, 46,
+        53, 60, 61, 54, 47, 55, 62, 63
+    };
+
+    constexpr u16 END_OF_BLOCK = 0xFE00; // also used as padding between blocks
+
+    auto signed10 (u16 value) -> s32 {
+        return (s32) ((s16) (value << 6) >> 6);
+    }
+
+    auto pair (s16 low, s16 high) -> u32 {
+        return (u16) low | ((u32) (u16) high << 16);
+    }
+
+#if !defined(PSX_SSE2)
+    auto round16 (s32 sum) -> s16 { // drop the matrix's 16 fractional bits, saturating like packs does in the SIMD version
+        return (s16) std::clamp ((sum + 0x8000) >> 16, -0x8000, 0x7FFF);
+    }
+#endif
+}
+
+void MDEC::reset() {
+    command = Command::None;
+    paramsLeft = 0;
+    paramIndex = 0;
+    depth = MDECDepth::Bit4;
+    signedOutput = false;
+    setBit15 = false;
+    dataInEnabled = false;
+    dataOutEnabled = false;
+
+    input.clear();
+    inputPos = 0;
+    blockIndex = 0;
+    output.clear();
+    outputPos = 0;
+}
+
+void MDEC::writeControl (u32 value) {
+    if (value & (1u << 31)) // abort the current command, empty the FIFOs
+        reset();
+
+    dataInEnabled = (value >> 30) & 1;
+    dataOutEnabled = (value >> 29) & 1;
+}
+
+auto MDEC::readStatus() -> u32 {
+    constexpr std::array <u32, 6> statusBlocks = { 4, 5, 0, 1, 2, 3 }; // the status register numbers Y1-Y4 as 0-3, Cr as 4 and Cb as 5
+    const auto outputLeft = output.size() - outputPos;
+    const auto busy = command != Command::None || outputLeft != 0;
+
+    u32 status = 0;
+    status |= (u32) (outputLeft == 0) << 31;
+    status |= (u32) busy << 29;
+    status |= (u32) (dataInEnabled && command != Command::None) << 28;
+    status |= (u32) (dataOutEnabled && outputLeft != 0) << 27;
+    status |= (u32) depth << 25;
+    status |= (u32) signedOutput << 24;
+    status |= (u32) setBit15 << 23;
+    status |= (depth == MDECDepth::Bit4 || depth == MDECDepth::Bit8 ? 4 : statusBlocks[blockIndex]) << 16;
+    status |= (paramsLeft - 1) & 0xFFFF; // 0xFFFF once the last parameter is in
+
+    return status;
+}
+
+auto MDEC::readData() -> u32 {
+    if (outputPos == output.size()) {
+        Helpers::warn ("Read from empty MDEC output\n");
+        return 0;
+    }
+
+    const auto word = output[outputPos++];
+    if (outputPos == output.size()) {
+        output.clear();
+        outputPos = 0;
+    }
+
+    return word;
+}
+
+void MDEC::readData (u32* dest, size_t count) {
+    const auto available = std::min (count, output.size() - outputPos);
+    std::copy_n (&output[outputPos], available, dest);
+    outputPos += available;
+
+    if (outputPos == output.size()) {
+        output.clear();
+        outputPos = 0;
+    }
+
+    for (auto i = available; i < count; i++)
+        dest[i] = readData(); // warns about the underflow
+}
+
+void MDEC::startCommand (u32 word) {
+    paramIndex = 0;
+
+    switch (word >> 29) {
+        case 1:
+            command = Command::Decode;
+            paramsLeft = word & 0xFFFF;
+            depth = (MDECDepth) ((word >> 27) & 3);
+            signedOutput = (word >> 26) & 1;
+            setBit15 = (word >> 25) & 1;
+            blockIndex = 0;
+            break;
+
+        case 2:
+            command = Command::SetQuantTables;
+            paramsLeft = (word & 1) ? 32 : 16; // bit 0 picks whether the chroma table comes after the luma one
+            break;
+
+        case 3:
+            command = Command::SetScaleTable;
+            paramsLeft = 32;
+            break;
+
+        default: // no function
+            Helpers::warn ("Unknown MDEC command %08X\n", word);
+            command = Command::None;
+            paramsLeft = 0;
+            return;
+    }
+
+    if (paramsLeft == 0)
+        endCommand();
+}
+
+void MDEC::writeCommand (u32 word) {
+    writeCommands (&word, 1);
+}
+
+void MDEC::writeCommands (const u32* words, size_t count) {
+    while (count > 0) {
+        if (command == Command::None) {
+            startCommand (*words++);
+            count--;
+            continue;
+        }
+
+        const auto length = std::min <size_t> (count, paramsLeft);
+
+        switch (command) {
+            case Command::Decode:
+                for (size_t i = 0; i < length; i++) {
+                    input.push_back ((u16) words[i]);
+                    input.push_back ((u16) (words[i] >> 16));
+                }
+                break;
+
+            case Command::SetQuantTables:
+                for (size_t i = 0; i < length; i++) {
+                    for (u32 byte = 0; byte < 4; byte++) {
+                        const auto index = (paramIndex + i) * 4 + byte;
+                        (index < 64 ? lumaQuant[index] : chromaQuant[index - 64]) = (u8) (words[i] >> (byte * 8));
+                    }
+                }
+                break;
+
+            case Command::SetScaleTable:
+                for (size_t i = 0; i < length; i++) {
+                    scaleTable[(paramIndex + i) * 2] = (s16) words[i];
+                    scaleTable[(paramIndex + i) * 2 + 1] = (s16) (words[i] >> 16);
+                }
+                break;
+
+            default: break;
+        }
+
+        words += length;
+        count -= length;
+        paramIndex += (u32) length;
+        paramsLeft -= (u32) length;
+
+        if (command == Command::Decode)
+            decodeAvailable();
+
+        if (paramsLeft == 0)
+            endCommand();
+    }
+}
+
+void MDEC::endCommand() {
+    if (command == Command::SetScaleTable)
+        updateScalePairs();
+
+    // whatever's left of the decode input is padding, or a block the command got cut off in the middle of
+    input.clear();
+    inputPos = 0;
+    blockIndex = 0;
+    command = Command::None;
+}
+
+// The IDCT passes multiply pairs of 16-bit values and add them together (madd), so the matrix gets stored in pairs of rows.
+// rowPairs[p * 16 + x * 2 + n] = scaleTable[(p * 2 + n) * 8 + x], so one load gives both weights of every pixel in a row.
+// columnPairs[p * 8 + y] holds scaleTable[p * 2 * 8 + y] and scaleTable[(p * 2 + 1) * 8 + y], the 2 weights of a pixel in a column
+void MDEC::updateScalePairs() {
+    for (u32 p = 0; p < 4; p++) {
+        for (u32 x = 0; x < 8; x++) {
+            rowPairs[p * 16 + x * 2] = scaleTable[(p * 2) * 8 + x];
+            rowPairs[p * 16 + x * 2 + 1] = scaleTable[(p * 2 + 1) * 8 + x];
+            columnPairs[p * 8 + x] = pair (scaleTable[(p * 2) * 8 + x], scaleTable[(p * 2 + 1) * 8 + x]);
+        }
+    }
+}
+
+void MDEC::decodeAvailable() {
+    const auto colour = depth == MDECDepth::Bit24 || depth == MDECDepth::Bit15;
+
+    while (true) {
+        const auto& quant = (colour && blockIndex < 2) ? chromaQuant : lumaQuant; // Cr and Cb use the chroma table
+        if (!decodeBlock (blocks[blockIndex], quant))
+            break;
+
+        if (!colour)
+            outputMonochrome (blocks[0]);
+
+        else if (++blockIndex == 6) {
+            outputColour();
+            blockIndex = 0;
+        }
+    }
+
+    if (inputPos >= 4096) { // drop what's been decoded now and then, instead of shifting the input every block
+        input.erase (input.begin(), input.begin() + inputPos);
+        inputPos = 0;
+    }
+}
+
+// Decode the block starting at inputPos into pixels. If the input doesn't hold all of the block yet, nothing gets consumed and it returns false.
+// The first halfword of a block holds the quantization scale and the DC coefficient. Each halfword after it skips a number of zero coefficients
+// and then holds the next one, until the skips run past the 64th coefficient, which END_OF_BLOCK always does
+auto MDEC::decodeBlock (std::array <s16, 64>& block, const std::array <u8, 64>& quant) -> bool {
+    auto pos = inputPos;
+    while (pos < input.size() && input[pos] == END_OF_BLOCK) // padding
+        pos++;
+
+    if (pos == input.size())
+        return false;
+
+    alignas(32) std::array <s16, 64> coefficients;
+    coefficients.fill (0);
+
+    auto n = input[pos++];
+    const auto scale = (s32) (n >> 10);
+    auto value = signed10 (n) * quant[0];
+    u32 k = 0;
+
+    while (true) {
+        if (scale == 0) // a scale of 0 stores the coefficients as they are, in raster order
+            value = signed10 (n) * 2;
+
+        value = std::clamp (value, -0x400, 0x3FF);
+        coefficients[scale == 0 ? k : zagzig[k]] = (s16) value;
+
+        if (pos == input.size())
+            return false;
+
+        n = input[pos++];
+        k += (n >> 10) + 1;
+        if (k > 63)
+            break;
+
+        value = (signed10 (n) * quant[k] * scale + 4) / 8;
+    }
+
+    inputPos = pos;
+    idct (coefficients.data(), block.data());
+    return true;
+}
+
+// 2 passes of 1D IDCTs with the scale table, which holds the weights with 16 fractional bits: first along every row, then along every column.
+// The intermediate results are rounded back to 16 bits between the passes
+void MDEC::idct (const s16* coefficients, s16* pixels) {
+    alignas(32) std::array <s16, 64> rows;
+
+#if defined(PSX_SSE2)
+    [[maybe_unused]] const auto rounding = _mm_set1_epi32 (0x8000);
+
+    // Row pass. rows[r * 8 + x] = sum of coefficients[r * 8 + u] * scaleTable[u * 8 + x], 2 values of u per madd
+    for (u32 r = 0; r < 8; r++) {
+        const auto in = &coefficients[r * 8];
+
+#if defined(PSX_AVX2)
+        auto sum = _mm256_setzero_si256();
+        for (u32 p = 0; p < 4; p++) {
+            const auto weights = _mm256_loadu_si256 ((const __m256i*) &rowPairs[p * 16]);
+            sum = _mm256_add_epi32 (sum, _mm256_madd_epi16 (weights, _mm256_set1_epi32 ((s32) pair (in[p * 2], in[p * 2 + 1]))));
+        }
+
+        sum = _mm256_srai_epi32 (_mm256_add_epi32 (sum, _mm256_set1_epi32 (0x8000)), 16);
+        const auto low = _mm256_castsi256_si128 (sum);
+        const auto high = _mm256_extracti128_si256 (sum, 1);
+#else
+        auto low = _mm_setzero_si128(); // pixels 0-3
+        auto high = _mm_setzero_si128(); // pixels 4-7
+        for (u32 p = 0; p < 4; p++) {
+            const auto coefficientPair = _mm_set1_epi32 ((s32) pair (in[p * 2], in[p * 2 + 1]));
+            low = _mm_add_epi32 (low, _mm_madd_epi16 (_mm_loadu_si128 ((const __m128i*) &rowPairs[p * 16]), coefficientPair));
+            high = _mm_add_epi32 (high, _mm_madd_epi16 (_mm_loadu_si128 ((const __m128i*) &rowPairs[p * 16 + 8]), coefficientPair));
+        }
+
+        low = _mm_srai_epi32 (_mm_add_epi32 (low, rounding), 16);
+        high = _mm_srai_epi32 (_mm_add_epi32 (high, rounding), 16);
+#endif
+        _mm_store_si128 ((__m128i*) &rows[r * 8], _mm_packs_epi32 (low, high));
+    }
+
+    // Column pass. pixels[y * 8 + x] = sum of scaleTable[v * 8 + y] * rows[v * 8 + x]. Interleaving 2 rows lines up the pairs for madd
+    alignas (16) __m128i interleaved[8];
+    for (u32 p = 0; p < 4; p++) {
+        const auto even = _mm_load_si128 ((const __m128i*) &rows[p * 2 * 8]);
+        const auto odd = _mm_load_si128 ((const __m128i*) &rows[(p * 2 + 1) * 8]);
+        interleaved[p * 2] = _mm_unpacklo_epi16 (even, odd);
+        interleaved[p * 2 + 1] = _mm_unpackhi_epi16 (even, odd);
+    }
+
+    for (u32 y = 0; y < 8; y++) {
+#if defined(PSX_AVX2)
+        auto sum = _mm256_setzero_si256();
+        for (u32 p = 0; p < 4; p++) {
+            const auto values = _mm256_set_m128i (interleaved[p * 2 + 1], interleaved[p * 2]);
+            sum = _mm256_add_epi32 (sum, _mm256_madd_epi16 (values, _mm256_set1_epi32 ((s32) columnPairs[p * 8 + y])));
+        }
+
+        sum = _mm256_srai_epi32 (_mm256_add_epi32 (sum, _mm256_set1_epi32 (0x8000)), 16);
+        const auto low = _mm256_castsi256_si128 (sum);
+        const auto high = _mm256_extracti128_si256 (sum, 1);
+#else
+        auto low = _mm_setzero_si128();
+        auto high = _mm_setzero_si128();
+        for (u32 p = 0; p < 4; p++) {
+            const auto weights = _mm_set1_epi32 ((s32) columnPairs[p * 8 + y]);
+            low = _mm_add_epi32 (low, _mm_madd_epi16 (interleaved[p * 2], weights));
+            high = _mm_add_epi32 (high, _mm_madd_epi16 (interleaved[p * 2 + 1], weights));
+        }
+
+        low = _mm_srai_epi32 (_mm_add_epi32 (low, rounding), 16);
+        high = _mm_srai_epi32 (_mm_add_epi32 (high, rounding), 16);
+#endif
+        _mm_storeu_si128 ((__m128i*) &pixels[y * 8], _mm_packs_epi32 (low, high));
+    }
+#else
+    for (u32 r = 0; r < 8; r++) {
+        for (u32 x = 0; x < 8; x++) {
+            s32 sum = 0;
+            for (u32 u = 0; u < 8; u++)
+                sum += coefficients[r * 8 + u] * scaleTable[u * 8 + x];
+
+            rows[r * 8 + x] = round16 (sum);
+        }
+    }
+
+    for (u32 y = 0; y < 8; y++) {
+        for (u32 x = 0; x < 8; x++) {
+            s32 sum = 0;
+            for (u32 v = 0; v < 8; v++)
+                sum += scaleTable[v * 8 + y] * rows[v * 8 + x];
+
+            pixels[y * 8 + x] = round16 (sum);
+        }
+    }
+#endif
+}
+
+void MDEC::outputMonochrome (const std::array <s16, 64>& block) {
+    const auto bias = signedOutput ? 0 : 0x80;
+    std::array <u8, 64> luma;
+    for (u32 i = 0; i < 64; i++)
+        luma[i] = (u8) (std::clamp <s32> (block[i], -128, 127) ^ bias);
+
+    if (depth == MDECDepth::Bit8) {
+        for (u32 i = 0; i < 64; i += 4)
+            output.push_back (luma[i] | (luma[i + 1] << 8) | (luma[i + 2] << 16) | ((u32) luma[i + 3] << 24));
+    }
+
+    else { // 4-bit, the first pixel goes in the low nibble
+        for (u32 i = 0; i < 64; i += 8) {
+            u32 word = 0;
+            for (u32 pixel = 0; pixel < 8; pixel++)
+                word |= (u32) (luma[i + pixel] >> 4) << (pixel * 4);
+
+            output.push_back (word);
+        }
+    }
+}
+
+// YUV -> RGB for the 16x16 pixels of a macroblock. Cr and Cb cover the whole macroblock at half resolution, Y1-Y4 are its 4 quarters.
+//   R = Y + 1.402 Cr, G = Y - 0.3437 Cb - 0.7143 Cr, B = Y + 1.772 Cb
+// with the factors in 8.8 fixed point, clamped to signed 8 bits and then made unsigned unless signed output was asked for
+void MDEC::outputColour() {
+    const auto& cr = blocks[0];
+    const auto& cb = blocks[1];
+    const u8 bias = signedOutput ? 0 : 0x80;
+    alignas(16) std::array <u8, 16 * 16> red, green, blue;
+
+    for (u32 y = 0; y < 16; y++) {
+        for (u32 half = 0; half < 2; half++) { // 8 pixels at a time, the width of a Y block
+            const auto& luma = blocks[2 + (y / 8) * 2 + half];
+            const auto lumaRow = &luma[(y % 8) * 8];
+            const auto chroma = (y / 2) * 8 + half * 4;
+            const auto dest = y * 16 + half * 8;
+
+#if defined(PSX_SSE2)
+            // Every chroma value covers 2 pixels, and madd works on (Cr, Cb) pairs
+            auto crRow = _mm_loadl_epi64 ((const __m128i*) &cr[chroma]);
+            auto cbRow = _mm_loadl_epi64 ((const __m128i*) &cb[chroma]);
+            crRow = _mm_unpacklo_epi16 (crRow, crRow);
+            cbRow = _mm_unpacklo_epi16 (cbRow, cbRow);
+            const auto pairsLow = _mm_unpacklo_epi16 (crRow, cbRow);
+            const auto pairsHigh = _mm_unpackhi_epi16 (crRow, cbRow);
+
+            const auto convert = [&] (u32 factors) { // (Cr * factor0 + Cb * factor1) >> 8 for the 8 pixels
+                const auto weights = _mm_set1_epi32 ((s32) factors);
+                return _mm_packs_epi32 (_mm_srai_epi32 (_mm_madd_epi16 (pairsLow, weights), 8), _mm_srai_epi32 (_mm_madd_epi16 (pairsHigh, weights), 8));
+            };
+
+            const auto lumaValues = _mm_loadu_si128 ((const __m128i*) lumaRow);
+            const auto biasVector = _mm_set1_epi8 ((char) bias);
+            const auto r = _mm_packs_epi16 (_mm_adds_epi16 (lumaValues, convert (pair (359, 0))), _mm_setzero_si128());
+            const auto g = _mm_packs_epi16 (_mm_adds_epi16 (lumaValues, convert (pair (-183, -88))), _mm_setzero_si128());
+            const auto b = _mm_packs_epi16 (_mm_adds_epi16 (lumaValues, convert (pair (0, 454))), _mm_setzero_si128());
+
+            _mm_storel_epi64 ((__m128i*) &red[dest], _mm_xor_si128 (r, biasVector));
+            _mm_storel_epi64 ((__m128i*) &green[dest], _mm_xor_si128 (g, biasVector));
+            _mm_storel_epi64 ((__m128i*) &blue[dest], _mm_xor_si128 (b, biasVector));
+#else
+            for (u32 x = 0; x < 8; x++) {
+                const s32 crValue = cr[chroma + x / 2];
+                const s32 cbValue = cb[chroma + x / 2];
+                const s32 lumaValue = lumaRow[x];
+
+                red[dest + x] = (u8) (std::clamp (lumaValue + ((crValue * 359) >> 8), -128, 127) ^ bias);
+                green[dest + x] = (u8) (std::clamp (lumaValue + ((crValue * -183 + cbValue * -88) >> 8), -128, 127) ^ bias);
+                blue[dest + x] = (u8) (std::clamp (lumaValue + ((cbValue * 454) >> 8), -128, 127) ^ bias);
+            }
+#endif
+        }
+    }
+
+    if (depth == MDECDepth::Bit24) {
+        const auto first = output.size();
+        output.resize (first + 16 * 16 * 3 / 4);
+        auto bytes = (u8*) &output[first];
+
+        for (u32 i = 0; i < 16 * 16; i++) {
+            *bytes++ = red[i];
+            *bytes++ = green[i];
+            *bytes++ = blue[i];
+        }
+    }
+
+    else {
+        const u32 bit15 = setBit15 ? 0x8000 : 0;
+        for (u32 i = 0; i < 16 * 16; i += 2) {
+            const u32 first = (red[i] >> 3) | ((green[i] >> 3) << 5) | ((blue[i] >> 3) << 10) | bit15;
+            const u32 second = (red[i + 1] >> 3) | ((green[i + 1] >> 3) << 5) | ((blue[i + 1] >> 3) << 10) | bit15;
+            output.push_back (first | (second << 16));
+        }
+    }
+}
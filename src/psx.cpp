@@ -1,9 +1,38 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include "include/psx.h"
 #include "include/helpers.h"
+#include "include/iso9660.h"
 
-PSX::PSX(std::string directory) {
-    gpu = new class GPU();
-    bus = new Bus(gpu);
+namespace {
+    // The path of the EXE in a SYSTEM.CNF line like "BOOT = cdrom:\SLUS_000.01;1", or an empty string if the line isn't a BOOT line
+    auto parseBootLine (const std::string& line) -> std::string {
+        const auto equals = line.find ('=');
+        if (equals == std::string::npos)
+            return "";
+
+        auto key = line.substr (0, equals);
+        key.erase (std::remove_if (key.begin(), key.end(), [] (unsigned char c) { return std::isspace (c); }), key.end());
+        std::transform (key.begin(), key.end(), key.begin(), [] (unsigned char c) { return (char) std::toupper (c); });
+        if (key != "BOOT")
+            return "";
+
+        auto value = line.substr (equals + 1);
+        if (const auto colon = value.find (':'); colon != std::string::npos) // drop the device, cdrom: or cdrom0:
+            value.erase (0, colon + 1);
+
+        const auto start = value.find_first_not_of (" \t");
+        if (start == std::string::npos)
+            return "";
+        return value.substr (start, value.find_first_of (" \t\r", start) - start); // anything after the path is arguments
+    }
+}
+
+PSX::PSX(std::string directory, const GPUConfig& gpuConfig) {
+    scheduler = new Scheduler();
+    gpu = new class GPU(gpuConfig);
+    bus = new Bus(gpu, scheduler);
     cpu = new CPU(bus);
 
     auto ROM = Helpers::loadROM (directory);
@@ -11,27 +40,85 @@ PSX::PSX(std::string directory) {
 }
 
 void PSX::step() {
+    if (bootPending && cpu -> pc() == SHELL_ENTRY)
+        bootDisc();
+
     cpu -> step();
+    scheduler -> addCycles (CYCLES_PER_STEP); // runs DMA and whatever else is due
+}
+
+void PSX::insertDisc (const std::string& path) {
+    bus -> insertDisc (Disc::open (path));
+}
+
+void PSX::fastBoot() {
+    if (bus -> disc() == nullptr)
+        Helpers::panic ("Can't boot from the disc without a disc\n");
+
+    bootPending = true;
+}
+
+// Does what the shell would after the license screens: reads SYSTEM.CNF to find the EXE (PSX.EXE if there's no SYSTEM.CNF) and starts it
+void PSX::bootDisc() {
+    bootPending = false;
+    ISO9660 filesystem (*bus -> disc());
+
+    std::string path = "PSX.EXE";
+    if (const auto config = filesystem.readFile ("SYSTEM.CNF")) {
+        const auto text = std::string (config -> begin(), config -> end());
+        size_t start = 0;
+
+        while (start < text.size()) {
+            auto end = text.find ('\n', start);
+            if (end == std::string::npos)
+                end = text.size();
+
+            if (const auto boot = parseBootLine (text.substr (start, end - start)); !boot.empty()) {
+                path = boot;
+                break;
+            }
+
+            start = end + 1;
+        }
+    }
+
+    const auto exe = filesystem.readFile (path);
+    if (!exe)
+        Helpers::panic ("Disc has no boot executable %s\n", path.c_str());
+
+    std::printf ("Booting %s from the disc\n", path.c_str());
+    loadEXE (*exe);
 }
 
 void PSX::render() {
-    gpu -> renderer.draw();
+    gpu -> endFrame();
+    bus -> newFrame();
 }
 
 void PSX::sideload() {
-    auto exe_header = (PSX_EXE_HEADER*) bus -> ROM.data();
+    loadEXE (bus -> ROM);
+}
 
-    if (exe_header -> keyword != 0x45584520582D5350) { // The magic value for the string 'PS-X EXE' in ASCII
+// The EXE's code and data follow its 2KB header, and get copied into RAM in one go
+void PSX::loadEXE (const std::vector <u8>& exe) {
+    if (exe.size() < 0x800)
         Helpers::panic ("Invalid PSX exe\n");
-    }
 
-    auto initialPC = exe_header -> initialPC;
-    auto initialGP = exe_header -> initialGP;
-    auto initialSP = exe_header -> sp_base + exe_header -> sp_offs;
+    PSX_EXE_HEADER exe_header;
+    std::memcpy (&exe_header, exe.data(), sizeof (PSX_EXE_HEADER));
 
-    cpu -> sideload_init_regs(initialPC, initialSP, initialGP);
-    for (int i = 0; i < exe_header -> size; i++) {
-        auto val = bus -> ROM[0x800 + i];
-        bus -> write8 (exe_header -> dest + i, val);
+    if (exe_header.keyword != 0x45584520582D5350) { // The magic value for the string 'PS-X EXE' in ASCII
+        Helpers::panic ("Invalid PSX exe\n");
     }
+
+    if (exe_header.memfillSize != 0) {
+        const std::vector <u8> zeroes (std::min <u32> (exe_header.memfillSize, 0x20'0000), 0);
+        bus -> loadToRAM (exe_header.memfillStart, zeroes.data(), zeroes.size());
+    }
+
+    const auto size = std::min <size_t> (exe_header.size, exe.size() - 0x800);
+    bus -> loadToRAM (exe_header.dest, &exe[0x800], size);
+
+    auto initialSP = exe_header.sp_base != 0 ? exe_header.sp_base + exe_header.sp_offs : DEFAULT_STACK;
+    cpu -> sideload_init_regs (exe_header.initialPC, initialSP, exe_header.initialGP);
 }
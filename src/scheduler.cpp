@@ -0,0 +1,43 @@
+#include <algorithm>
+#include "include/scheduler.h"
+
+Scheduler::Scheduler() {
+    deadlines.fill (NEVER);
+}
+
+void Scheduler::setHandler (SchedulerEvent event, std::function <void()> handler) {
+    handlers[(size_t) event] = std::move (handler);
+}
+
+void Scheduler::updateNextDeadline() {
+    nextDeadline = *std::min_element (deadlines.begin(), deadlines.end());
+}
+
+void Scheduler::schedule (SchedulerEvent event, u64 cycles) {
+    deadlines[(size_t) event] = timestamp + cycles;
+    updateNextDeadline();
+}
+
+void Scheduler::cancel (SchedulerEvent event) {
+    deadlines[(size_t) event] = NEVER;
+    updateNextDeadline();
+}
+
+// Fire every event that's due, earliest first. Handlers can schedule events again, including ones that are already due.
+// Cycles the CPU stalled for are only skipped once the events that were due before the stall have run, so those fire at their own time
+void Scheduler::runDueEvents() {
+    while (true) {
+        while (timestamp >= nextDeadline) {
+            const auto event = (size_t) (std::min_element (deadlines.begin(), deadlines.end()) - deadlines.begin());
+            deadlines[event] = NEVER;
+            updateNextDeadline();
+            handlers[event]();
+        }
+
+        if (pendingStall == 0)
+            return;
+
+        timestamp += pendingStall;
+        pendingStall = 0;
+    }
+}
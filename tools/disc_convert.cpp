@@ -0,0 +1,61 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "include/compressed_disc.h"
+#include "include/disc.h"
+#include "include/helpers.h"
+
+/*
+ * Converts a BIN/CUE disc image to a compressed disc image (see include/compressed_disc.h).
+ * With --verify, the written image is opened again and every sector is compared against the original.
+ * Usage: disc_convert <input .cue or .bin> <output .cdz> [--hunk-sectors 1-64] [--verify]
+*/
+
+auto main (int argc, char* argv[]) -> int {
+    if (argc < 3) {
+        std::printf ("Usage: %s <input .cue or .bin> <output .cdz> [--hunk-sectors 1-64] [--verify]\n", argv[0]);
+        return 1;
+    }
+
+    auto hunkSectors = CompressedDiscFormat::DEFAULT_HUNK_SECTORS;
+    bool verify = false;
+
+    for (int i = 3; i < argc; i++) {
+        const auto arg = std::string (argv[i]);
+
+        if (arg == "--hunk-sectors" && i + 1 < argc) {
+            char* end;
+            const auto value = argv[++i];
+            const auto parsed = std::strtoul (value, &end, 10);
+            if (end == value || *end != '\0' || parsed == 0 || parsed > CompressedDiscFormat::MAX_HUNK_SECTORS)
+                Helpers::panic ("Bad value %s for --hunk-sectors (expected 1 to %u)\n", value, CompressedDiscFormat::MAX_HUNK_SECTORS);
+            hunkSectors = (u32) parsed;
+        }
+
+        else if (arg == "--verify")
+            verify = true;
+        else
+            Helpers::panic ("Unknown option %s\n", arg.c_str());
+    }
+
+    const auto source = Disc::open (argv[1]);
+    const auto stats = CompressedDisc::convert (*source, argv[2], hunkSectors);
+    std::printf ("%u hunks (%u stored uncompressed), %llu -> %llu bytes (%.1f%%)\n", stats.hunks, stats.storedHunks,
+                 (unsigned long long) stats.inputBytes, (unsigned long long) stats.outputBytes, 100.0 * stats.outputBytes / stats.inputBytes);
+
+    if (verify) {
+        CompressedDisc compressed (argv[2]);
+        std::vector <u8> expected (Disc::SECTOR_SIZE), actual (Disc::SECTOR_SIZE);
+
+        for (u32 sector = 0; sector < source -> leadOut(); sector++) {
+            source -> readSector (sector, expected.data());
+            compressed.readSector (sector, actual.data());
+            if (expected != actual)
+                Helpers::panic ("Sector %u doesn't match the original\n", sector);
+        }
+
+        std::printf ("Verified %u sectors\n", source -> leadOut());
+    }
+}
@@ -0,0 +1,18 @@
+# Converter from BIN/CUE disc images to compressed disc images (.cdz)
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += \
+    disc_convert.cpp \
+    ../src/CDROM/compressed_disc.cpp \
+    ../src/CDROM/disc.cpp
+
+HEADERS += \
+    ../include/compressed_disc.h \
+    ../include/disc.h \
+    ../include/helpers.h \
+    ../include/types.h
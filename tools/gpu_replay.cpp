@@ -0,0 +1,147 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "include/gpu.h"
+#include "include/gpu_recorder.h"
+#include "include/software_renderer.h"
+#include "include/helpers.h"
+
+/*
+ * Replays a GPU log recorded with --record-gpu (see include/gpu_recorder.h) into a fresh GPU as fast as possible.
+ * Prints the VRAM hash after every frame, so logs can be used as regression tests, and the throughput of the whole run.
+ * Only the replay itself is timed, not loading the log or hashing VRAM.
+ * Usage: gpu_replay <log> [--renderer null|software] [--scale 1|2|4] [--texture-layout linear|tiled] [--frame-cache] [--quiet]
+*/
+
+namespace {
+    auto hashVRAM (const VRAM& vram) -> u64 { // FNV-1a over every pixel
+        u64 hash = 0xCBF2'9CE4'8422'2325;
+        for (auto pixel : vram.pixels) {
+            hash ^= pixel;
+            hash *= 0x100'0000'01B3;
+        }
+
+        return hash;
+    }
+}
+
+auto main (int argc, char* argv[]) -> int {
+    if (argc < 2) {
+        std::printf ("Usage: %s <log> [--renderer null|software] [--scale 1|2|4] [--texture-layout linear|tiled] [--frame-cache] [--quiet]\n", argv[0]);
+        return 1;
+    }
+
+    GPUConfig config;
+    config.renderer = RendererType::Software;
+    bool quiet = false; // only print the summary
+
+    for (int i = 2; i < argc; i++) {
+        const auto arg = std::string (argv[i]);
+
+        if (arg == "--renderer" && i + 1 < argc) {
+            if (!Renderer::parseType (argv[++i], config.renderer) || config.renderer == RendererType::Window)
+                Helpers::panic ("Unsupported renderer %s (expected null or software)\n", argv[i]);
+        }
+
+        else if (arg == "--scale" && i + 1 < argc) {
+            const auto value = std::string (argv[++i]);
+            if (value != "1" && value != "2" && value != "4")
+                Helpers::panic ("Unsupported resolution scale %s (expected 1, 2 or 4)\n", value.c_str());
+            config.resolutionScale = (u32) (value[0] - '0');
+        }
+
+        else if (arg == "--texture-layout" && i + 1 < argc)
+            config.textureLayout = std::string (argv[++i]) == "tiled" ? TexelLayout::Tiled : TexelLayout::Linear;
+        else if (arg == "--frame-cache")
+            config.frameCache = true;
+        else if (arg == "--quiet")
+            quiet = true;
+        else
+            Helpers::panic ("Unknown option %s\n", arg.c_str());
+    }
+
+    std::ifstream file (argv[1], std::ios::binary);
+    if (!file.is_open())
+        Helpers::panic ("Couldn't open GPU log %s\n", argv[1]);
+
+    const std::vector <u8> log ((std::istreambuf_iterator <char> (file)), std::istreambuf_iterator <char>());
+    size_t offset = 0;
+
+    auto read32 = [&]() -> u32 {
+        if (offset + sizeof(u32) > log.size())
+            Helpers::panic ("GPU log is truncated at offset %zu\n", offset);
+
+        u32 value;
+        std::memcpy (&value, &log[offset], sizeof(u32));
+        offset += sizeof(u32);
+        return value;
+    };
+
+    if (read32() != GPULog::MAGIC || read32() != GPULog::VERSION)
+        Helpers::panic ("%s isn't a GPU log, or was recorded by a different version\n", argv[1]);
+
+    std::vector <u32> words; // the current GP0Words record
+    auto gpu = std::make_unique <GPU> (config);
+    const auto software = dynamic_cast <SoftwareRenderer*> (gpu -> renderer.get()); // null if nothing gets drawn
+
+    using Clock = std::chrono::steady_clock;
+    double seconds = 0.0;
+    u32 frames = 0;
+    u64 primitives = 0, pixels = 0;
+    auto start = Clock::now();
+
+    while (offset < log.size()) {
+        const auto record = (GPULog::Record) log[offset++];
+
+        switch (record) {
+            case GPULog::Record::GP0Words: {
+                const auto count = read32();
+                if (offset + (size_t) count * sizeof(u32) > log.size())
+                    Helpers::panic ("GPU log is truncated at offset %zu\n", offset);
+
+                // The whole record goes through gp0_commands, like DMA does. Records aren't 4-byte aligned in the log, so copy it out first
+                words.resize (count);
+                std::memcpy (words.data(), &log[offset], (size_t) count * sizeof(u32));
+                offset += (size_t) count * sizeof(u32);
+                gpu -> gp0_commands (words.data(), count);
+                break;
+            }
+
+            case GPULog::Record::GP1Word: gpu -> gp1_command (read32()); break;
+
+            case GPULog::Record::GPURead: {
+                const auto count = read32();
+                for (u32 i = 0; i < count; i++)
+                    gpu -> gpuread();
+                break;
+            }
+
+            case GPULog::Record::Frame:
+                gpu -> endFrame();
+                seconds += std::chrono::duration <double> (Clock::now() - start).count();
+
+                if (software) {
+                    primitives += software -> cullStats().drawn;
+                    pixels += software -> cullStats().pixels;
+                }
+
+                if (!quiet)
+                    std::printf ("Frame %u: VRAM hash %016llX\n", frames, (unsigned long long) hashVRAM (gpu -> vram));
+
+                frames++;
+                start = Clock::now();
+                break;
+
+            default: Helpers::panic ("Unknown GPU log record %02X at offset %zu\n", (u32) record, offset - 1);
+        }
+    }
+
+    seconds += std::chrono::duration <double> (Clock::now() - start).count();
+    std::printf ("Final VRAM hash %016llX\n", (unsigned long long) hashVRAM (gpu -> vram));
+    std::printf ("%u frames in %.3f s (%.1f fps), %.0f primitives/s, %.0f pixels/s (quads count as 2 primitives)\n",
+                 frames, seconds, frames / seconds, primitives / seconds, pixels / seconds);
+}
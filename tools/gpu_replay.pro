@@ -0,0 +1,46 @@
+# Standalone replayer for GPU logs recorded with --record-gpu. Only needs the GPU, so it builds without SFML
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+DEFINES += PSX_HEADLESS
+INCLUDEPATH += $$PWD/..
+
+SOURCES += \
+    gpu_replay.cpp \
+    ../src/GPU/display.cpp \
+    ../src/GPU/draw_calls.cpp \
+    ../src/GPU/frame_cache.cpp \
+    ../src/GPU/frameskip.cpp \
+    ../src/GPU/gp0.cpp \
+    ../src/GPU/gp1.cpp \
+    ../src/GPU/gpu.cpp \
+    ../src/GPU/gpu_recorder.cpp \
+    ../src/GPU/rasterizer.cpp \
+    ../src/GPU/renderer.cpp \
+    ../src/GPU/software_renderer.cpp \
+    ../src/GPU/span_kernels.cpp \
+    ../src/GPU/texture_cache.cpp \
+    ../src/GPU/upscaler.cpp \
+    ../src/GPU/vram.cpp
+
+HEADERS += \
+    ../include/display.h \
+    ../include/draw_state.h \
+    ../include/frame_cache.h \
+    ../include/frameskip.h \
+    ../include/gpu.h \
+    ../include/gpu_recorder.h \
+    ../include/helpers.h \
+    ../include/null_renderer.h \
+    ../include/rasterizer.h \
+    ../include/renderer.h \
+    ../include/simd.h \
+    ../include/software_renderer.h \
+    ../include/span_kernels.h \
+    ../include/texture_cache.h \
+    ../include/types.h \
+    ../include/upscaler.h \
+    ../include/vertex_arena.h \
+    ../include/vram.h
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <random>
+#include <vector>
+#include "include/spu.h"
+
+/*
+ * Checks that the SPU's block reverb (reverbBlock) gives exactly what running psx-spx's reverb one access at a time (reverbStep)
+ * does. Every configuration plays the same ADPCM noise and CD audio through the reverb twice, once with setReverbReference on,
+ * and compares the mixed output and the whole sound RAM (where the work area lives) between the two runs.
+ * Configurations are the BIOS's "Room" preset plus random layouts with short, overlapping and long delays at random work area
+ * bases, with reverb writes turned off for a while in the middle.
+ * Usage: reverb_check [seeds per layout, 40 by default]
+*/
+
+namespace {
+    constexpr u32 SPU_BASE = 0x1F801C00;
+    constexpr u32 RAM_SIZE = 512 * 1024;
+
+    // The "Room" preset from psx-spx, 1DC0-1DFF in register order
+    constexpr u16 ROOM[32] = {
+        0x007D, 0x005B, 0x6D80, 0x54B8, 0xBED0, 0x0000, 0x0000, 0xBA80, 0x5800, 0x5300, 0x04D6, 0x0333, 0x03F0, 0x0227, 0x0374, 0x01EF,
+        0x0334, 0x01B5, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x01B4, 0x0136, 0x00B8, 0x005C, 0x8000, 0x8000
+    };
+    constexpr u16 ROOM_BASE = (RAM_SIZE - 0x26C0) / 8;
+
+    enum class Layout { Room, Short, Overlapping, Long };
+
+    struct Result {
+        u64 outputHash;
+        u64 ramHash;
+    };
+
+    void hash (u64& value, u16 halfword) { // FNV-1a
+        value ^= halfword;
+        value *= 0x100'0000'01B3;
+    }
+
+    auto run (Layout layout, u32 seed, bool reference) -> Result {
+        Scheduler scheduler;
+        AudioRing cdAudio, output;
+        SPU spu (&scheduler, cdAudio, [] {});
+        spu.setOutput (&output);
+        spu.setReverbReference (reference);
+
+        std::mt19937 rng (seed);
+        const auto write = [&] (u32 offset, u16 value) { spu.write16 (SPU_BASE + offset, value); };
+
+        // 64 blocks of random ADPCM at 1000, looping back to the start
+        std::vector <u8> samples (64 * 16);
+        for (u32 block = 0; block < 64; block++) {
+            auto data = &samples[block * 16];
+            data[0] = (rng() % 13) | ((rng() % 5) << 4); // shift and filter
+            data[1] = block == 63 ? 3 : block == 0 ? 4 : 0; // loop end + repeat, loop start
+            for (u32 i = 2; i < 16; i++)
+                data[i] = (u8) rng();
+        }
+
+        write (0x1AA, 0xC000);
+        write (0x1A6, 0x1000 / 8);
+        write (0x1AA, 0xC020); // DMA write
+        spu.dmaWrite ((const u32*) samples.data(), samples.size() / 4);
+        write (0x1AA, 0xC080);
+
+        u16 registers[32];
+        if (layout == Layout::Room)
+            std::copy (std::begin (ROOM), std::end (ROOM), registers);
+        else {
+            const u32 range = layout == Layout::Short ? 0x40 : layout == Layout::Overlapping ? 0x8 : 0x800;
+            for (u32 i = 0; i < 32; i++) {
+                const bool volume = (i >= 2 && i <= 9) || i >= 30;
+                registers[i] = volume ? (u16) rng() : (u16) (rng() % range);
+            }
+        }
+
+        for (u32 i = 0; i < 32; i++)
+            write (0x1C0 + i * 2, registers[i]);
+        write (0x1A2, layout == Layout::Room ? ROOM_BASE : (u16) (0x1000 + rng() % 0xEFFF));
+        write (0x184, 0x5000); // reverb output volume
+        write (0x186, 0x4800);
+        write (0x180, 0x3FFF); // main volume
+        write (0x182, 0x3FFF);
+        write (0x1B0, 0x7FFF); // CD volume
+        write (0x1B2, 0x7FFF);
+
+        for (u32 voice = 0; voice < 6; voice++) {
+            const auto base = voice * 16;
+            write (base + 0x0, 0x3000); // volume
+            write (base + 0x2, 0x2800);
+            write (base + 0x4, 0x600 + rng() % 0x1800); // pitch
+            write (base + 0x6, 0x1000 / 8 + (rng() % 32) * 2); // start address
+            write (base + 0x8, 0x00FF); // ADSR
+            write (base + 0xA, 0x0000);
+        }
+
+        write (0x198, 0x2F); // reverb on for voices 0-3 and 5
+        write (0x1AA, 0xC085); // CD audio and CD reverb on, reverb writes on
+        for (u32 i = 0; i < 5000; i++)
+            cdAudio.push ({ (s16) rng(), (s16) rng() });
+        write (0x188, 0x3F); // key on
+
+        Result result { 0xCBF2'9CE4'8422'2325, 0xCBF2'9CE4'8422'2325 };
+        for (u32 step = 0; step < 6000; step++) {
+            scheduler.addCycles (200 + rng() % 1500);
+            if (step == 3000)
+                write (0x1AA, 0xC005); // reverb writes off
+            else if (step == 4000)
+                write (0x1AA, 0xC085);
+
+            StereoSample sample;
+            while (output.pop (&sample, 1)) {
+                hash (result.outputHash, (u16) sample.left);
+                hash (result.outputHash, (u16) sample.right);
+            }
+        }
+
+        // Read sound RAM back with a DMA read from 0
+        std::vector <u32> ram (RAM_SIZE / 4);
+        write (0x1A6, 0);
+        write (0x1AA, 0xC0B5);
+        spu.dmaRead (ram.data(), ram.size());
+        for (auto word : ram) {
+            hash (result.ramHash, (u16) word);
+            hash (result.ramHash, (u16) (word >> 16));
+        }
+
+        return result;
+    }
+}
+
+auto main (int argc, char* argv[]) -> int {
+    unsigned long seeds = 40;
+    char* end = nullptr;
+    if (argc == 2)
+        seeds = std::strtoul (argv[1], &end, 10);
+
+    if (argc > 2 || (argc == 2 && (end == argv[1] || *end != '\0')) || seeds == 0 || seeds > 1'000'000) {
+        std::printf ("Usage: %s [seeds per layout, 40 by default]\n", argv[0]);
+        return 1;
+    }
+
+    const char* names[] = { "room", "short", "overlapping", "long" };
+    u32 configurations = 0, mismatches = 0;
+
+    for (u32 layout = 0; layout < 4; layout++) {
+        for (u32 seed = 1; seed <= (u32) seeds; seed++) { // Room only takes its voices and CD audio from the seed
+            const auto reference = run ((Layout) layout, seed, true);
+            const auto block = run ((Layout) layout, seed, false);
+            configurations++;
+
+            if (reference.outputHash != block.outputHash || reference.ramHash != block.ramHash) {
+                mismatches++;
+                std::printf ("Mismatch: %s layout, seed %u (output %016llX vs %016llX, sound RAM %016llX vs %016llX)\n", names[layout], seed,
+                             (unsigned long long) reference.outputHash, (unsigned long long) block.outputHash,
+                             (unsigned long long) reference.ramHash, (unsigned long long) block.ramHash);
+            }
+        }
+    }
+
+    std::printf ("%u of %u configurations match\n", configurations - mismatches, configurations);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+# Checks the SPU's block reverb against the one tick at a time reference. Only needs the SPU, so it builds without SFML
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+DEFINES += PSX_HEADLESS
+INCLUDEPATH += $$PWD/..
+
+SOURCES += \
+    reverb_check.cpp \
+    ../src/SPU/reverb.cpp \
+    ../src/SPU/spu.cpp \
+    ../src/scheduler.cpp
+
+HEADERS += \
+    ../include/audio_ring.h \
+    ../include/helpers.h \
+    ../include/scheduler.h \
+    ../include/simd.h \
+    ../include/spu.h \
+    ../include/types.h